@@ -0,0 +1,79 @@
+/*! \file main.cpp
+ *  \brief Heap allocations of Incppect::update() once the subscriptions are stable
+ *
+ *  Replaces the global operator new to count the allocations made during the update passes. Exits with a non-zero
+ *  status if any pass after the warm-up allocated.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#define INCPPECT_BENCH_COUNT_ALLOCS
+#include "../common.h"
+
+using bench::incppect;
+
+int main(int argc, char** argv)
+{
+   printf("Usage: %s [n_clients] [n_requests] [payload_bytes] [change_ratio] [n_ticks]\n", argv[0]);
+
+   const int n_clients = argc > 1 ? atoi(argv[1]) : 4;
+   const int n_requests = argc > 2 ? atoi(argv[2]) : 1000;
+   const int payload_bytes = argc > 3 ? atoi(argv[3]) : 512;
+   const double change_ratio = argc > 4 ? atof(argv[4]) : 0.1;
+   const int n_ticks = argc > 5 ? atoi(argv[5]) : 1000;
+
+   incppect server;
+
+   std::vector<char> data(size_t(n_requests) * payload_bytes);
+   server.var("/data/{}", [&](const std::vector<int>& idxs) {
+      return std::string_view{data.data() + size_t(idxs[0]) * payload_bytes, size_t(payload_bytes)};
+   });
+   server.var("/counter", [&](const std::vector<int>&) { return incpp::view(int64_t(server.n_passes)); });
+   const int32_t getter_id = server.pathToGetter["/data/{}"];
+   const int32_t counter_id = server.pathToGetter["/counter"];
+
+   // /counter as request 0, /data/i as request i + 1
+   auto msg_register = bench::registration(getter_id, n_requests, 1);
+   msg_register.insert(msg_register.begin() + 1, {0, counter_id, 0});
+   const auto msg_request = bench::request_list(n_requests + 1);
+   for (int client_id = 1; client_id <= n_clients; ++client_id) {
+      bench::add_client(server, *server.shards[0], client_id, msg_register, msg_request);
+   }
+
+   std::mt19937 rng(1234);
+   const auto step = [&] {
+      const size_t n_changed = size_t(change_ratio * n_requests);
+      for (size_t k = 0; k < n_changed; ++k) {
+         data[(rng() % n_requests) * payload_bytes + rng() % payload_bytes] += 1;
+      }
+      server.update();
+   };
+
+   // the first passes size the buffers
+   const int n_warmup = 10;
+   for (int tick = 0; tick < n_warmup; ++tick) {
+      step();
+   }
+
+   int n_ticks_with_allocs = 0;
+   const uint64_t n_allocs0 = bench::n_allocs;
+   const uint64_t n_bytes0 = bench::n_alloc_bytes;
+   for (int tick = 0; tick < n_ticks; ++tick) {
+      const uint64_t n = bench::n_allocs;
+      step();
+      n_ticks_with_allocs += bench::n_allocs != n;
+   }
+   const uint64_t n_allocs = bench::n_allocs - n_allocs0;
+   const uint64_t n_bytes = bench::n_alloc_bytes - n_bytes0;
+
+   printf("\nclients: %d, requests/client: %d, payload: %d bytes, change ratio: %g\n", n_clients, n_requests,
+          payload_bytes, change_ratio);
+   printf("%d steady-state ticks: %llu allocations, %llu bytes, %d ticks allocated\n", n_ticks,
+          (unsigned long long)n_allocs, (unsigned long long)n_bytes, n_ticks_with_allocs);
+
+   return n_allocs == 0 ? 0 : 1;
+}
@@ -0,0 +1,226 @@
+/*! \file main.cpp
+ *  \brief Compression ratio and throughput of the payload codecs on sequences of var versions
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "incppect/codec.h"
+#include "incppect/xor_rle.h"
+
+// a var changing over time, one version per update pass
+struct dataset
+{
+   const char* name;
+   std::function<void(std::vector<float>&, int)> step; // compute version t in place
+};
+
+// balls2d without the collisions: [r, m, x, y, vx, vy] per ball, bouncing on the walls
+void balls(std::vector<float>& v, int t)
+{
+   const size_t n = v.size() / 6;
+   if (t == 0) {
+      std::mt19937 rng(1234);
+      std::uniform_real_distribution<float> u(0.0f, 1.0f);
+      for (size_t i = 0; i < n; ++i) {
+         float* b = v.data() + 6 * i;
+         b[0] = 0.05f * u(rng) + 0.02f;
+         b[1] = b[0] * b[0];
+         b[2] = 2.0f * u(rng) - 1.0f;
+         b[3] = 2.0f * u(rng) - 1.0f;
+         b[4] = 2.0f * u(rng) - 1.0f;
+         b[5] = 2.0f * u(rng) - 1.0f;
+      }
+      return;
+   }
+
+   const float dt = 0.001f;
+   for (size_t i = 0; i < n; ++i) {
+      float* b = v.data() + 6 * i;
+      b[2] += b[4] * dt;
+      b[3] += b[5] * dt;
+      if (b[2] - b[0] < -1.0f) b[4] = std::abs(b[4]);
+      if (b[3] - b[0] < -1.0f) b[5] = std::abs(b[5]);
+      if (b[2] + b[0] > 1.0f) b[4] = -std::abs(b[4]);
+      if (b[3] + b[0] > 1.0f) b[5] = -std::abs(b[5]);
+   }
+}
+
+// a travelling wave, every sample changes every version
+void sine(std::vector<float>& v, int t)
+{
+   for (size_t i = 0; i < v.size(); ++i) {
+      v[i] = std::sin(0.01f * float(i) + 0.05f * float(t));
+   }
+}
+
+// white noise, incompressible
+void noise(std::vector<float>& v, int t)
+{
+   std::mt19937 rng(t);
+   std::normal_distribution<float> d;
+   for (auto& x : v) x = d(rng);
+}
+
+// a slowly filled buffer: 1% of the samples change per version
+void sparse(std::vector<float>& v, int t)
+{
+   std::mt19937 rng(t);
+   if (t == 0) {
+      for (size_t i = 0; i < v.size(); ++i) v[i] = float(i % 1000);
+      return;
+   }
+   for (size_t k = 0; k < v.size() / 100; ++k) {
+      v[rng() % v.size()] += 1.0f;
+   }
+}
+
+// raw deflate with a sync flush, as permessage-deflate does for every message
+struct deflater
+{
+   z_stream stream{};
+   std::string out;
+
+   deflater() { deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY); }
+   ~deflater() { deflateEnd(&stream); }
+
+   size_t compress(const std::string& in)
+   {
+      out.resize(deflateBound(&stream, in.size()) + 16);
+      stream.next_in = (Bytef*)in.data();
+      stream.avail_in = uInt(in.size());
+      stream.next_out = (Bytef*)out.data();
+      stream.avail_out = uInt(out.size());
+      deflate(&stream, Z_SYNC_FLUSH);
+      deflateReset(&stream);
+      return out.size() - stream.avail_out - 4;
+   }
+};
+
+struct result
+{
+   size_t bytes = 0;
+   double encode_s = 0.0;
+   double decode_s = 0.0;
+};
+
+int main(int argc, char** argv)
+{
+   printf("Usage: %s [n_floats] [n_versions]\n", argv[0]);
+
+   const size_t n_floats = argc > 1 ? atoi(argv[1]) : 6 * 4096;
+   const int n_versions = argc > 2 ? atoi(argv[2]) : 200;
+
+   const dataset datasets[] = {{"balls", balls}, {"sine", sine}, {"noise", noise}, {"sparse", sparse}};
+   const char* codecs[] = {"raw", "xor_rle", "lz4", "xor+lz4", "xor+deflate", "deflate"};
+   constexpr size_t n_codecs = std::size(codecs);
+
+   using clock = std::chrono::steady_clock;
+   const auto seconds = [](clock::time_point t0) { return std::chrono::duration<double>(clock::now() - t0).count(); };
+
+   printf("\n%zu floats (%zu bytes) per version, %d versions\n\n", n_floats, 4 * n_floats, n_versions);
+   printf("%8s %12s %10s %12s %12s\n", "data", "codec", "ratio", "encode MB/s", "decode MB/s");
+
+   incpp::codec::lz4 lz4;
+   deflater zlib;
+
+   for (const auto& d : datasets) {
+      std::vector<float> v(n_floats);
+      std::string prev, cur, x, shuffled, entry, decoded, client;
+
+      result results[n_codecs];
+      size_t raw_bytes = 0;
+
+      for (int t = 0; t < n_versions; ++t) {
+         d.step(v, t);
+         prev.swap(cur);
+         cur.assign((const char*)v.data(), 4 * v.size());
+         if (t == 0) {
+            client = cur;
+            continue;
+         }
+
+         const size_t n = cur.size();
+         raw_bytes += n;
+         results[0].bytes += n;
+
+         // xor_rle
+         auto t0 = clock::now();
+         entry.clear();
+         incpp::xor_rle::encode(prev.data(), cur.data(), n, entry);
+         results[1].encode_s += seconds(t0);
+         results[1].bytes += std::min(entry.size(), n);
+
+         t0 = clock::now();
+         incpp::xor_rle::decode(entry.data(), entry.size(), client.data(), n);
+         results[1].decode_s += seconds(t0);
+         if (client != cur) {
+            printf("error: xor_rle does not restore '%s' at version %d\n", d.name, t);
+            return 1;
+         }
+
+         // shuffle + lz4 of the content, and of the XOR with the previous version
+         for (int diff = 0; diff < 2; ++diff) {
+            auto& r = results[2 + diff];
+            t0 = clock::now();
+            const char* src = cur.data();
+            if (diff) {
+               x.resize(n);
+               for (size_t i = 0; i < n; ++i) x[i] = char(prev[i] ^ cur[i]);
+               src = x.data();
+            }
+            shuffled.resize(n);
+            incpp::codec::shuffle(src, n, shuffled.data());
+            entry.clear();
+            lz4.compress(shuffled.data(), n, entry);
+            r.encode_s += seconds(t0);
+            r.bytes += incpp::codec::kLz4HeaderSize + ((entry.size() + 3) / 4) * 4;
+
+            t0 = clock::now();
+            decoded.resize(2 * n);
+            const bool ok = incpp::codec::lz4::decompress(entry.data(), entry.size(), decoded.data() + n, n);
+            incpp::codec::unshuffle(decoded.data() + n, n, decoded.data());
+            if (diff) {
+               for (size_t i = 0; i < n; ++i) decoded[i] = char(decoded[i] ^ prev[i]);
+            }
+            r.decode_s += seconds(t0);
+            if (!ok || std::string_view{decoded}.substr(0, n) != cur) {
+               printf("error: lz4 does not restore '%s' at version %d\n", d.name, t);
+               return 1;
+            }
+         }
+
+         // deflate of the xor_rle entry as sent, and of the content
+         t0 = clock::now();
+         entry.clear();
+         incpp::xor_rle::encode(prev.data(), cur.data(), n, entry);
+         results[4].bytes += zlib.compress(entry.size() < n ? entry : cur);
+         results[4].encode_s += seconds(t0);
+
+         t0 = clock::now();
+         results[5].bytes += zlib.compress(cur);
+         results[5].encode_s += seconds(t0);
+      }
+
+      for (size_t k = 0; k < n_codecs; ++k) {
+         const auto& r = results[k];
+         const double mb = raw_bytes / 1e6;
+         const auto rate = [mb](double s) { return s > 0.0 ? mb / s : 0.0; };
+         printf("%8s %12s %10.3f %12.1f %12.1f\n", d.name, codecs[k], double(r.bytes) / raw_bytes, rate(r.encode_s),
+                rate(r.decode_s));
+      }
+      printf("\n");
+   }
+
+   printf("ratio: bytes on the wire / raw bytes. decode is not measured for raw and deflate\n");
+
+   return 0;
+}
@@ -0,0 +1,82 @@
+/*! \file common.h
+ *  \brief Helpers shared by the benchmarks of the server
+ *
+ *  - synthetic clients: clients without a socket, fed with the same binary messages a browser would send
+ *  - allocation counting: define INCPPECT_BENCH_COUNT_ALLOCS before including this header, in the single translation
+ *    unit of the benchmark, to replace the global operator new
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+#include <vector>
+
+#include "incppect/incppect.h"
+
+namespace bench
+{
+   using incppect = incpp::Incppect<false>;
+
+   inline std::string_view as_message(const std::vector<int32_t>& msg)
+   {
+      return {(const char*)msg.data(), msg.size() * sizeof(int32_t)};
+   }
+
+   // binary registration of the var getter_id with index i as request first + i, i = 0 .. n-1
+   inline std::vector<int32_t> registration(int32_t getter_id, int n, int32_t first = 0)
+   {
+      std::vector<int32_t> msg = {5};
+      for (int i = 0; i < n; ++i) {
+         msg.insert(msg.end(), {first + i, getter_id, 1, i});
+      }
+      return msg;
+   }
+
+   // request list with the requests 0 .. n-1
+   inline std::vector<int32_t> request_list(int n)
+   {
+      std::vector<int32_t> msg = {2};
+      for (int i = 0; i < n; ++i) {
+         msg.push_back(i);
+      }
+      return msg;
+   }
+
+   // registers and requests the vars of a synthetic client of the shard. unless throttled, the requests are sent on
+   // every pass instead of every 16 ms
+   inline void add_client(incppect& server, incppect::Shard& shard, int32_t client_id,
+                          const std::vector<int32_t>& msg_register, const std::vector<int32_t>& msg_request,
+                          bool throttle = false)
+   {
+      server.process_message(shard, client_id, as_message(msg_register));
+      server.process_message(shard, client_id, as_message(msg_request));
+
+      if (!throttle) {
+         auto& t_min_update_ms = shard.client_data[client_id].requests.t_min_update_ms;
+         std::fill(t_min_update_ms.begin(), t_min_update_ms.end(), -1);
+      }
+   }
+
+   inline std::atomic<uint64_t> n_allocs{};
+   inline std::atomic<uint64_t> n_alloc_bytes{};
+}
+
+#ifdef INCPPECT_BENCH_COUNT_ALLOCS
+void* operator new(size_t size)
+{
+   ++bench::n_allocs;
+   bench::n_alloc_bytes += size;
+   if (void* p = std::malloc(size ? size : 1)) {
+      return p;
+   }
+   throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+#endif
@@ -0,0 +1,445 @@
+/*! \file main.cpp
+ *  \brief Load generator: many websocket viewers of a local incppect server, over loopback
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "incppect/client.h"
+
+struct Options
+{
+   std::string host = "localhost";
+   int port = 3002;
+   std::vector<int> steps = {1, 10, 100, 1000, 10000};
+   std::vector<std::string> paths = {"/state/nballs", "/state/dt", "/state/energy", "/state/balls/{0..63}/x",
+                                     "/state/balls/{0..63}/y"};
+   int per_client = 0; // random subset of the paths per connection, 0: all
+   int n_threads = 1;
+   int tick_ms = 50; // like incppect.js
+   double warmup_s = 1.0;
+   double duration_s = 5.0;
+   int server_pid = 0;
+   std::string server_cmd{};
+};
+
+struct Conn
+{
+   incpp::websocket ws;
+   incpp::Client client;
+   int32_t req_timestamp = -1;
+
+   uint64_t rx_counted = 0;
+   uint64_t tx_counted = 0;
+};
+
+// a thread with its own epoll set, driving a slice of the connections
+struct Worker
+{
+   int epfd = -1;
+   std::thread thread{};
+
+   std::mutex mutex{};
+   std::vector<std::unique_ptr<Conn>> pending{}; // connected by the main thread, guarded by mutex
+   std::vector<uint32_t> latency_us{}; // guarded by mutex
+
+   std::vector<std::unique_ptr<Conn>> conns{};
+   size_t n_adopted = 0;
+
+   std::atomic<uint64_t> n_updates{0};
+   std::atomic<uint64_t> n_errors{0};
+   std::atomic<uint64_t> n_closed{0};
+   std::atomic<uint64_t> rx_bytes{0};
+   std::atomic<uint64_t> tx_bytes{0};
+};
+
+std::atomic<bool> g_running{true};
+
+// same clock as incpp::timestamp_us(), which the server uses for /incppect/timestamp_us
+int64_t now_us()
+{
+   using namespace std::chrono;
+   return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// "/state/balls/{0..3}/x" -> "/state/balls/0/x", ..., "/state/balls/3/x"
+std::vector<std::string> expand(const std::string& path)
+{
+   const auto b = path.find('{');
+   const auto d = path.find("..", b);
+   const auto e = path.find('}', d);
+   if (b == std::string::npos || d == std::string::npos || e == std::string::npos) {
+      return {path};
+   }
+
+   std::vector<std::string> res;
+   const int first = std::stoi(path.substr(b + 1, d - b - 1));
+   const int last = std::stoi(path.substr(d + 2, e - d - 2));
+   for (int i = first; i <= last; ++i) {
+      for (auto& p : expand(path.substr(e + 1))) {
+         res.push_back(path.substr(0, b) + std::to_string(i) + p);
+      }
+   }
+   return res;
+}
+
+template <class T, class F>
+std::vector<T> split(const std::string& s, F&& parse)
+{
+   std::vector<T> res;
+   std::stringstream ss(s);
+   for (std::string item; std::getline(ss, item, ',');) {
+      if (!item.empty()) {
+         res.push_back(parse(item));
+      }
+   }
+   return res;
+}
+
+// utime + stime in seconds and the resident set size in MB of a process
+struct ProcStat
+{
+   double cpu_s = 0.0;
+   double rss_mb = 0.0;
+};
+
+bool proc_stat(int pid, ProcStat& res)
+{
+   std::ifstream f("/proc/" + std::to_string(pid) + "/stat");
+   std::string line;
+   if (!std::getline(f, line)) {
+      return false;
+   }
+
+   // the command name may contain spaces, the fields start after the closing parenthesis
+   std::stringstream ss(line.substr(line.rfind(')') + 2));
+   std::vector<std::string> fields;
+   for (std::string field; ss >> field;) {
+      fields.push_back(field);
+   }
+   if (fields.size() < 22) {
+      return false;
+   }
+
+   // fields 14, 15 and 24 of proc(5), counted from the state field (3)
+   res.cpu_s = double(std::stoull(fields[11]) + std::stoull(fields[12])) / sysconf(_SC_CLK_TCK);
+   res.rss_mb = double(std::stoll(fields[21])) * sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+   return true;
+}
+
+void run_worker(Worker& w, const Options& opts)
+{
+   std::vector<epoll_event> events(1024);
+   int64_t t_last_tick = now_us();
+
+   const auto poll = [&](Conn& c) {
+      const bool open = c.ws.poll([&](std::string_view msg) {
+         if (!c.client.on_message(msg)) {
+            ++w.n_errors;
+         }
+      });
+
+      w.rx_bytes += c.ws.rx_bytes - c.rx_counted;
+      c.rx_counted = c.ws.rx_bytes;
+
+      // closing the descriptor removed it from the epoll set
+      if (!open) {
+         ++w.n_closed;
+      }
+   };
+
+   while (g_running) {
+      {
+         std::lock_guard lock(w.mutex);
+         for (auto& c : w.pending) {
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.ptr = c.get();
+            epoll_ctl(w.epfd, EPOLL_CTL_ADD, c->ws.fd, &ev);
+            w.conns.push_back(std::move(c));
+         }
+         w.pending.clear();
+      }
+
+      // the handshake may have read the first messages already, they would not wake up epoll
+      for (size_t i = w.n_adopted; i < w.conns.size(); ++i) {
+         poll(*w.conns[i]);
+      }
+      w.n_adopted = w.conns.size();
+
+      const int n = epoll_wait(w.epfd, events.data(), events.size(), 5);
+      for (int i = 0; i < n; ++i) {
+         auto& c = *(Conn*)events[i].data.ptr;
+         if (c.ws.is_open()) {
+            poll(c);
+         }
+      }
+
+      const int64_t t = now_us();
+      if (t - t_last_tick >= 1000 * opts.tick_ms) {
+         t_last_tick = t;
+         for (auto& c : w.conns) {
+            if (c->ws.is_open()) {
+               c->client.tick();
+               w.tx_bytes += c->ws.tx_bytes - c->tx_counted;
+               c->tx_counted = c->ws.tx_bytes;
+            }
+         }
+      }
+   }
+}
+
+std::unique_ptr<Conn> connect(const Options& opts, const std::vector<std::string>& paths, Worker& w, int idx)
+{
+   auto c = std::make_unique<Conn>();
+   if (!c->ws.connect(opts.host, opts.port)) {
+      return nullptr;
+   }
+
+   auto& client = c->client;
+   auto* ws = &c->ws;
+   client.send = [ws](std::string_view msg) { ws->send(msg); };
+
+   c->req_timestamp = client.subscribe("/incppect/timestamp_us");
+   if (opts.per_client <= 0 || opts.per_client >= int(paths.size())) {
+      for (auto& p : paths) {
+         client.subscribe(p);
+      }
+   }
+   else {
+      std::mt19937 rng(idx);
+      std::vector<int> order(paths.size());
+      for (int i = 0; i < int(order.size()); ++i) order[i] = i;
+      std::shuffle(order.begin(), order.end(), rng);
+      for (int i = 0; i < opts.per_client; ++i) {
+         client.subscribe(paths[order[i]]);
+      }
+   }
+
+   // the timestamp var changes on every pass, so it is part of every frame the connection receives
+   auto* conn = c.get();
+   client.on_update = [conn, &w](int32_t req_id) {
+      ++w.n_updates;
+      if (req_id == conn->req_timestamp) {
+         const int64_t dt = now_us() - conn->client.value<int64_t>(req_id);
+         std::lock_guard lock(w.mutex);
+         w.latency_us.push_back(uint32_t(std::clamp<int64_t>(dt, 0, UINT32_MAX)));
+      }
+   };
+
+   return c;
+}
+
+void print_usage(const char* argv0)
+{
+   printf("Usage: %s [options]\n", argv0);
+   printf("  --host HOST          server host (default: localhost)\n");
+   printf("  --port PORT          server port (default: 3002, balls2d)\n");
+   printf("  --clients N,N,...    number of connections of every step (default: 1,10,100,1000,10000)\n");
+   printf("  --paths P,P,...      paths to subscribe to, {a..b} expands to a range of indices\n");
+   printf("                       (default: the balls2d vars for 64 balls)\n");
+   printf("  --per-client K       every connection subscribes to K random paths of the list (default: all)\n");
+   printf("  --threads T          client threads (default: 1)\n");
+   printf("  --tick-ms MS         request / keepalive period of the connections (default: 50)\n");
+   printf("  --warmup S           seconds before measuring every step (default: 1)\n");
+   printf("  --duration S         seconds measured for every step (default: 5)\n");
+   printf("  --pid PID            pid of the server, for its CPU usage\n");
+   printf("  --server CMD         start the server with CMD (via /bin/sh) and stop it at the end\n");
+}
+
+int main(int argc, char** argv)
+{
+   Options opts;
+   for (int i = 1; i < argc; ++i) {
+      const std::string arg = argv[i];
+      const char* val = i + 1 < argc ? argv[i + 1] : nullptr;
+      if (arg == "-h" || arg == "--help" || !val) {
+         print_usage(argv[0]);
+         return arg == "-h" || arg == "--help" ? 0 : 1;
+      }
+      ++i;
+
+      if (arg == "--host") opts.host = val;
+      else if (arg == "--port") opts.port = atoi(val);
+      else if (arg == "--clients") opts.steps = split<int>(val, [](auto& s) { return std::stoi(s); });
+      else if (arg == "--paths") opts.paths = split<std::string>(val, [](auto& s) { return s; });
+      else if (arg == "--per-client") opts.per_client = atoi(val);
+      else if (arg == "--threads") opts.n_threads = std::max(1, atoi(val));
+      else if (arg == "--tick-ms") opts.tick_ms = std::max(1, atoi(val));
+      else if (arg == "--warmup") opts.warmup_s = atof(val);
+      else if (arg == "--duration") opts.duration_s = atof(val);
+      else if (arg == "--pid") opts.server_pid = atoi(val);
+      else if (arg == "--server") opts.server_cmd = val;
+      else {
+         print_usage(argv[0]);
+         return 1;
+      }
+   }
+
+   std::vector<std::string> paths;
+   for (auto& p : opts.paths) {
+      for (auto& e : expand(p)) {
+         paths.push_back(e);
+      }
+   }
+
+   std::signal(SIGPIPE, SIG_IGN);
+
+   // every connection needs a descriptor, and so does the server if it runs under the same limits
+   const int max_clients = *std::max_element(opts.steps.begin(), opts.steps.end());
+   rlimit lim{};
+   getrlimit(RLIMIT_NOFILE, &lim);
+   lim.rlim_cur = lim.rlim_max;
+   setrlimit(RLIMIT_NOFILE, &lim);
+   if (lim.rlim_cur < rlim_t(max_clients) + 64) {
+      printf("warning: the open files limit (%lu) is too low for %d connections\n", (unsigned long)lim.rlim_cur,
+             max_clients);
+   }
+
+   if (!opts.server_cmd.empty()) {
+      opts.server_pid = fork();
+      if (opts.server_pid == 0) {
+         execl("/bin/sh", "sh", "-c", ("exec " + opts.server_cmd).c_str(), (char*)nullptr);
+         _exit(127);
+      }
+
+      // wait for the server to listen
+      incpp::websocket probe;
+      for (int i = 0; i < 100 && !probe.connect(opts.host, opts.port); ++i) {
+         std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      }
+      if (!probe.is_open()) {
+         printf("failed to connect to the server started with '%s'\n", opts.server_cmd.c_str());
+         kill(opts.server_pid, SIGTERM);
+         return 1;
+      }
+   }
+
+   printf("server: %s:%d, %zu paths (%s per connection), %d client threads, tick %d ms\n\n", opts.host.c_str(),
+          opts.port, paths.size(), opts.per_client > 0 ? std::to_string(opts.per_client).c_str() : "all",
+          opts.n_threads, opts.tick_ms);
+
+   std::vector<std::unique_ptr<Worker>> workers;
+   for (int i = 0; i < opts.n_threads; ++i) {
+      auto& w = *workers.emplace_back(std::make_unique<Worker>());
+      w.epfd = epoll_create1(0);
+      w.thread = std::thread(run_worker, std::ref(w), std::cref(opts));
+   }
+
+   printf("%8s %10s %10s %9s %9s %9s %9s %10s %10s %9s %9s\n", "clients", "frames/s", "per conn", "p50 ms",
+          "p90 ms", "p99 ms", "max ms", "rx MB/s", "tx KB/s", "srv cpu%", "srv MB");
+   fflush(stdout);
+
+   int n_connected = 0;
+   int ret = 0;
+   for (const int n_clients : opts.steps) {
+      while (n_connected < n_clients) {
+         auto& w = *workers[n_connected % workers.size()];
+         auto c = connect(opts, paths, w, n_connected);
+         if (!c) {
+            printf("connection %d failed\n", n_connected + 1);
+            ret = 1;
+            break;
+         }
+         std::lock_guard lock(w.mutex);
+         w.pending.push_back(std::move(c));
+         ++n_connected;
+      }
+      if (ret != 0) {
+         break;
+      }
+
+      std::this_thread::sleep_for(std::chrono::duration<double>(opts.warmup_s));
+
+      // reset the counters of the workers, then measure
+      const auto reset = [&] {
+         uint64_t n_updates = 0, n_closed = 0, n_errors = 0, rx_bytes = 0, tx_bytes = 0;
+         std::vector<uint32_t> latency_us;
+         for (auto& w : workers) {
+            n_updates += w->n_updates.exchange(0);
+            n_closed += w->n_closed.exchange(0);
+            n_errors += w->n_errors.exchange(0);
+            rx_bytes += w->rx_bytes.exchange(0);
+            tx_bytes += w->tx_bytes.exchange(0);
+            std::lock_guard lock(w->mutex);
+            latency_us.insert(latency_us.end(), w->latency_us.begin(), w->latency_us.end());
+            w->latency_us.clear();
+         }
+         return std::make_tuple(n_updates, n_closed, n_errors, rx_bytes, tx_bytes, std::move(latency_us));
+      };
+
+      reset();
+      ProcStat srv0{}, srv1{};
+      const bool has_srv = opts.server_pid > 0 && proc_stat(opts.server_pid, srv0);
+      const int64_t t0 = now_us();
+
+      std::this_thread::sleep_for(std::chrono::duration<double>(opts.duration_s));
+
+      auto [n_updates, n_closed, n_errors, rx_bytes, tx_bytes, latency_us] = reset();
+      const double dt = (now_us() - t0) * 1e-6;
+      if (has_srv) {
+         proc_stat(opts.server_pid, srv1);
+      }
+
+      const auto percentile = [&](double p) {
+         if (latency_us.empty()) return 0.0;
+         const size_t k = std::min(latency_us.size() - 1, size_t(p * latency_us.size()));
+         std::nth_element(latency_us.begin(), latency_us.begin() + k, latency_us.end());
+         return latency_us[k] * 1e-3;
+      };
+
+      // every frame carries the timestamp var, so there is one latency sample per frame
+      const double frames_per_s = latency_us.size() / dt;
+      const double p50 = percentile(0.50);
+      const double p90 = percentile(0.90);
+      const double p99 = percentile(0.99);
+      const double pmax = percentile(1.0);
+
+      printf("%8d %10.0f %10.1f %9.2f %9.2f %9.2f %9.2f %10.2f %10.1f", n_clients, frames_per_s,
+             frames_per_s / n_clients, p50, p90, p99, pmax, rx_bytes / dt / (1024.0 * 1024.0), tx_bytes / dt / 1024.0);
+      if (has_srv) {
+         printf(" %9.1f %9.1f", 100.0 * (srv1.cpu_s - srv0.cpu_s) / dt, srv1.rss_mb);
+      }
+      else {
+         printf(" %9s %9s", "-", "-");
+      }
+      printf("\n");
+      fflush(stdout);
+
+      if (n_closed > 0 || n_errors > 0) {
+         printf("         %lu connections closed, %lu malformed messages, %lu var updates\n", (unsigned long)n_closed,
+                (unsigned long)n_errors, (unsigned long)n_updates);
+      }
+   }
+
+   g_running = false;
+   for (auto& w : workers) {
+      w->thread.join();
+      close(w->epfd);
+   }
+   workers.clear();
+
+   if (!opts.server_cmd.empty()) {
+      kill(opts.server_pid, SIGTERM);
+      waitpid(opts.server_pid, nullptr, 0);
+   }
+
+   return ret;
+}
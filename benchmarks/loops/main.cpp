@@ -0,0 +1,119 @@
+/*! \file main.cpp
+ *  \brief Throughput of Incppect::update() when the clients are sharded across several event loops
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../common.h"
+
+using bench::incppect;
+
+struct Result
+{
+   double frames_per_s = 0.0;
+   double passes_per_s = 0.0;
+};
+
+Result run(int n_loops, int n_clients, int n_requests, int payload_bytes, double change_ratio, double duration_s)
+{
+   incppect server;
+
+   std::vector<char> data(size_t(n_requests) * payload_bytes);
+   server.var("/data/{}", [&](const std::vector<int>& idxs) {
+      return std::string_view{data.data() + size_t(idxs[0]) * payload_bytes, size_t(payload_bytes)};
+   });
+   const int32_t getter_id = server.pathToGetter["/data/{}"];
+
+   // the app state changes before every evaluation of the getters, under the same lock
+   std::mt19937 rng(1234);
+   server.sync_hooks.emplace_back([&] {
+      const size_t n_changed = size_t(change_ratio * n_requests);
+      for (size_t k = 0; k < n_changed; ++k) {
+         data[(rng() % n_requests) * payload_bytes] += 1;
+      }
+   });
+
+   while (int(server.shards.size()) < n_loops) {
+      server.add_shard();
+   }
+
+   // synthetic clients, assigned round-robin to the loops like the kernel would do with the connections
+   const auto msg_register = bench::registration(getter_id, n_requests);
+   const auto msg_request = bench::request_list(n_requests);
+   for (int client_id = 1; client_id <= n_clients; ++client_id) {
+      bench::add_client(server, *server.shards[client_id % n_loops], client_id, msg_register, msg_request);
+   }
+
+   // the first pass sends everything in full
+   for (auto& shard : server.shards) {
+      server.update(*shard);
+   }
+
+   std::atomic<bool> start = false;
+   std::atomic<int64_t> n_frames = 0;
+   std::atomic<int64_t> n_passes = 0;
+
+   std::vector<std::thread> threads;
+   for (int i = 0; i < n_loops; ++i) {
+      threads.emplace_back([&, i] {
+         auto& shard = *server.shards[i];
+         while (!start) {
+            std::this_thread::yield();
+         }
+
+         const auto t_end = std::chrono::steady_clock::now() + std::chrono::duration<double>(duration_s);
+         int64_t frames = 0;
+         int64_t passes = 0;
+         while (std::chrono::steady_clock::now() < t_end) {
+            server.update(shard);
+            frames += shard.client_data.size();
+            ++passes;
+         }
+         n_frames += frames;
+         n_passes += passes;
+      });
+   }
+
+   start = true;
+   for (auto& thread : threads) {
+      thread.join();
+   }
+
+   return {n_frames / duration_s, n_passes / duration_s};
+}
+
+int main(int argc, char** argv)
+{
+   printf("Usage: %s [n_clients] [n_requests] [payload_bytes] [change_ratio] [max_loops] [duration_s]\n", argv[0]);
+
+   const int n_clients = argc > 1 ? atoi(argv[1]) : 64;
+   const int n_requests = argc > 2 ? atoi(argv[2]) : 1000;
+   const int payload_bytes = argc > 3 ? atoi(argv[3]) : 64;
+   const double change_ratio = argc > 4 ? atof(argv[4]) : 0.1;
+   const int max_loops = argc > 5 ? atoi(argv[5]) : int(std::max(1u, std::thread::hardware_concurrency()));
+   const double duration_s = argc > 6 ? atof(argv[6]) : 1.0;
+
+   printf("\nclients: %d, requests/client: %d, payload: %d bytes, change ratio: %g\n\n", n_clients, n_requests,
+          payload_bytes, change_ratio);
+   printf("%6s %14s %14s %10s\n", "loops", "frames/s", "passes/s", "speedup");
+
+   double base = 0.0;
+   for (int n_loops = 1; n_loops <= max_loops; n_loops *= 2) {
+      const auto r = run(n_loops, n_clients, n_requests, payload_bytes, change_ratio, duration_s);
+      if (n_loops == 1) {
+         base = r.frames_per_s;
+      }
+      printf("%6d %14.0f %14.0f %9.2fx\n", n_loops, r.frames_per_s, r.passes_per_s, r.frames_per_s / base);
+   }
+
+   return 0;
+}
@@ -0,0 +1,255 @@
+/*! \file main.cpp
+ *  \brief Benchmark suite for the server hot path, with the results written as JSON
+ *
+ *  - update: Incppect::update() for synthetic clients, swept over the number of clients, the number of requests per
+ *    client, the payload size and the ratio of vars changing between two ticks
+ *  - messages: Incppect::process_message() for the client messages (the body of the websocket message handler)
+ *
+ *  Usage: incppect_bench [--quick] [--out results.json]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define INCPPECT_BENCH_COUNT_ALLOCS
+#include "../common.h"
+
+using bench::as_message;
+using bench::incppect;
+using clock_type = std::chrono::steady_clock;
+
+struct UpdateResult
+{
+   int32_t n_clients{};
+   int32_t n_requests{};
+   int32_t payload_bytes{};
+   double change_ratio{};
+
+   int32_t n_ticks{};
+   double us_per_tick{};
+   double ns_per_request{};
+   double bytes_per_tick{};
+   double allocs_per_tick{};
+};
+
+struct MessageResult
+{
+   std::string message{};
+   int32_t n_entries{};
+
+   int32_t n_messages{};
+   double ns_per_message{};
+   double ns_per_entry{};
+   double allocs_per_message{};
+};
+
+struct Report
+{
+   std::string simd{};
+   double min_time_s{};
+   std::vector<UpdateResult> update{};
+   std::vector<MessageResult> messages{};
+};
+
+UpdateResult bench_update(int n_clients, int n_requests, int payload_bytes, double change_ratio, double min_time_s)
+{
+   incppect server;
+
+   std::vector<char> data(size_t(n_requests) * payload_bytes);
+   server.var("/data/{}", [&](const std::vector<int>& idxs) {
+      return std::string_view{data.data() + size_t(idxs[0]) * payload_bytes, size_t(payload_bytes)};
+   });
+
+   const auto msg_register = bench::registration(server.pathToGetter["/data/{}"], n_requests);
+   const auto msg_request = bench::request_list(n_requests);
+   for (int client_id = 1; client_id <= n_clients; ++client_id) {
+      bench::add_client(server, *server.shards[0], client_id, msg_register, msg_request);
+   }
+
+   std::mt19937 rng(1234);
+   const auto step = [&] {
+      const size_t n_changed = size_t(change_ratio * n_requests);
+      for (size_t k = 0; k < n_changed; ++k) {
+         data[(rng() % n_requests) * payload_bytes + rng() % payload_bytes] += 1;
+      }
+   };
+
+   // the first passes send everything in full and size the buffers
+   for (int tick = 0; tick < 3; ++tick) {
+      step();
+      server.update();
+   }
+
+   UpdateResult r{n_clients, n_requests, payload_bytes, change_ratio};
+
+   double t_update_s = 0.0;
+   const double tx0 = server.tx_count;
+   const uint64_t n_allocs0 = bench::n_allocs;
+   while (t_update_s < min_time_s || r.n_ticks < 10) {
+      step();
+
+      const auto t0 = clock_type::now();
+      server.update();
+      t_update_s += std::chrono::duration<double>(clock_type::now() - t0).count();
+
+      ++r.n_ticks;
+   }
+
+   r.us_per_tick = 1e6 * t_update_s / r.n_ticks;
+   r.ns_per_request = 1e3 * r.us_per_tick / (double(n_clients) * n_requests);
+   r.bytes_per_tick = (server.tx_count - tx0) / r.n_ticks;
+   r.allocs_per_tick = double(bench::n_allocs - n_allocs0) / r.n_ticks;
+
+   return r;
+}
+
+// time process_message() for a message, prepare() is called untimed before every repetition
+template <class Prepare>
+MessageResult bench_message(incppect& server, std::string name, int n_entries, std::string_view msg,
+                            Prepare&& prepare, double min_time_s)
+{
+   MessageResult r{std::move(name), n_entries};
+
+   double t_s = 0.0;
+   uint64_t n_allocs = 0;
+   while (t_s < min_time_s || r.n_messages < 10) {
+      prepare();
+
+      const uint64_t n_allocs0 = bench::n_allocs;
+      const auto t0 = clock_type::now();
+      server.process_message(1, msg);
+      t_s += std::chrono::duration<double>(clock_type::now() - t0).count();
+      n_allocs += bench::n_allocs - n_allocs0;
+
+      ++r.n_messages;
+   }
+
+   r.ns_per_message = 1e9 * t_s / r.n_messages;
+   r.ns_per_entry = r.ns_per_message / std::max(n_entries, 1);
+   r.allocs_per_message = double(n_allocs) / r.n_messages;
+
+   return r;
+}
+
+std::vector<MessageResult> bench_messages(int n_entries, double min_time_s)
+{
+   incppect server;
+
+   std::vector<char> data(n_entries * sizeof(float));
+   server.var("/data/{}", [&](const std::vector<int>& idxs) {
+      return std::string_view{data.data() + idxs[0] * sizeof(float), sizeof(float)};
+   });
+   const int32_t getter_id = server.pathToGetter["/data/{}"];
+
+   auto& shard = *server.shards[0];
+   const auto fresh_client = [&] { server.remove_client(shard, 1); };
+   const auto nothing = [] {};
+
+   std::vector<MessageResult> results;
+
+   // registration of all vars by a client that just connected
+   std::string text(sizeof(int32_t), '\0');
+   text[0] = 1;
+   for (int i = 0; i < n_entries; ++i) {
+      text += "/data/{} " + std::to_string(i) + " 1 " + std::to_string(i) + " ";
+   }
+   results.push_back(bench_message(server, "register_text", n_entries, text, fresh_client, min_time_s));
+
+   const auto binary = bench::registration(getter_id, n_entries);
+   results.push_back(
+      bench_message(server, "register_binary", n_entries, as_message(binary), fresh_client, min_time_s));
+
+   // messages of a registered client
+   server.process_message(1, as_message(binary));
+
+   const auto requests = bench::request_list(n_entries);
+   results.push_back(bench_message(server, "request_list", n_entries, as_message(requests), nothing, min_time_s));
+
+   const std::vector<int32_t> keepalive = {3};
+   results.push_back(bench_message(server, "keepalive", n_entries, as_message(keepalive), nothing, min_time_s));
+
+   std::vector<int32_t> options = {6};
+   for (int i = 0; i < n_entries; ++i) {
+      options.insert(options.end(), {i, int32_t(incpp::request_option::update_period_ms), 16});
+   }
+   results.push_back(
+      bench_message(server, "request_options", n_entries, as_message(options), nothing, min_time_s));
+
+   return results;
+}
+
+int main(int argc, char** argv)
+{
+   bool quick = false;
+   std::string out_path = "incppect_bench.json";
+   for (int i = 1; i < argc; ++i) {
+      const std::string arg = argv[i];
+      if (arg == "--quick") {
+         quick = true;
+      }
+      else if (arg == "--out" && i + 1 < argc) {
+         out_path = argv[++i];
+      }
+      else {
+         printf("Usage: %s [--quick] [--out results.json]\n", argv[0]);
+         return 1;
+      }
+   }
+
+   Report report;
+   report.simd = incpp::simd::name(incpp::simd::best());
+   report.min_time_s = quick ? 0.02 : 0.2;
+
+   const std::vector<int> v_clients = quick ? std::vector<int>{1, 16} : std::vector<int>{1, 8, 64};
+   const std::vector<int> v_requests = quick ? std::vector<int>{100, 1000} : std::vector<int>{10, 100, 1000, 10000};
+   const std::vector<int> v_payload = quick ? std::vector<int>{16, 1024} : std::vector<int>{4, 64, 1024, 16384};
+   const std::vector<double> v_change = quick ? std::vector<double>{0.1} : std::vector<double>{0.0, 0.1, 1.0};
+
+   // keep the state of a single configuration below ~256 MB
+   constexpr double kMaxBytes = 256.0 * 1024 * 1024;
+
+   printf("%8s %8s %8s %7s %10s %12s %14s %12s\n", "clients", "requests", "payload", "change", "us/tick",
+          "ns/request", "bytes/tick", "allocs/tick");
+   for (const int n_clients : v_clients) {
+      for (const int n_requests : v_requests) {
+         for (const int payload_bytes : v_payload) {
+            if (4.0 * n_clients * n_requests * (payload_bytes + 12) > kMaxBytes) {
+               continue;
+            }
+            for (const double change_ratio : v_change) {
+               const auto r = bench_update(n_clients, n_requests, payload_bytes, change_ratio, report.min_time_s);
+               printf("%8d %8d %8d %7.2f %10.1f %12.1f %14.0f %12.2f\n", r.n_clients, r.n_requests, r.payload_bytes,
+                      r.change_ratio, r.us_per_tick, r.ns_per_request, r.bytes_per_tick, r.allocs_per_tick);
+               report.update.push_back(r);
+            }
+         }
+      }
+   }
+
+   printf("\n%16s %8s %14s %12s %14s\n", "message", "entries", "ns/message", "ns/entry", "allocs/message");
+   for (const int n_entries : quick ? std::vector<int>{1000} : std::vector<int>{10, 1000, 100000}) {
+      for (const auto& r : bench_messages(n_entries, report.min_time_s)) {
+         printf("%16s %8d %14.0f %12.1f %14.2f\n", r.message.c_str(), r.n_entries, r.ns_per_message, r.ns_per_entry,
+                r.allocs_per_message);
+         report.messages.push_back(r);
+      }
+   }
+
+   std::string json;
+   if (auto ec = glz::write<glz::opts{.prettify = true}>(report, json)) {
+      printf("failed to serialize the results\n");
+      return 1;
+   }
+
+   std::ofstream(out_path) << json;
+   printf("\nresults written to '%s'\n", out_path.c_str());
+
+   return 0;
+}
@@ -0,0 +1,84 @@
+/*! \file main.cpp
+ *  \brief Cost of Incppect::update() for synthetic clients with many requests
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../common.h"
+
+using bench::incppect;
+
+int main(int argc, char** argv)
+{
+   printf("Usage: %s [n_clients] [n_requests] [payload_bytes] [change_ratio] [n_ticks]\n", argv[0]);
+
+   const int n_clients = argc > 1 ? atoi(argv[1]) : 4;
+   const int n_requests = argc > 2 ? atoi(argv[2]) : 10000;
+   const int payload_bytes = argc > 3 ? atoi(argv[3]) : 16;
+   const double change_ratio = argc > 4 ? atof(argv[4]) : 0.1;
+   const int n_ticks = argc > 5 ? atoi(argv[5]) : 60;
+
+   incppect server;
+
+   std::vector<char> data(size_t(n_requests) * payload_bytes);
+   server.var("/data/{}", [&](const std::vector<int>& idxs) {
+      return std::string_view{data.data() + size_t(idxs[0]) * payload_bytes, size_t(payload_bytes)};
+   });
+   const int32_t getter_id = server.pathToGetter["/data/{}"];
+
+   // every client registers /data/i as request i and requests all of them
+   const auto msg_register = bench::registration(getter_id, n_requests);
+   const auto msg_request = bench::request_list(n_requests);
+   for (int client_id = 1; client_id <= n_clients; ++client_id) {
+      bench::add_client(server, *server.shards[0], client_id, msg_register, msg_request, true);
+   }
+
+   std::mt19937 rng(1234);
+   std::vector<double> t_update_us;
+
+   // requests are throttled to t_min_update_ms, so tick at a realistic 60 Hz pace and time only update()
+   const auto t_tick = std::chrono::milliseconds(20);
+   auto t_next = std::chrono::steady_clock::now();
+
+   for (int tick = 0; tick < n_ticks; ++tick) {
+      const size_t n_changed = size_t(change_ratio * n_requests);
+      for (size_t k = 0; k < n_changed; ++k) {
+         data[(rng() % n_requests) * payload_bytes] += 1;
+      }
+
+      const int32_t keepalive = 3;
+      for (int client_id = 1; client_id <= n_clients; ++client_id) {
+         server.process_message(client_id, {(const char*)&keepalive, sizeof(keepalive)});
+      }
+
+      t_next += t_tick;
+      std::this_thread::sleep_until(t_next);
+
+      const auto t0 = std::chrono::steady_clock::now();
+      server.update();
+      const auto t1 = std::chrono::steady_clock::now();
+
+      t_update_us.push_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+   }
+
+   // the first pass sends everything in full
+   t_update_us.erase(t_update_us.begin());
+   std::sort(t_update_us.begin(), t_update_us.end());
+
+   const double median_us = t_update_us[t_update_us.size() / 2];
+   const double n_total = double(n_clients) * n_requests;
+
+   printf("\nclients: %d, requests/client: %d, payload: %d bytes, change ratio: %g\n", n_clients, n_requests,
+          payload_bytes, change_ratio);
+   printf("update(): median %.1f us, min %.1f us, max %.1f us, %.1f ns/request\n", median_us, t_update_us.front(),
+          t_update_us.back(), 1000.0 * median_us / n_total);
+
+   return 0;
+}
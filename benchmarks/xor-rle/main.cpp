@@ -0,0 +1,126 @@
+/*! \file main.cpp
+ *  \brief Throughput of the XOR run-length diff kernels (encode and decode) at different change densities
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "incppect/xor_rle.h"
+
+// the scalar encoder as it was written in Incppect::update(), used as reference for the output
+std::string encode_reference(const std::string& prev, const std::string& cur)
+{
+   std::string diff;
+
+   uint32_t a = 0;
+   uint32_t b = 0;
+   uint32_t c = 0;
+   uint32_t n = 0;
+
+   for (int i = 0; i < (int)cur.size(); i += 4) {
+      std::memcpy(&a, prev.data() + i, sizeof(uint32_t));
+      std::memcpy(&b, cur.data() + i, sizeof(uint32_t));
+      a = a ^ b;
+      if (a == c) {
+         ++n;
+      }
+      else {
+         if (n > 0) {
+            diff.append((char*)(&n), sizeof(uint32_t));
+            diff.append((char*)(&c), sizeof(uint32_t));
+         }
+         n = 1;
+         c = a;
+      }
+   }
+
+   diff.append((char*)(&n), sizeof(uint32_t));
+   diff.append((char*)(&c), sizeof(uint32_t));
+
+   return diff;
+}
+
+int main(int argc, char** argv)
+{
+   printf("Usage: %s [size_mb] [min_time_s]\n", argv[0]);
+
+   const size_t size = size_t(argc > 1 ? atof(argv[1]) : 8.0) * 1024 * 1024;
+   const double min_time_s = argc > 2 ? atof(argv[2]) : 0.2;
+
+   const double densities[] = {0.0, 0.0001, 0.001, 0.01, 0.1, 0.5, 1.0};
+
+   std::vector<incpp::simd::level> levels = {incpp::simd::level::scalar};
+   if (incpp::simd::best() >= incpp::simd::level::sse42) levels.push_back(incpp::simd::level::sse42);
+   if (incpp::simd::best() >= incpp::simd::level::avx2) levels.push_back(incpp::simd::level::avx2);
+
+   printf("\nbuffer size: %zu bytes, best simd level: %s\n\n", size, incpp::simd::name(incpp::simd::best()));
+   printf("%10s %10s %12s %12s %12s\n", "density", "simd", "encode GB/s", "decode GB/s", "diff bytes");
+
+   std::mt19937 rng(1234);
+
+   std::string prev(size, 0);
+   for (auto& ch : prev) ch = char(rng());
+
+   for (const double density : densities) {
+      std::string cur = prev;
+      const size_t n_words = size / 4;
+      const size_t n_changed = size_t(density * n_words);
+      for (size_t k = 0; k < n_changed; ++k) {
+         const size_t i = (density == 1.0) ? k : rng() % n_words;
+         cur[4 * i] = char(cur[4 * i] + 1 + rng() % 255);
+      }
+
+      const std::string reference = encode_reference(prev, cur);
+
+      std::string diff;
+      diff.reserve(reference.size());
+
+      for (const auto level : levels) {
+         diff.clear();
+         incpp::xor_rle::encode(prev.data(), cur.data(), cur.size(), diff, level);
+         if (diff != reference) {
+            printf("error: output of '%s' differs from the reference encoder (density %g)\n",
+                   incpp::simd::name(level), density);
+            return 1;
+         }
+
+         int n_iter = 0;
+         const auto t0 = std::chrono::steady_clock::now();
+         double elapsed_s = 0.0;
+         while (elapsed_s < min_time_s) {
+            diff.clear();
+            incpp::xor_rle::encode(prev.data(), cur.data(), cur.size(), diff, level);
+            ++n_iter;
+            elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+         }
+
+         const double gbps = double(size) * n_iter / elapsed_s / 1e9;
+
+         std::string work = prev;
+         if (!incpp::xor_rle::decode(diff.data(), diff.size(), work.data(), work.size(), level) || work != cur) {
+            printf("error: decoding with '%s' does not restore the buffer (density %g)\n", incpp::simd::name(level),
+                   density);
+            return 1;
+         }
+
+         // every decode toggles the buffer between cur and prev, the cost is the same
+         n_iter = 0;
+         const auto t1 = std::chrono::steady_clock::now();
+         elapsed_s = 0.0;
+         while (elapsed_s < min_time_s) {
+            incpp::xor_rle::decode(diff.data(), diff.size(), work.data(), work.size(), level);
+            ++n_iter;
+            elapsed_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+         }
+
+         const double gbps_decode = double(size) * n_iter / elapsed_s / 1e9;
+         printf("%10g %10s %12.2f %12.2f %12zu\n", density, incpp::simd::name(level), gbps, gbps_decode, diff.size());
+      }
+   }
+
+   return 0;
+}
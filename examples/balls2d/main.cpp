@@ -28,33 +28,52 @@ float dist2(const float r0, const float r1) { return (r0 + r1) * (r0 + r1); }
 
 float dist2(const Ball& c0, const Ball& c1) { return (c0.x - c1.x) * (c0.x - c1.x) + (c0.y - c1.y) * (c0.y - c1.y); }
 
+// what the clients see: a copy of the state, published after every simulation step
+struct Frame
+{
+   float dt = 0.0f;
+   float energy = 0.0f;
+   int32_t nballs = 0;
+
+   std::vector<Ball> balls;
+};
+
 struct State
 {
    State()
    {
-      incppect::getInstance().var("/state/dt", [this](const auto&) { return incpp::view(dt); });
+      // the getters run on the incppect thread and read the latest published frame
+      incppect::getInstance().sync(published);
 
-      incppect::getInstance().var("/state/nballs", [this](const auto&) {
-         static int n = 0;
-         n = balls.size();
-         return incpp::view(n);
-      });
-
-      incppect::getInstance().var("/state/dt", [this](const auto&) { return incpp::view(dt); });
-      incppect::getInstance().var("/state/energy", [this](const auto&) { return incpp::view(energy); });
+      incppect::getInstance().var("/state/dt", [this](const auto&) { return incpp::view(frame().dt); });
+      incppect::getInstance().var("/state/nballs", [this](const auto&) { return incpp::view(frame().nballs); });
+      incppect::getInstance().var("/state/energy", [this](const auto&) { return incpp::view(frame().energy); });
 
       incppect::getInstance().var("/state/balls/{}/r",
-                                  [this](const auto& idxs) { return incpp::view(balls[idxs[0]].r); });
+                                  [this](const auto& idxs) { return incpp::view(frame().balls[idxs[0]].r); });
       incppect::getInstance().var("/state/balls/{}/m",
-                                  [this](const auto& idxs) { return incpp::view(balls[idxs[0]].m); });
+                                  [this](const auto& idxs) { return incpp::view(frame().balls[idxs[0]].m); });
       incppect::getInstance().var("/state/balls/{}/x",
-                                  [this](const auto& idxs) { return incpp::view(balls[idxs[0]].x); });
+                                  [this](const auto& idxs) { return incpp::view(frame().balls[idxs[0]].x); });
       incppect::getInstance().var("/state/balls/{}/y",
-                                  [this](const auto& idxs) { return incpp::view(balls[idxs[0]].y); });
+                                  [this](const auto& idxs) { return incpp::view(frame().balls[idxs[0]].y); });
       incppect::getInstance().var("/state/balls/{}/vx",
-                                  [this](const auto& idxs) { return incpp::view(balls[idxs[0]].vx); });
+                                  [this](const auto& idxs) { return incpp::view(frame().balls[idxs[0]].vx); });
       incppect::getInstance().var("/state/balls/{}/vy",
-                                  [this](const auto& idxs) { return incpp::view(balls[idxs[0]].vy); });
+                                  [this](const auto& idxs) { return incpp::view(frame().balls[idxs[0]].vy); });
+   }
+
+   const Frame& frame() const { return published.front(); }
+
+   // called by the simulation thread, never blocks
+   void publish()
+   {
+      auto& frame = published.back();
+      frame.dt = dt;
+      frame.energy = energy;
+      frame.nballs = balls.size();
+      frame.balls = balls;
+      published.commit();
    }
 
    void init(int nBalls)
@@ -150,6 +169,8 @@ struct State
    float energy = 0.0f;
 
    std::vector<Ball> balls;
+
+   incpp::triple_buffer<Frame> published;
 };
 
 int main(int argc, char** argv)
@@ -161,6 +182,7 @@ int main(int argc, char** argv)
    nBalls = std::max(1, std::min(128, nBalls));
    State state;
    state.init(nBalls);
+   state.publish();
 
    std::string http_route = localhost_root_path;
    auto parameters = configure_incppect_example(argc, argv, http_route, port);
@@ -176,6 +198,7 @@ int main(int argc, char** argv)
       }
 
       state.update();
+      state.publish();
 
       std::this_thread::sleep_for(std::chrono::milliseconds(1));
    }
@@ -0,0 +1,54 @@
+/*! \file main.cpp
+ *  \brief reading the vars of the hello-browser example with the native C++ client
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "incppect/client.h"
+
+int main(int argc, char** argv)
+{
+   printf("Usage: %s [host] [port]\n", argv[0]);
+
+   const std::string host = argc > 1 ? argv[1] : "localhost";
+   const int port = argc > 2 ? atoi(argv[2]) : 3010;
+
+   incpp::websocket ws;
+   if (!ws.connect(host, port)) {
+      printf("failed to connect to %s:%d\n", host.c_str(), port);
+      return 1;
+   }
+
+   incpp::Client client;
+   client.send = [&](std::string_view msg) { ws.send(msg); };
+
+   const auto var_int32 = client.subscribe("/var_int32");
+   const auto var_arr = client.subscribe("/var_int32_arr");
+   const auto var_double = client.subscribe("/var_double");
+   const auto var_str = client.subscribe("/var_str");
+   const auto nclients = client.subscribe("/incppect/nclients");
+
+   auto t_print = std::chrono::steady_clock::now();
+   while (ws.poll([&](std::string_view msg) { client.on_message(msg); }, 50)) {
+      client.tick();
+
+      const auto t = std::chrono::steady_clock::now();
+      if (t - t_print < std::chrono::seconds(1)) {
+         continue;
+      }
+      t_print = t;
+
+      printf("var_int32 = %d, var_int32_arr = [", client.value<int32_t>(var_int32));
+      for (const auto v : client.array<int32_t>(var_arr)) {
+         printf(" %d", v);
+      }
+      printf(" ], var_double = %g, var_str = '%.*s', nclients = %d\n", client.value<double>(var_double),
+             int(client.str(var_str).size()), client.str(var_str).data(), client.value<int32_t>(nclients));
+   }
+
+   printf("disconnected\n");
+   return 0;
+}
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace incpp
+{
+   // vars whose getters are too slow for the event loops:
+   //
+   //   the getter is called on a pool of worker threads and completes whenever its result is ready. the loops serve
+   //   the last result of every (getter, idxs) key and ask for a new one once it is older than the max staleness of
+   //   the var, so they never wait for the app. a var is not sent before its first result
+   namespace async
+   {
+      struct options
+      {
+         int64_t max_staleness_ms = 100; // age of a result after which the next request calls the getter again
+         int64_t t_timeout_ms = 10000; // a call that has not completed by then is abandoned and called again
+         int64_t t_evict_ms = 10000; // results nobody requested for this long are dropped
+      };
+
+      // completes a call, the data is copied. may be called from any thread
+      using done_t = std::function<void(std::string_view data)>;
+      using getter_t = std::function<void(const std::vector<int>& idxs, done_t done)>;
+
+      // last result of one (getter, idxs) key
+      struct entry
+      {
+         explicit entry(const std::vector<int>& idxs) : idxs(idxs) {}
+
+         const std::vector<int> idxs;
+
+         std::mutex mutex{};
+         std::shared_ptr<const std::string> data{}; // null until the first call completes
+         uint64_t version = 0; // incremented with every result
+         int64_t t_data_ms = -1; // start of the call that produced data
+         int64_t t_call_ms = -1; // start of the pending call, -1 if none
+         int64_t t_used_ms = -1; // last poll()
+
+         struct state
+         {
+            std::shared_ptr<const std::string> data{};
+            uint64_t version = 0;
+            bool call = false; // the caller must call the getter, with the start time t
+         };
+
+         state poll(int64_t t, const options& opts)
+         {
+            std::lock_guard lock(mutex);
+            t_used_ms = t;
+
+            const bool stale = version == 0 || t - t_data_ms >= opts.max_staleness_ms;
+            const bool pending = t_call_ms >= 0 && t - t_call_ms < opts.t_timeout_ms;
+            if (stale && !pending) {
+               t_call_ms = t;
+            }
+            return {data, version, stale && !pending};
+         }
+
+         // the result of the call started at t_call, unless a more recent one completed first
+         void complete(std::string_view result, int64_t t_call)
+         {
+            auto copy = std::make_shared<const std::string>(result);
+
+            std::lock_guard lock(mutex);
+            if (t_call == t_call_ms) {
+               t_call_ms = -1;
+            }
+            if (t_call < t_data_ms) {
+               return;
+            }
+            data = std::move(copy);
+            t_data_ms = t_call;
+            ++version;
+         }
+      };
+
+      // an asynchronous var and the results of its keys
+      struct var
+      {
+         var(getter_t&& getter, options opts) : getter(std::move(getter)), opts(opts) {}
+
+         getter_t getter{};
+         options opts{};
+
+         std::map<std::vector<int>, std::shared_ptr<entry>> entries{};
+
+         // the entries are only created by the loops, under Incppect::getter_mutex. the unused ones are dropped
+         // whenever a new one is created
+         const std::shared_ptr<entry>& find(const std::vector<int>& idxs, int64_t t)
+         {
+            if (const auto it = entries.find(idxs); it != entries.end()) {
+               return it->second;
+            }
+
+            std::erase_if(entries, [&](const auto& kv) {
+               const auto& e = kv.second;
+               if (e.use_count() > 1) {
+                  return false; // referenced by a snapshot, or by a pending call
+               }
+               std::lock_guard lock(e->mutex);
+               return t - e->t_used_ms >= opts.t_evict_ms;
+            });
+
+            return entries.emplace(idxs, std::make_shared<entry>(idxs)).first->second;
+         }
+      };
+
+      // fixed set of threads running the submitted jobs in order, started with the first job
+      struct pool
+      {
+         int32_t n_threads = 2;
+
+         ~pool() { stop(); }
+
+         void submit(std::function<void()>&& job)
+         {
+            {
+               std::lock_guard lock(mutex_);
+               if (threads_.empty()) {
+                  for (int32_t i = 0; i < std::max(n_threads, 1); ++i) {
+                     threads_.emplace_back([this] { work(); });
+                  }
+               }
+               jobs_.push_back(std::move(job));
+               ++n_jobs_;
+            }
+            cv_.notify_one();
+         }
+
+         // jobs queued or running
+         size_t n_jobs() const
+         {
+            std::lock_guard lock(mutex_);
+            return n_jobs_;
+         }
+
+         // wait for the running jobs and drop the queued ones
+         void stop()
+         {
+            {
+               std::lock_guard lock(mutex_);
+               stopping_ = true;
+            }
+            cv_.notify_all();
+
+            for (auto& thread : threads_) {
+               thread.join();
+            }
+
+            std::lock_guard lock(mutex_);
+            threads_.clear();
+            jobs_.clear();
+            n_jobs_ = 0;
+            stopping_ = false;
+         }
+
+        private:
+         void work()
+         {
+            std::unique_lock lock(mutex_);
+            while (true) {
+               cv_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+               if (stopping_) {
+                  return;
+               }
+
+               auto job = std::move(jobs_.front());
+               jobs_.pop_front();
+
+               lock.unlock();
+               job();
+               lock.lock();
+
+               --n_jobs_;
+            }
+         }
+
+         mutable std::mutex mutex_;
+         std::condition_variable cv_;
+         std::deque<std::function<void()>> jobs_;
+         std::vector<std::thread> threads_;
+         size_t n_jobs_ = 0;
+         bool stopping_ = false;
+      };
+   }
+}
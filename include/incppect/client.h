@@ -0,0 +1,1044 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "codec.h"
+#include "quant.h"
+#include "xor_rle.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define INCPPECT_POSIX_SOCKETS 1
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#else
+#define INCPPECT_POSIX_SOCKETS 0
+#endif
+
+namespace incpp
+{
+   // client side of the incppect protocol, the C++ counterpart of js/incppect.js
+   //
+   //   the transport is pluggable: the client passes the messages for the server to send() and expects the binary
+   //   messages received from the server in on_message(). websocket below is a minimal POSIX transport
+   //
+   //   incpp::websocket ws;
+   //   ws.connect("localhost", 3000);
+   //
+   //   incpp::Client client;
+   //   client.send = [&](std::string_view msg) { ws.send(msg); };
+   //   const auto nballs = client.subscribe("/state/nballs");
+   //
+   //   while (ws.poll([&](std::string_view msg) { client.on_message(msg); }, 50)) {
+   //      client.tick(); // registers new vars and keeps the requests alive, call it every ~50 ms
+   //      const auto n = client.value<int32_t>(nballs);
+   //   }
+   //
+   struct Client
+   {
+      static constexpr size_t kHeaderSize = 3 * sizeof(uint32_t); // of the frames
+      static constexpr int64_t kResyncRetryMs = 1000; // a keyframe that has not arrived by then is asked for again
+      struct Var
+      {
+         std::string path{};
+         std::string data{}; // latest content, zero-padded to a multiple of 4 bytes
+         uint64_t n_updates = 0;
+
+         std::optional<int32_t> update_period_ms{};
+         bool update_period_sent = false;
+
+         std::optional<quant::format> format{};
+         bool format_sent = false;
+
+         std::optional<codec::kind> codec{};
+         bool codec_sent = false;
+
+         std::optional<int32_t> priority{};
+         bool priority_sent = false;
+
+         bool quantized = false; // data is an encoded array, see floats()
+         std::vector<float> decoded{};
+         uint64_t n_decoded = 0; // n_updates when decoded was filled
+
+         // an entry larger than the chunk size of the server, received over several frames
+         std::string chunks{}; // sized with the first chunk
+         uint32_t chunks_type = 0; // type of the entry
+         size_t n_chunk_bytes = 0; // received so far
+      };
+
+      struct Stats
+      {
+         uint64_t n_frames = 0;
+         uint64_t n_no_change = 0;
+         uint64_t n_errors = 0;
+         uint64_t n_dropped = 0; // frames that did not apply to the last decoded one
+         uint64_t rx_bytes = 0;
+         uint64_t tx_bytes = 0;
+      };
+
+      std::function<void(std::string_view)> send{};
+
+      // called for every var updated by a frame
+      std::function<void(int32_t req_id)> on_update{};
+
+      std::vector<Var> vars{}; // indexed by req id
+      std::unordered_map<std::string, int32_t> path_to_req{};
+
+      std::unordered_map<std::string, int32_t> path_to_getter{};
+      bool has_getter_table = false;
+
+      std::vector<int32_t> requests{}; // req ids kept updated by the server
+      bool requests_changed = true;
+      int32_t n_registered = 0; // vars [0, n_registered) are known to the server
+
+      std::string channel{}; // see set_channel()
+      bool channel_sent = true;
+
+      std::string frame{}; // last frame, base of the frame-level diffs
+      uint32_t seq = 0; // sequence number of the last decoded frame
+      uint32_t acked_seq = 0; // last sequence number reported to the server
+      bool resync = false; // a frame was lost, the frames are dropped until a keyframe arrives
+      int64_t t_resync_ms = -1; // when the keyframe was last asked for, -1 to ask with the next tick()
+      std::vector<int32_t> msg{}; // message being built
+      std::string scratch{}; // decompressed codec::kind::lz4 entry
+
+      Stats stats{};
+
+      // request updates of a var, e.g. "/state/balls/3/x"
+      // returns the req id the var is identified with
+      int32_t subscribe(const std::string& path)
+      {
+         if (auto it = path_to_req.find(path); it != path_to_req.end()) {
+            if (std::find(requests.begin(), requests.end(), it->second) == requests.end()) {
+               requests.push_back(it->second);
+               requests_changed = true;
+            }
+            return it->second;
+         }
+
+         const int32_t req_id = vars.size();
+         vars.emplace_back().path = path;
+         path_to_req.emplace(path, req_id);
+
+         requests.push_back(req_id);
+         requests_changed = true;
+
+         return req_id;
+      }
+
+      // stop the updates of a var, its last content remains available
+      void unsubscribe(int32_t req_id)
+      {
+         if (auto it = std::find(requests.begin(), requests.end(), req_id); it != requests.end()) {
+            requests.erase(it);
+            requests_changed = true;
+         }
+      }
+
+      // minimum time between two updates of the var, e.g. 8 for 120 Hz or 1000 for 1 Hz
+      void set_update_period_ms(int32_t req_id, int32_t period_ms)
+      {
+         auto& var = vars[req_id];
+         var.update_period_ms = period_ms;
+         var.update_period_sent = false;
+      }
+
+      // receive a float (or with f64, double) array var in a lossy encoding, read it with floats()
+      void set_quantization(int32_t req_id, quant::encoding enc, bool f64 = false)
+      {
+         auto& var = vars[req_id];
+         var.format = quant::format{enc, f64};
+         var.format_sent = false;
+      }
+
+      // encoding of the var in the frames, see codec.h. the client does not negotiate permessage-deflate, so
+      // codec::kind::deflate sends the same bytes as xor_rle
+      void set_codec(int32_t req_id, codec::kind k)
+      {
+         auto& var = vars[req_id];
+         var.codec = k;
+         var.codec_sent = false;
+      }
+
+      // order of the vars when the connection is too slow for all of them, higher first (0 by default)
+      void set_priority(int32_t req_id, int32_t priority)
+      {
+         auto& var = vars[req_id];
+         var.priority = priority;
+         var.priority_sent = false;
+      }
+
+      // share the frames with the other clients of the same name and the same subscriptions, see Incppect::group()
+      void set_channel(const std::string& name)
+      {
+         channel = name;
+         channel_sent = false;
+      }
+
+      // playback control of a server replaying a recording (incpp::Replayer): [7][command][value]
+      void seek_ms(int32_t t_ms)
+      {
+         msg.assign({7, 0, t_ms});
+         send_msg();
+      }
+
+      // 1.0 is real time, 0.0 pauses
+      void set_playback_speed(double speed)
+      {
+         msg.assign({7, 1, int32_t(speed * 1000.0 + 0.5)});
+         send_msg();
+      }
+
+      // send the registrations of the new vars, the request list if it changed, or a keepalive otherwise
+      // the server drops requests that are not kept alive for Parameters::t_last_req_timeout_ms
+      void tick()
+      {
+         // the registrations use the getter ids, wait for the table
+         if (!has_getter_table) {
+            return;
+         }
+
+         if (n_registered < int32_t(vars.size())) {
+            send_registrations();
+         }
+
+         if (!channel_sent) {
+            // [8] name, zero-padded to 4 bytes
+            msg.assign((channel.size() + 3) / 4 + 1, 0);
+            msg[0] = 8;
+            std::memcpy(msg.data() + 1, channel.data(), channel.size());
+            send_msg();
+            channel_sent = true;
+         }
+
+         // [9][seq][flags]: acknowledge the decoded frames. a lost frame asks for a keyframe once, and again every
+         // kResyncRetryMs until one arrives
+         const int64_t t = now_ms();
+         const bool ask = resync && (t_resync_ms < 0 || t - t_resync_ms >= kResyncRetryMs);
+         if (ask || acked_seq != seq) {
+            msg.assign({9, int32_t(seq), ask ? 1 : 0});
+            send_msg();
+            acked_seq = seq;
+         }
+         if (ask) {
+            t_resync_ms = t;
+         }
+
+         msg.clear();
+         if (requests_changed) {
+            msg.push_back(2);
+            msg.insert(msg.end(), requests.begin(), requests.end());
+            requests_changed = false;
+         }
+         else {
+            msg.push_back(3);
+         }
+         send_msg();
+
+         msg.clear();
+         msg.push_back(6);
+         for (int32_t req_id = 0; req_id < n_registered; ++req_id) {
+            auto& var = vars[req_id];
+            if (var.update_period_ms && !var.update_period_sent) {
+               msg.insert(msg.end(), {req_id, 0, *var.update_period_ms});
+               var.update_period_sent = true;
+            }
+            if (var.format && !var.format_sent) {
+               msg.insert(msg.end(), {req_id, 1, var.format->option()});
+               var.format_sent = true;
+            }
+            if (var.codec && !var.codec_sent) {
+               msg.insert(msg.end(), {req_id, 2, int32_t(*var.codec)});
+               var.codec_sent = true;
+            }
+            if (var.priority && !var.priority_sent) {
+               msg.insert(msg.end(), {req_id, 3, *var.priority});
+               var.priority_sent = true;
+            }
+         }
+         if (msg.size() > 1) {
+            send_msg();
+         }
+      }
+
+      // forget the server side state, e.g. before reconnecting
+      // the vars and the subscriptions are kept and registered again with the new connection
+      void reset()
+      {
+         path_to_getter.clear();
+         has_getter_table = false;
+         requests_changed = true;
+         n_registered = 0;
+         channel_sent = channel.empty();
+         frame.clear();
+         seq = 0;
+         acked_seq = 0;
+         resync = false;
+         t_resync_ms = -1;
+         for (auto& var : vars) {
+            var.update_period_sent = false;
+            var.format_sent = false;
+            var.codec_sent = false;
+            var.priority_sent = false;
+            var.chunks.clear();
+         }
+      }
+
+      // handle a message received from the server
+      // returns false if it is malformed
+      bool on_message(std::string_view m)
+      {
+         stats.rx_bytes += m.size();
+
+         if (m.size() < sizeof(uint32_t) || m.size() % 4 != 0) {
+            ++stats.n_errors;
+            return false;
+         }
+
+         const uint32_t type_all = xor_rle::word(m.data());
+         if (type_all == 2) {
+            return on_getter_table(m);
+         }
+         if (type_all == 3) {
+            ++stats.n_no_change;
+            return true;
+         }
+
+         if (type_all > 1 || m.size() < kHeaderSize) {
+            ++stats.n_errors;
+            return false;
+         }
+
+         // [typeAll][seq][base], the frame applies to the last decoded one unless it is a keyframe (base == seq)
+         const uint32_t frame_seq = xor_rle::word(m.data() + 4);
+         const uint32_t base = xor_rle::word(m.data() + 8);
+         if (base != frame_seq && (resync || base != seq)) {
+            ++stats.n_dropped;
+            resync = true;
+            return true;
+         }
+         resync = false;
+         t_resync_ms = -1;
+
+         if (type_all == 0) {
+            frame.assign(m);
+         }
+         else if (frame.size() < kHeaderSize || !xor_rle::decode(m.data() + kHeaderSize, m.size() - kHeaderSize,
+                                                                   frame.data() + kHeaderSize, frame.size() - kHeaderSize)) {
+            ++stats.n_errors;
+            resync = true;
+            return false;
+         }
+         seq = frame_seq;
+
+         ++stats.n_frames;
+         if (!apply_frame()) {
+            resync = true;
+            return false;
+         }
+         return true;
+      }
+
+      // zero-copy views of the content of a var
+      std::string_view data(int32_t req_id) const { return vars[req_id].data; }
+
+      template <class T>
+      std::span<const T> array(int32_t req_id) const
+      {
+         const auto& data = vars[req_id].data;
+         return {(const T*)data.data(), data.size() / sizeof(T)};
+      }
+
+      template <class T>
+      T value(int32_t req_id) const
+      {
+         T v{};
+         const auto& data = vars[req_id].data;
+         std::memcpy(&v, data.data(), std::min(sizeof(T), data.size()));
+         return v;
+      }
+
+      // a float array var, decoded if it was received quantized (see set_quantization())
+      std::span<const float> floats(int32_t req_id)
+      {
+         auto& var = vars[req_id];
+         if (!var.quantized) {
+            return array<float>(req_id);
+         }
+         if (var.n_decoded != var.n_updates) {
+            if (!quant::decode(var.data, var.decoded)) {
+               var.decoded.clear();
+            }
+            var.n_decoded = var.n_updates;
+         }
+         return var.decoded;
+      }
+
+      // a string var, up to the first zero byte
+      std::string_view str(int32_t req_id) const
+      {
+         const std::string_view data = vars[req_id].data;
+         return data.substr(0, data.find('\0'));
+      }
+
+      // split a path into the pattern the var was defined with and its indices, like incppect.js:
+      // "/balls/3/x" -> "/balls/{}/x", [3]
+      static std::string pattern(std::string_view path, std::vector<int32_t>& idxs)
+      {
+         std::string res;
+         size_t i = 0;
+         while (i < path.size()) {
+            size_t j = i + 1;
+            if (path[i] == '/') {
+               if (j < path.size() && path[j] == '-') ++j;
+               const size_t k = j;
+               while (j < path.size() && path[j] >= '0' && path[j] <= '9') ++j;
+               if (j > k) {
+                  idxs.push_back(std::stoi(std::string(path.substr(i + 1, j - i - 1))));
+                  res += "/{}";
+                  i = j;
+                  continue;
+               }
+               j = i + 1;
+            }
+            res += path[i];
+            i = j;
+         }
+         return res;
+      }
+
+     private:
+      static int64_t now_ms()
+      {
+         using namespace std::chrono;
+         return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+      }
+
+      void send_msg()
+      {
+         const std::string_view m{(const char*)msg.data(), msg.size() * sizeof(int32_t)};
+         stats.tx_bytes += m.size();
+         if (send) {
+            send(m);
+         }
+      }
+
+      // [5] n x [req_id][getter_id][nidxs][idxs...] for the advertised paths, text for the rest
+      void send_registrations()
+      {
+         std::string text(sizeof(int32_t), '\0');
+         text[0] = 1;
+
+         msg.clear();
+         msg.push_back(5);
+
+         std::vector<int32_t> idxs;
+         for (int32_t req_id = n_registered; req_id < int32_t(vars.size()); ++req_id) {
+            idxs.clear();
+            const auto p = pattern(vars[req_id].path, idxs);
+            if (auto it = path_to_getter.find(p); it != path_to_getter.end()) {
+               msg.insert(msg.end(), {req_id, it->second, int32_t(idxs.size())});
+               msg.insert(msg.end(), idxs.begin(), idxs.end());
+            }
+            else {
+               text += p + ' ' + std::to_string(req_id) + ' ' + std::to_string(idxs.size()) + ' ';
+               for (const auto idx : idxs) {
+                  text += std::to_string(idx) + ' ';
+               }
+            }
+         }
+         n_registered = vars.size();
+
+         if (msg.size() > 1) {
+            send_msg();
+         }
+
+         if (text.size() > sizeof(int32_t)) {
+            text += '\0';
+            stats.tx_bytes += text.size();
+            if (send) {
+               send(text);
+            }
+         }
+      }
+
+      // [2][n] n x [getter_id][path length][path, zero-padded to 4 bytes]
+      bool on_getter_table(std::string_view m)
+      {
+         if (m.size() < 2 * sizeof(int32_t)) {
+            ++stats.n_errors;
+            return false;
+         }
+
+         path_to_getter.clear();
+
+         const uint32_t n = xor_rle::word(m.data() + 4);
+         size_t offset = 8;
+         for (uint32_t i = 0; i < n; ++i) {
+            if (offset + 8 > m.size()) {
+               ++stats.n_errors;
+               return false;
+            }
+            const int32_t getter_id = xor_rle::word(m.data() + offset);
+            const uint32_t len = xor_rle::word(m.data() + offset + 4);
+            offset += 8;
+            if (len > m.size() - offset) {
+               ++stats.n_errors;
+               return false;
+            }
+            path_to_getter.emplace(std::string(m.substr(offset, len)), getter_id);
+            offset += (len + 3) / 4 * 4;
+         }
+
+         has_getter_table = true;
+         return true;
+      }
+
+      // [typeAll][seq][base] n x [req_id][type][size][data]
+      bool apply_frame()
+      {
+         size_t offset = kHeaderSize;
+         while (offset + 12 <= frame.size()) {
+            const uint32_t req_id = xor_rle::word(frame.data() + offset);
+            const uint32_t type = xor_rle::word(frame.data() + offset + 4);
+            const uint32_t len = xor_rle::word(frame.data() + offset + 8);
+            offset += 12;
+
+            if (len > frame.size() - offset || req_id >= vars.size()) {
+               ++stats.n_errors;
+               return false;
+            }
+
+            auto& var = vars[req_id];
+            bool complete = true;
+            const bool ok = type == 3 ? apply_chunk(var, frame.data() + offset, len, complete)
+                                      : apply_entry(var, type, frame.data() + offset, len);
+            if (!ok) {
+               ++stats.n_errors;
+               return false;
+            }
+            offset += len;
+
+            if (!complete) {
+               continue;
+            }
+
+            ++var.n_updates;
+            if (on_update) {
+               on_update(req_id);
+            }
+         }
+
+         return true;
+      }
+
+      // type 0 content, 1 XOR-RLE diff of the previous content, 2 codec::kind::lz4, with quant::kEntryFlag for a
+      // quantized array
+      bool apply_entry(Var& var, uint32_t type, const char* p, size_t len)
+      {
+         var.quantized = (type & quant::kEntryFlag) != 0;
+         switch (type & ~quant::kEntryFlag) {
+         case 0:
+            var.data.assign(p, len);
+            return true;
+         case 1:
+            return xor_rle::decode(p, len, var.data.data(), var.data.size());
+         case 2:
+            return apply_lz4(var, p, len);
+         default:
+            return false;
+         }
+      }
+
+      // [type][total size][offset][data], part of an entry of another type. the parts are copied into a buffer sized
+      // with the first one and the entry is applied once it is complete
+      bool apply_chunk(Var& var, const char* p, size_t len, bool& complete)
+      {
+         complete = false;
+         if (len < 12) {
+            return false;
+         }
+         const uint32_t type = xor_rle::word(p);
+         const uint32_t total = xor_rle::word(p + 4);
+         const uint32_t offset = xor_rle::word(p + 8);
+         const size_t n = len - 12;
+
+         if (offset == 0) {
+            var.chunks.resize(total);
+            var.chunks_type = type;
+            var.n_chunk_bytes = 0;
+         }
+         if ((type & ~quant::kEntryFlag) == 3 || type != var.chunks_type || total != var.chunks.size() ||
+             offset != var.n_chunk_bytes || n > total - offset) {
+            return false;
+         }
+
+         std::memcpy(var.chunks.data() + offset, p + 12, n);
+         var.n_chunk_bytes += n;
+         if (var.n_chunk_bytes < total) {
+            return true;
+         }
+
+         complete = true;
+         bool ok = true;
+         if ((type & ~quant::kEntryFlag) == 0) {
+            var.data.swap(var.chunks); // the buffer becomes the content, no copy
+            var.quantized = (type & quant::kEntryFlag) != 0;
+         }
+         else {
+            ok = apply_entry(var, type, var.chunks.data(), total);
+         }
+         var.chunks.clear();
+         var.n_chunk_bytes = 0;
+         return ok;
+      }
+
+      // [u32 raw size][u32 flags] lz4 block of the shuffled content, or of its XOR with the previous one
+      bool apply_lz4(Var& var, const char* p, size_t len)
+      {
+         if (len < codec::kLz4HeaderSize) {
+            return false;
+         }
+         const uint32_t size = xor_rle::word(p);
+         const uint32_t flags = xor_rle::word(p + 4);
+         if (size % 4 != 0 || size > (uint64_t(len) << 8)) {
+            return false;
+         }
+
+         scratch.resize(2 * size_t(size));
+         char* shuffled = scratch.data() + size;
+         if (!codec::lz4::decompress(p + 8, len - 8, shuffled, size)) {
+            return false;
+         }
+
+         if (flags & codec::kXorFlag) {
+            if (var.data.size() != size) {
+               return false;
+            }
+            codec::unshuffle(shuffled, size, scratch.data());
+            for (size_t i = 0; i < size; ++i) {
+               var.data[i] ^= scratch[i];
+            }
+         }
+         else {
+            var.data.resize(size);
+            codec::unshuffle(shuffled, size, var.data.data());
+         }
+
+         return true;
+      }
+   };
+
+#if INCPPECT_POSIX_SOCKETS
+   // the opening handshake of RFC 6455 (section 4): the client sends a random key and the server proves that it is a
+   // websocket server that read it with Sec-WebSocket-Accept = base64(sha1(key + kGuid))
+   namespace handshake
+   {
+      constexpr std::string_view kGuid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+      inline std::array<uint8_t, 20> sha1(std::string_view data)
+      {
+         const auto rol = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+
+         // padded with 0x80, zeros and the length in bits to a multiple of 64 bytes
+         std::string msg(data);
+         msg += char(0x80);
+         msg.append((119 - data.size() % 64) % 64, '\0');
+         for (int i = 7; i >= 0; --i) {
+            msg += char((uint64_t(data.size()) * 8) >> (8 * i));
+         }
+
+         uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+         for (size_t offset = 0; offset < msg.size(); offset += 64) {
+            uint32_t w[80];
+            for (int i = 0; i < 16; ++i) {
+               const auto* p = (const uint8_t*)msg.data() + offset + 4 * i;
+               w[i] = uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | uint32_t(p[3]);
+            }
+            for (int i = 16; i < 80; ++i) {
+               w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+            }
+
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+            for (int i = 0; i < 80; ++i) {
+               const uint32_t f = i < 20   ? (b & c) | (~b & d)
+                                  : i < 40 ? b ^ c ^ d
+                                  : i < 60 ? (b & c) | (b & d) | (c & d)
+                                           : b ^ c ^ d;
+               const uint32_t k = i < 20 ? 0x5a827999 : i < 40 ? 0x6ed9eba1 : i < 60 ? 0x8f1bbcdc : 0xca62c1d6;
+               const uint32_t tmp = rol(a, 5) + f + e + k + w[i];
+               e = d;
+               d = c;
+               c = rol(b, 30);
+               b = a;
+               a = tmp;
+            }
+            h[0] += a;
+            h[1] += b;
+            h[2] += c;
+            h[3] += d;
+            h[4] += e;
+         }
+
+         std::array<uint8_t, 20> res{};
+         for (int i = 0; i < 20; ++i) {
+            res[i] = uint8_t(h[i / 4] >> (24 - 8 * (i % 4)));
+         }
+         return res;
+      }
+
+      inline std::string base64(const uint8_t* data, size_t n)
+      {
+         constexpr std::string_view chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+         std::string res;
+         for (size_t i = 0; i < n; i += 3) {
+            const uint32_t v = uint32_t(data[i]) << 16 | (i + 1 < n ? uint32_t(data[i + 1]) << 8 : 0) |
+                               (i + 2 < n ? uint32_t(data[i + 2]) : 0);
+            res += chars[(v >> 18) & 0x3f];
+            res += chars[(v >> 12) & 0x3f];
+            res += i + 1 < n ? chars[(v >> 6) & 0x3f] : '=';
+            res += i + 2 < n ? chars[v & 0x3f] : '=';
+         }
+         return res;
+      }
+
+      // Sec-WebSocket-Key: 16 random bytes, new for every connection
+      inline std::string key()
+      {
+         std::random_device rd;
+         uint8_t bytes[16];
+         for (auto& b : bytes) {
+            b = uint8_t(rd());
+         }
+         return base64(bytes, sizeof(bytes));
+      }
+
+      inline std::string accept(std::string_view key)
+      {
+         const auto digest = sha1(std::string(key) + std::string(kGuid));
+         return base64(digest.data(), digest.size());
+      }
+
+      // value of a header of an HTTP response, the name is case-insensitive. empty if missing
+      inline std::string_view header(std::string_view response, std::string_view name)
+      {
+         const auto lower = [](char c) { return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c; };
+         size_t pos = response.find("\r\n");
+         while (pos != std::string_view::npos && pos + 2 < response.size()) {
+            const size_t begin = pos + 2;
+            const size_t end = std::min(response.find("\r\n", begin), response.size());
+            const auto line = response.substr(begin, end - begin);
+            const size_t colon = line.find(':');
+            if (colon == name.size() && std::equal(name.begin(), name.end(), line.begin(),
+                                                   [&](char a, char b) { return lower(a) == lower(b); })) {
+               auto value = line.substr(colon + 1);
+               while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+               while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+               return value;
+            }
+            pos = end < response.size() ? end : std::string_view::npos;
+         }
+         return {};
+      }
+   }
+
+   // minimal websocket client over a plain TCP socket: no TLS and no extensions, which is all an incppect server
+   // needs. after connect() the socket is non-blocking, so it can be driven by poll() or by an external epoll loop
+   struct websocket
+   {
+      int fd = -1;
+
+      std::string rx{}; // received bytes that are not a complete frame yet
+      std::string message{}; // fragments of the message being received
+      std::string tx{}; // frame being sent
+      uint32_t mask_state = 0x9e3779b9;
+
+      // bytes on the wire, including the websocket framing
+      uint64_t rx_bytes = 0;
+      uint64_t tx_bytes = 0;
+
+      websocket() = default;
+      websocket(const websocket&) = delete;
+      websocket& operator=(const websocket&) = delete;
+      websocket(websocket&& other) noexcept { *this = std::move(other); }
+      websocket& operator=(websocket&& other) noexcept
+      {
+         std::swap(fd, other.fd);
+         rx.swap(other.rx);
+         message.swap(other.message);
+         tx.swap(other.tx);
+         mask_state = other.mask_state;
+         rx_bytes = other.rx_bytes;
+         tx_bytes = other.tx_bytes;
+         return *this;
+      }
+      ~websocket() { close(); }
+
+      bool is_open() const { return fd >= 0; }
+
+      void close()
+      {
+         if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+         }
+         rx.clear();
+         message.clear();
+      }
+
+      // blocking TCP connect and websocket handshake
+      bool connect(const std::string& host, int port, const std::string& path = "/incppect")
+      {
+         close();
+
+         addrinfo hints{};
+         hints.ai_family = AF_UNSPEC;
+         hints.ai_socktype = SOCK_STREAM;
+
+         addrinfo* res = nullptr;
+         if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0) {
+            return false;
+         }
+         for (auto* ai = res; ai && fd < 0; ai = ai->ai_next) {
+            fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd >= 0 && ::connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+               ::close(fd);
+               fd = -1;
+            }
+         }
+         freeaddrinfo(res);
+         if (fd < 0) {
+            return false;
+         }
+
+         int one = 1;
+         setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+         const std::string key = handshake::key();
+         const std::string request = "GET " + path + " HTTP/1.1\r\nHost: " + host + ":" + std::to_string(port) +
+                                     "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: " + key +
+                                     "\r\nSec-WebSocket-Version: 13\r\n\r\n";
+         if (!write_all(request)) {
+            close();
+            return false;
+         }
+
+         // the first frames may arrive together with the response, keep them in rx
+         size_t end = std::string::npos;
+         while ((end = rx.find("\r\n\r\n")) == std::string::npos) {
+            char buf[4096];
+            const auto n = ::recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0 || rx.size() > 65536) {
+               close();
+               return false;
+            }
+            rx.append(buf, n);
+         }
+         // any other answer, e.g. from a proxy, is not a websocket of this connection
+         const std::string_view response(rx.data(), end + 2);
+         if (rx.compare(0, 12, "HTTP/1.1 101") != 0 ||
+             handshake::header(response, "Sec-WebSocket-Accept") != handshake::accept(key)) {
+            close();
+            return false;
+         }
+         rx.erase(0, end + 4);
+
+         // the masking keys must not be predictable either (RFC 6455, 10.3)
+         mask_state = std::random_device{}() | 1;
+
+         fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+         return true;
+      }
+
+      // send a binary message, waits while the socket buffer is full
+      bool send(std::string_view payload) { return send_frame(0x2, payload); }
+
+      // read the available data and pass every complete message to on_message
+      // waits up to timeout_ms for data (0: don't wait, -1: forever)
+      // returns false once the connection is closed
+      template <class F>
+      bool poll(F&& on_message, int timeout_ms = 0)
+      {
+         if (fd < 0) {
+            return false;
+         }
+
+         if (timeout_ms != 0) {
+            pollfd pfd{fd, POLLIN, 0};
+            ::poll(&pfd, 1, timeout_ms);
+         }
+
+         while (true) {
+            char buf[65536];
+            const auto n = ::recv(fd, buf, sizeof(buf), 0);
+            if (n > 0) {
+               rx.append(buf, n);
+               rx_bytes += n;
+               continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+               close();
+               return false;
+            }
+            break;
+         }
+
+         return parse(on_message);
+      }
+
+     private:
+      bool write_all(std::string_view data)
+      {
+         while (!data.empty()) {
+            const auto n = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+            if (n > 0) {
+               data.remove_prefix(n);
+               tx_bytes += n;
+            }
+            else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+               pollfd pfd{fd, POLLOUT, 0};
+               ::poll(&pfd, 1, -1);
+            }
+            else {
+               return false;
+            }
+         }
+         return true;
+      }
+
+      // client frames are masked (RFC 6455, 5.3)
+      bool send_frame(uint8_t opcode, std::string_view payload)
+      {
+         if (fd < 0) {
+            return false;
+         }
+
+         tx.clear();
+         tx += char(0x80 | opcode);
+         if (payload.size() < 126) {
+            tx += char(0x80 | payload.size());
+         }
+         else if (payload.size() < 65536) {
+            tx += char(0x80 | 126);
+            tx += char(payload.size() >> 8);
+            tx += char(payload.size());
+         }
+         else {
+            tx += char(0x80 | 127);
+            for (int i = 7; i >= 0; --i) {
+               tx += char(uint64_t(payload.size()) >> (8 * i));
+            }
+         }
+
+         mask_state ^= mask_state << 13;
+         mask_state ^= mask_state >> 17;
+         mask_state ^= mask_state << 5;
+         char mask[4];
+         std::memcpy(mask, &mask_state, sizeof(mask));
+         tx.append(mask, 4);
+
+         const size_t offset = tx.size();
+         tx.append(payload);
+         for (size_t i = 0; i < payload.size(); ++i) {
+            tx[offset + i] ^= mask[i % 4];
+         }
+
+         if (!write_all(tx)) {
+            close();
+            return false;
+         }
+         return true;
+      }
+
+      template <class F>
+      bool parse(F&& on_message)
+      {
+         size_t pos = 0;
+         while (rx.size() - pos >= 2) {
+            const uint8_t b0 = rx[pos];
+            const uint8_t b1 = rx[pos + 1];
+            const bool fin = b0 & 0x80;
+            const uint8_t opcode = b0 & 0x0f;
+            const bool masked = b1 & 0x80;
+
+            size_t header = 2;
+            uint64_t len = b1 & 0x7f;
+            if (len == 126) {
+               header = 4;
+               if (rx.size() - pos < header) break;
+               len = (uint64_t(uint8_t(rx[pos + 2])) << 8) | uint8_t(rx[pos + 3]);
+            }
+            else if (len == 127) {
+               header = 10;
+               if (rx.size() - pos < header) break;
+               len = 0;
+               for (int i = 0; i < 8; ++i) {
+                  len = (len << 8) | uint8_t(rx[pos + 2 + i]);
+               }
+            }
+            if (masked) {
+               header += 4;
+            }
+            if (rx.size() - pos < header || rx.size() - pos - header < len) {
+               break;
+            }
+
+            std::string_view payload{rx.data() + pos + header, size_t(len)};
+            pos += header + len;
+
+            switch (opcode) {
+            case 0x0: // continuation
+            case 0x1: // text
+            case 0x2: // binary
+               if (fin && message.empty()) {
+                  on_message(payload);
+               }
+               else {
+                  message.append(payload);
+                  if (fin) {
+                     on_message(std::string_view{message});
+                     message.clear();
+                  }
+               }
+               // the handler may have closed the connection
+               if (fd < 0) {
+                  return false;
+               }
+               break;
+            case 0x8: // close
+               send_frame(0x8, {});
+               close();
+               return false;
+            case 0x9: // ping
+               if (!send_frame(0xa, payload)) {
+                  return false;
+               }
+               break;
+            default:
+               break;
+            }
+         }
+
+         rx.erase(0, pos);
+         return true;
+      }
+   };
+#endif
+}
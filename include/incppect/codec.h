@@ -0,0 +1,288 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace incpp
+{
+   // encodings of the vars in the frames, chosen per request with request_option::codec:
+   //
+   //   raw      the content in full (entry type 0), never diffed
+   //   xor_rle  XOR-RLE diff of the previous version when it is smaller (type 1), else the content (type 0)
+   //   lz4      the content, or its XOR with the previous version, byte-shuffled and LZ4 compressed (type 2):
+   //
+   //              [u32 raw size][u32 flags] lz4 block, zero-padded to 4 bytes
+   //              flags bit 0: XOR the decompressed bytes into the previous content of the var
+   //
+   //   deflate  like xor_rle, in a frame compressed by the websocket (permessage-deflate)
+   //
+   // with automatic, the server measures the size and the encoding cost of all codecs on the var every few versions
+   // and uses the best one for all automatic requests of it, see Incppect::select_codec()
+   namespace codec
+   {
+      enum struct kind : int32_t {
+         automatic = 0,
+         raw = 1,
+         xor_rle = 2,
+         lz4 = 3,
+         deflate = 4,
+      };
+
+      constexpr size_t kKinds = 5;
+
+      inline const char* name(kind k)
+      {
+         switch (k) {
+         case kind::raw:
+            return "raw";
+         case kind::xor_rle:
+            return "xor_rle";
+         case kind::lz4:
+            return "lz4";
+         case kind::deflate:
+            return "deflate";
+         default:
+            return "automatic";
+         }
+      }
+
+      inline kind from_option(int32_t value)
+      {
+         return value >= 0 && value < int32_t(kKinds) ? kind(value) : kind::automatic;
+      }
+
+      constexpr uint32_t kXorFlag = 1;
+      constexpr size_t kLz4HeaderSize = 2 * sizeof(uint32_t);
+
+      // byte planes of 4-byte words: all first bytes, then all second bytes, ... n is a multiple of 4
+      // the high bytes of floats (sign, exponent) vary slowly and become long runs for the compressor
+      inline void shuffle(const char* src, size_t n, char* dst)
+      {
+         const size_t m = n / 4;
+         for (size_t j = 0; j < m; ++j) {
+            dst[j] = src[4 * j + 0];
+            dst[m + j] = src[4 * j + 1];
+            dst[2 * m + j] = src[4 * j + 2];
+            dst[3 * m + j] = src[4 * j + 3];
+         }
+      }
+
+      inline void unshuffle(const char* src, size_t n, char* dst)
+      {
+         const size_t m = n / 4;
+         for (size_t j = 0; j < m; ++j) {
+            dst[4 * j + 0] = src[j];
+            dst[4 * j + 1] = src[m + j];
+            dst[4 * j + 2] = src[2 * m + j];
+            dst[4 * j + 3] = src[3 * m + j];
+         }
+      }
+
+      // compressor of the LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md)
+      // greedy matching with a hash table of the last positions, the output can be decoded by any LZ4 decoder
+      struct lz4
+      {
+         static constexpr int kHashBits = 14;
+         static constexpr uint32_t kEmpty = 0xffffffff;
+
+         std::vector<uint32_t> table = std::vector<uint32_t>(size_t(1) << kHashBits);
+
+         static uint32_t read32(const char* p)
+         {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+         }
+
+         static uint32_t hash(uint32_t v) { return (v * 2654435761u) >> (32 - kHashBits); }
+
+         // largest compression of n bytes (LZ4_COMPRESSBOUND)
+         static constexpr size_t bound(size_t n) { return n + n / 255 + 16; }
+
+         static void write_length(std::string& out, size_t n)
+         {
+            for (; n >= 255; n -= 255) {
+               out += char(255);
+            }
+            out += char(n);
+         }
+
+         static void write_sequence(std::string& out, const char* literals, size_t n_literals, size_t offset,
+                                    size_t match_length)
+         {
+            const size_t ml = match_length - 4;
+            out += char((std::min<size_t>(n_literals, 15) << 4) | std::min<size_t>(ml, 15));
+            if (n_literals >= 15) {
+               write_length(out, n_literals - 15);
+            }
+            out.append(literals, n_literals);
+            out += char(offset & 0xff);
+            out += char(offset >> 8);
+            if (ml >= 15) {
+               write_length(out, ml - 15);
+            }
+         }
+
+         // append the compression of src to out
+         void compress(const char* src, size_t n, std::string& out)
+         {
+            std::fill(table.begin(), table.end(), kEmpty);
+
+            size_t anchor = 0;
+            size_t i = 0;
+
+            // the last match starts at least 12 bytes and ends at least 5 bytes before the end of the block
+            const size_t match_limit = n > 12 ? n - 12 : 0;
+            const size_t match_end = n > 5 ? n - 5 : 0;
+
+            while (i < match_limit) {
+               const uint32_t seq = read32(src + i);
+               const uint32_t h = hash(seq);
+               const size_t ref = table[h];
+               table[h] = uint32_t(i);
+
+               if (ref == kEmpty || i - ref > 65535 || read32(src + ref) != seq) {
+                  i += 1 + ((i - anchor) >> 6); // skip faster through incompressible data
+                  continue;
+               }
+
+               size_t start = i;
+               size_t from = ref;
+               size_t length = 4;
+               while (start + length < match_end && src[from + length] == src[start + length]) {
+                  ++length;
+               }
+               while (start > anchor && from > 0 && src[start - 1] == src[from - 1]) {
+                  --start;
+                  --from;
+                  ++length;
+               }
+
+               write_sequence(out, src + anchor, start - anchor, start - from, length);
+               i = start + length;
+               anchor = i;
+
+               if (i - 2 < match_limit) {
+                  table[hash(read32(src + i - 2))] = uint32_t(i - 2);
+               }
+            }
+
+            const size_t n_literals = n - anchor;
+            out += char(std::min<size_t>(n_literals, 15) << 4);
+            if (n_literals >= 15) {
+               write_length(out, n_literals - 15);
+            }
+            out.append(src + anchor, n_literals);
+         }
+
+         // decompress a block into exactly size bytes at dst, the last sequence may be followed by the zero padding
+         // of the entry. returns false if it is malformed
+         static bool decompress(const char* src, size_t n, char* dst, size_t size)
+         {
+            size_t i = 0;
+            size_t o = 0;
+
+            const auto read_length = [&](size_t& length) {
+               uint8_t b = 255;
+               while (b == 255) {
+                  if (i >= n) return false;
+                  b = uint8_t(src[i++]);
+                  length += b;
+               }
+               return true;
+            };
+
+            while (i < n) {
+               const uint8_t token = uint8_t(src[i++]);
+
+               size_t n_literals = token >> 4;
+               if (n_literals == 15 && !read_length(n_literals)) {
+                  return false;
+               }
+               if (n_literals > n - i || n_literals > size - o) {
+                  return false;
+               }
+               std::memcpy(dst + o, src + i, n_literals);
+               i += n_literals;
+               o += n_literals;
+
+               if (i == n || o == size) {
+                  break; // the last sequence has no match, it may be followed by the padding of the entry
+               }
+
+               if (i + 2 > n) {
+                  return false;
+               }
+               const size_t offset = uint8_t(src[i]) | (size_t(uint8_t(src[i + 1])) << 8);
+               i += 2;
+
+               size_t length = token & 0xf;
+               if (length == 15 && !read_length(length)) {
+                  return false;
+               }
+               length += 4;
+
+               if (offset == 0 || offset > o || length > size - o) {
+                  return false;
+               }
+               // the match may overlap the output, copy byte by byte
+               for (size_t k = 0; k < length; ++k, ++o) {
+                  dst[o] = dst[o - offset];
+               }
+            }
+
+            if (o != size || n - i > 3) {
+               return false;
+            }
+            return std::all_of(src + i, src + n, [](char c) { return c == 0; });
+         }
+      };
+
+      // plain copy of the counters of a codec, the content of /incppect/metrics/codec/{}
+      struct codec_data
+      {
+         uint64_t n_entries = 0; // vars sent with the codec
+         uint64_t bytes_in = 0; // size of their content
+         uint64_t bytes_out = 0; // size of their entries, before websocket compression
+         uint64_t n_encodes = 0; // encodings of a snapshot version
+         uint64_t encode_ns = 0;
+      };
+
+      // written by all loops
+      struct counters
+      {
+         std::atomic<uint64_t> n_entries{};
+         std::atomic<uint64_t> bytes_in{};
+         std::atomic<uint64_t> bytes_out{};
+         std::atomic<uint64_t> n_encodes{};
+         std::atomic<uint64_t> encode_ns{};
+
+         void entry(size_t in, size_t out)
+         {
+            n_entries.fetch_add(1, std::memory_order_relaxed);
+            bytes_in.fetch_add(in, std::memory_order_relaxed);
+            bytes_out.fetch_add(out, std::memory_order_relaxed);
+         }
+
+         void encoded(uint64_t ns)
+         {
+            n_encodes.fetch_add(1, std::memory_order_relaxed);
+            encode_ns.fetch_add(ns, std::memory_order_relaxed);
+         }
+
+         codec_data load() const
+         {
+            constexpr auto relaxed = std::memory_order_relaxed;
+            return {n_entries.load(relaxed), bytes_in.load(relaxed), bytes_out.load(relaxed), n_encodes.load(relaxed),
+                    encode_ns.load(relaxed)};
+         }
+      };
+   }
+}
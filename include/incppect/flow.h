@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace incpp
+{
+   // pacing of the frames of a client to the rate of its connection:
+   //
+   //   the clients acknowledge the frames they decoded (message type 9), so the server knows how many bytes reached
+   //   the client and when. the delivery rate is the max of the recent samples of bytes acknowledged per millisecond.
+   //   the bytes in flight (sent and not acknowledged) are kept below a window of a round trip at that rate, so a slow
+   //   link queues about a round trip of frames instead of filling the socket buffers. the round trip includes the delay
+   //   of the acknowledgements, so a window that is used up delivers faster than the estimate as long as the link can,
+   //   and the estimate follows the link up as soon as the frames back up
+   namespace flow
+   {
+      constexpr int64_t kUnlimited = std::numeric_limits<int64_t>::max();
+
+      struct estimator
+      {
+         static constexpr size_t kFrames = 64; // sent frames remembered until their acknowledgement
+         static constexpr double kWindowGain = 1.0; // bytes in flight, in round trips at the delivery rate
+         static constexpr double kMinWindow = 4 * 1024; // bytes in flight allowed at any rate
+         static constexpr double kDecay = 0.95; // of the max of the delivery rate samples, per acknowledgement
+         static constexpr double kMaxAckIntervalMs = 250.0;
+         static constexpr int64_t kAckTimeoutMs = 1000; // the frames in flight are written off without acknowledgement
+
+         double rate = 0.0; // bytes per ms delivered to the client, 0 until measured: no limit
+         double rtt_ms = 0.0; // smoothed time from sending a frame to its acknowledgement
+         double min_rtt_ms = 0.0;
+         double ack_interval_ms = 0.0; // smoothed, the clients do not acknowledge every frame
+
+         uint64_t n_sent = 0; // bytes passed to the socket
+         uint64_t n_delivered = 0; // bytes up to the last acknowledged frame
+         int64_t t_delivered_ms = -1; // time of the last acknowledgement
+
+         struct sent_frame
+         {
+            uint32_t seq = 0;
+            int64_t t_ms = -1; // -1 once acknowledged
+            uint64_t n_sent = 0; // bytes sent up to and including the frame
+         };
+         std::array<sent_frame, kFrames> frames{};
+
+         // bytes the next frames may take, given the bytes still buffered by the socket. without a measurement of the
+         // rate, a client with buffered bytes gets nothing until they are written
+         int64_t budget(int64_t t, size_t buffered)
+         {
+            if (rate == 0.0) {
+               return buffered ? 0 : kUnlimited;
+            }
+
+            // e.g. the client lost a frame and waits for a keyframe, which may not fit in the window
+            if (n_sent > n_delivered && t - t_delivered_ms > std::max<int64_t>(kAckTimeoutMs, int64_t(4 * rtt_ms))) {
+               n_delivered = n_sent;
+               t_delivered_ms = t;
+            }
+
+            return int64_t(window()) - int64_t(n_sent - n_delivered);
+         }
+
+         double window() const { return std::max(kWindowGain * rate * (min_rtt_ms + ack_interval_ms), kMinWindow); }
+
+         void on_send(size_t n) { n_sent += n; }
+
+         // after on_send() of the frame
+         void on_frame(uint32_t seq, int64_t t) { frames[seq % kFrames] = {seq, t, n_sent}; }
+
+         // the client decoded frame seq, and all frames before it
+         void on_ack(uint32_t seq, int64_t t)
+         {
+            auto& frame = frames[seq % kFrames];
+            if (frame.seq != seq || frame.t_ms < 0) {
+               return;
+            }
+
+            const double sample_rtt = double(t - frame.t_ms);
+            rtt_ms = rtt_ms == 0.0 ? sample_rtt : 0.875 * rtt_ms + 0.125 * sample_rtt;
+            min_rtt_ms = min_rtt_ms == 0.0 ? sample_rtt : std::min(min_rtt_ms, sample_rtt);
+            frame.t_ms = -1;
+
+            if (frame.n_sent > n_delivered && t_delivered_ms >= 0 && t > t_delivered_ms) {
+               const double dt = double(t - t_delivered_ms);
+               const double interval = std::min(dt, kMaxAckIntervalMs);
+               ack_interval_ms = ack_interval_ms == 0.0 ? interval : 0.875 * ack_interval_ms + 0.125 * interval;
+               rate = std::max(double(frame.n_sent - n_delivered) / dt, kDecay * rate);
+            }
+            n_delivered = std::max(n_delivered, frame.n_sent);
+            t_delivered_ms = t;
+         }
+      };
+   }
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace incpp
+{
+   // server-side history of scalar vars:
+   //
+   //   the server samples the var into a fixed-size ring buffer on its own clock, so the history does not depend on
+   //   how often the clients poll and is shared by all of them. the clients request a time window decimated to a
+   //   number of buckets and receive it as a single var
+   namespace history
+   {
+      // how the content of a var is read when it is sampled
+      enum struct sample_type : int32_t {
+         i32,
+         u32,
+         i64,
+         u64,
+         f32,
+         f64,
+      };
+
+      struct options
+      {
+         int32_t depth = 0; // number of samples kept, 0 for no history
+         int32_t period_ms = 16; // minimum time between two samples, rounded up to ticks
+         sample_type type = sample_type::f64;
+      };
+
+      // content of a history query, one per bucket. the buckets without samples hold NaN
+      struct bucket
+      {
+         double t_ms = 0.0; // start of the bucket, relative to the end of the window (<= 0)
+         double min = 0.0;
+         double max = 0.0;
+         double mean = 0.0;
+      };
+
+      inline double read(std::string_view data, sample_type type)
+      {
+         const auto get = [&data]<class T>(T v) {
+            std::memcpy(&v, data.data(), std::min(sizeof(T), data.size()));
+            return double(v);
+         };
+
+         switch (type) {
+         case sample_type::i32:
+            return get(int32_t{});
+         case sample_type::u32:
+            return get(uint32_t{});
+         case sample_type::i64:
+            return get(int64_t{});
+         case sample_type::u64:
+            return get(uint64_t{});
+         case sample_type::f32:
+            return get(float{});
+         case sample_type::f64:
+            return get(double{});
+         }
+         return 0.0;
+      }
+
+      // fixed-size ring of (timestamp, value) samples, oldest first
+      struct ring
+      {
+         int32_t getter_id = -1;
+         options opts{};
+
+         std::vector<int64_t> t_ms{};
+         std::vector<double> values{};
+         size_t head = 0; // index of the oldest sample
+         size_t count = 0;
+         int64_t t_last_sample_ms = std::numeric_limits<int64_t>::min() / 2;
+
+         std::vector<bucket> result{}; // content of the last query
+         std::vector<uint32_t> counts{}; // samples per bucket of the last query
+
+         explicit ring(int32_t getter_id, options opts)
+            : getter_id(getter_id), opts(opts), t_ms(std::max(opts.depth, 1)), values(std::max(opts.depth, 1))
+         {}
+
+         size_t capacity() const { return t_ms.size(); }
+
+         // i-th sample, 0 is the oldest
+         size_t slot(size_t i) const { return (head + i) % capacity(); }
+
+         bool due(int64_t t) const { return t - t_last_sample_ms >= opts.period_ms; }
+
+         void push(int64_t t, double value)
+         {
+            t_last_sample_ms = t;
+            if (count < capacity()) {
+               const size_t i = slot(count++);
+               t_ms[i] = t;
+               values[i] = value;
+               return;
+            }
+            t_ms[head] = t;
+            values[head] = value;
+            head = (head + 1) % capacity();
+         }
+
+         // min/max/mean of the samples in (t_end - window_ms, t_end], in n_buckets buckets of equal duration
+         const std::vector<bucket>& query(int64_t t_end, int32_t window_ms, int32_t n_buckets)
+         {
+            n_buckets = std::clamp(n_buckets, 1, 1 << 16);
+            window_ms = std::max(window_ms, 1);
+
+            const double nan = std::numeric_limits<double>::quiet_NaN();
+            const double bucket_ms = double(window_ms) / n_buckets;
+            const int64_t t_begin = t_end - window_ms;
+
+            auto& n = counts;
+            n.assign(n_buckets, 0);
+            result.assign(n_buckets, bucket{0.0, nan, nan, 0.0});
+            for (int32_t k = 0; k < n_buckets; ++k) {
+               result[k].t_ms = k * bucket_ms - window_ms;
+            }
+
+            // the samples are sorted by time, skip the ones before the window
+            size_t lo = 0, hi = count;
+            while (lo < hi) {
+               const size_t mid = (lo + hi) / 2;
+               if (t_ms[slot(mid)] <= t_begin) {
+                  lo = mid + 1;
+               }
+               else {
+                  hi = mid;
+               }
+            }
+
+            for (size_t i = lo; i < count && t_ms[slot(i)] <= t_end; ++i) {
+               const size_t s = slot(i);
+               const auto k = std::min(int32_t(double(t_ms[s] - t_begin - 1) / bucket_ms), n_buckets - 1);
+               auto& b = result[k];
+               const double v = values[s];
+               if (n[k]++ == 0) {
+                  b.min = b.max = v;
+               }
+               else {
+                  b.min = std::min(b.min, v);
+                  b.max = std::max(b.max, v);
+               }
+               b.mean += v;
+            }
+
+            for (int32_t k = 0; k < n_buckets; ++k) {
+               result[k].mean = n[k] ? result[k].mean / n[k] : nan;
+            }
+
+            return result;
+         }
+      };
+   }
+}
@@ -1,19 +1,37 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <deque>
+#include <format>
 #include <fstream>
 #include <functional>
 #include <future>
 #include <latch>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <span>
 #include <sstream>
 #include <thread>
 #include <vector>
 
 #include "App.h" // uWebSockets
+#include "async.h"
+#include "codec.h"
 #include "common.h"
+#include "flow.h"
+#include "history.h"
+#include "lod.h"
+#include "metrics.h"
+#include "quant.h"
+#include "trace.h"
+#include "xor_rle.h"
 #include "glaze/glaze.hpp"
 
 namespace incpp
@@ -63,25 +81,268 @@ namespace incpp
       }
    */
 
+   // lock-free publication of consistent snapshots of application state
+   //
+   //   the app thread fills back() and calls commit() (or publish(value)) after every simulation step, it never blocks
+   //   the incppect thread calls acquire() to switch to the latest committed snapshot and reads it through front()
+   //
+   // the writer and the reader each own one of the three buffers, the third one is exchanged atomically between them
+   template <class T>
+   struct triple_buffer
+   {
+      // app thread
+      T& back() { return slots[back_idx].value; }
+
+      void commit()
+      {
+         slots[back_idx].epoch = ++n_commits;
+         back_idx = middle.exchange(back_idx | kDirty, std::memory_order_acq_rel) & kIndexMask;
+      }
+
+      void publish(const T& value)
+      {
+         back() = value;
+         commit();
+      }
+
+      // incppect thread
+      // returns true if a newer snapshot was acquired
+      bool acquire()
+      {
+         if ((middle.load(std::memory_order_relaxed) & kDirty) == 0) {
+            return false;
+         }
+         front_idx = middle.exchange(front_idx, std::memory_order_acq_rel) & kIndexMask;
+         return true;
+      }
+
+      const T& front() const { return slots[front_idx].value; }
+
+      // number of the commit that produced front(), 0 if nothing was acquired yet
+      uint64_t epoch() const { return slots[front_idx].epoch; }
+
+     private:
+      static constexpr uint8_t kIndexMask = 0x3;
+      static constexpr uint8_t kDirty = 0x4;
+
+      struct alignas(64) slot
+      {
+         T value{};
+         uint64_t epoch = 0;
+      };
+
+      std::array<slot, 3> slots{};
+
+      uint8_t back_idx = 0;
+      uint64_t n_commits = 0;
+      alignas(64) std::atomic<uint8_t> middle{1};
+      alignas(64) uint8_t front_idx = 2;
+   };
+
    inline int64_t timestamp()
    {
       using namespace std::chrono;
       return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
    }
 
-   struct Request
+   // the steady clock is CLOCK_MONOTONIC on Linux, so it can be compared between processes on the same host
+   inline int64_t timestamp_us()
    {
-      int64_t t_last_update_ms = -1;
-      int64_t t_last_req_ms = -1;
-      int64_t t_min_update_ms = 16;
-      int64_t t_last_req_timeout_ms = 3000;
+      using namespace std::chrono;
+      return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+   }
+
+   // content of a snapshot, zero-padded to a multiple of 4 bytes. immutable once published
+   using Content = std::shared_ptr<const std::string>;
+
+   inline const Content& empty_content()
+   {
+      static const Content content = std::make_shared<const std::string>();
+      return content;
+   }
+
+   // result of calling a getter with a given set of indices, shared by the loops:
+   //
+   //   the first loop that needs it in a tick calls the getter under getter_mutex and publishes the content, the
+   //   other loops read the published content during the next Parameters::t_tick_ms instead of calling the getter
+   //   again. the content buffers are recycled once no loop references them
+   struct SharedSnapshot
+   {
+      int32_t getter_id = -1;
+      std::vector<int> idxs{};
+      quant::format format{};
+
+      int32_t n_refs = 0; // loops referencing it, under Incppect::snapshots_mutex
 
+      // written under getter_mutex
+      uint64_t app_version = 0; // value of the version callback of the var at the last getter call
+      std::shared_ptr<async::entry> async{}; // results of an asynchronous getter, see Incppect::var_async()
+      std::vector<std::shared_ptr<std::string>> buffers{};
+
+      // published, under mutex
+      std::mutex mutex{};
+      Content content{}; // null until the getter returned something
+      uint64_t version = 0; // incremented each time the content changes
+      int64_t t_evaluated_ms = -1; // last evaluation, whether or not the content changed
+      int32_t evaluated_by = -1; // index of the loop that evaluated it
+   };
+
+   // the view of a loop on a shared snapshot, referenced by all requests (of all clients of the loop) with the same
+   // (getter_id, idxs) key. the versions and the encodings are those of the loop: its clients may skip some of the
+   // shared versions
+   struct Snapshot
+   {
+      int32_t getter_id = -1;
       std::vector<int> idxs{};
+      quant::format format{}; // encoding of the content, requested with request_option::quantization
+
+      std::shared_ptr<SharedSnapshot> shared{};
+      uint64_t shared_version = 0; // version of the shared snapshot cur comes from
+
+      int32_t n_refs = 0; // number of requests referencing this snapshot
+      int64_t tick = -1; // last update() pass that needed it
+      uint64_t version = 0; // incremented each time the content changes
+
+      Content cur = empty_content(); // current content
+      Content prev = empty_content(); // content at (version - 1)
+      std::string diff{}; // run-length encoding of prev ^ cur
+      bool has_diff = false;
+      uint64_t diff_ns = 0; // time spent encoding diff
+
+      // codec::kind::lz4 entries of cur, and of prev ^ cur
+      std::string lz4{};
+      std::string lz4_diff{};
+      bool has_lz4 = false;
+      bool has_lz4_diff = false;
+      uint64_t lz4_ns = 0; // time spent encoding the last of them
+
+      codec::kind codec = codec::kind::deflate; // used by the automatic requests, see Incppect::select_codec()
+      uint64_t codec_version = 0; // version at which the codec was selected
+   };
+
+   // the getter of a snapshot and the encoding of its content
+   struct SnapshotVar
+   {
       int32_t getter_id = -1;
+      quant::format format{};
+
+      auto operator<=>(const SnapshotVar&) const = default;
+   };
+
+   // orders snapshot keys, allows lookups with a (SnapshotVar, span of idxs) pair without building a vector
+   struct SnapshotKeyLess
+   {
+      using is_transparent = void;
+
+      template <class A, class B>
+      bool operator()(const A& a, const B& b) const
+      {
+         if (a.first != b.first) {
+            return a.first < b.first;
+         }
+         return std::lexicographical_compare(a.second.begin(), a.second.end(), b.second.begin(), b.second.end());
+      }
+   };
+
+   // per-request settings sent by the clients with a type 6 message
+   enum struct request_option : int32_t {
+      update_period_ms = 0, // minimum time between two updates of the request, <= 0 to update on every tick
+      quantization = 1, // quant::format::option() of a float array, 0 to send it unchanged
+      codec = 2, // codec::kind of the entries of the request
+      priority = 3, // order of the due requests when the bandwidth budget cannot take all of them, higher first
+   };
+
+   // playback control sent by the clients with a type 7 message, handled by the Replayer
+   enum struct playback_command : int32_t {
+      seek_ms = 0, // jump to a time of the recording
+      speed_permille = 1, // playback speed, 1000 is real time and 0 pauses
+   };
+
+   // requests of a client as a structure of arrays indexed by the client-assigned req id
+   // the ids are small dense integers, so update() walks contiguous memory instead of map nodes
+   struct RequestTable
+   {
+      // every slot costs all the columns, so the ids are bounded and the table grows by at most kMaxGrowth slots
+      // per registration: a client cannot make the server allocate megabytes with a single large id. the clients
+      // number their vars densely from 0, in the order they register them
+      static constexpr int32_t kMaxRequests = 1 << 14;
+      static constexpr int32_t kMaxGrowth = 256;
+
+      std::vector<int32_t> snapshot_id{}; // -1 for unused req ids
+      std::vector<uint64_t> version{}; // snapshot version last sent to the client
+      std::vector<int64_t> t_last_update_ms{};
+      std::vector<int64_t> t_last_req_ms{};
+      std::vector<int64_t> t_min_update_ms{};
+      std::vector<int64_t> t_last_req_timeout_ms{};
+      std::vector<codec::kind> codec{};
+      std::vector<uint8_t> streaming{}; // an entry of the request is being sent in chunks, see ClientData::streams
+      std::vector<int32_t> priority{};
+      std::vector<int64_t> t_last_sent_ms{}; // last time an entry of the request was sent
+
+      int32_t size() const { return int32_t(snapshot_id.size()); }
+
+      bool contains(int32_t req_id) const { return req_id >= 0 && req_id < size() && snapshot_id[req_id] >= 0; }
+
+      bool valid(int32_t req_id) const { return req_id >= 0 && req_id < std::min(size() + kMaxGrowth, kMaxRequests); }
+
+      // the client renewed the request within its timeout, or the request without timeout was not sent yet
+      bool alive(int32_t req_id, int64_t t) const
+      {
+         return (t_last_req_timeout_ms[req_id] < 0 && t_last_req_ms[req_id] > 0) ||
+                t - t_last_req_ms[req_id] < t_last_req_timeout_ms[req_id];
+      }
+
+      // (re-)initialize request req_id, growing the table if needed
+      void assign(int32_t req_id, int32_t id)
+      {
+         if (req_id >= size()) {
+            const size_t n = req_id + 1;
+            snapshot_id.resize(n, -1);
+            version.resize(n);
+            t_last_update_ms.resize(n);
+            t_last_req_ms.resize(n);
+            t_min_update_ms.resize(n);
+            t_last_req_timeout_ms.resize(n);
+            codec.resize(n);
+            streaming.resize(n);
+            priority.resize(n);
+            t_last_sent_ms.resize(n);
+         }
 
-      std::string prev{};
-      std::string diff{};
-      std::string_view cur{};
+         snapshot_id[req_id] = id;
+         version[req_id] = 0;
+         t_last_update_ms[req_id] = -1;
+         t_last_req_ms[req_id] = -1;
+         t_min_update_ms[req_id] = 16;
+         t_last_req_timeout_ms[req_id] = 3000;
+         codec[req_id] = codec::kind::automatic;
+         streaming[req_id] = 0;
+         priority[req_id] = 0;
+         t_last_sent_ms[req_id] = -1;
+      }
+   };
+
+   // the frames sent to the clients:
+   //
+   //   [typeAll][seq][base] n x [req_id][type][size][data], all int32 but the data
+   //
+   //   typeAll 0: the entries, type 0 content, 1 XOR-RLE diff of the previous content, 2 codec::kind::lz4,
+   //              3 chunk [type][total size][offset][data] of an entry of another type, see ClientData::streams.
+   //              quant::kEntryFlag is set in the type of the entries whose content is a quantized array
+   //   typeAll 1: XOR-RLE diff of the entries of the previous frame
+   //
+   // and the messages [2] getter table (see build_getter_table()) and [3] no change
+   constexpr size_t kFrameHeaderSize = 3 * sizeof(uint32_t);
+
+   struct Channel;
+
+   // an entry larger than Parameters::chunk_size, sent in chunks over consecutive frames
+   struct Stream
+   {
+      int32_t req_id = -1; // -1 for a free slot
+      int32_t type = 0; // of the entry
+      std::string data{}; // the entry, copied when the stream started so the snapshot can move on
+      size_t offset = 0; // bytes sent so far
    };
 
    struct ClientData
@@ -91,13 +352,67 @@ namespace incpp
       std::array<uint8_t, 4> ip_address{};
 
       std::vector<int32_t> last_requests{};
-      std::map<int32_t, Request> requests{};
+      RequestTable requests{};
+      std::vector<int32_t> due_requests{}; // changed requests sent in the current update() pass
+      bool polled = false; // some requests were due in the current update() pass
+      size_t max_frame_size = 0; // size of a frame with all requests in full
+      bool unchanged = false; // a "no change" frame was sent and nothing changed since
+      bool dirty = false; // the subscriptions changed since the last update() pass
+
+      // a keyframe holds all requests of the client in full and does not depend on the previous frames
+      bool keyframe = false; // send a keyframe in the next update() pass
+      int64_t t_keyframe_interval_ms = -1; // send keyframes periodically, < 0 to disable
+      int64_t t_last_keyframe_ms = std::numeric_limits<int64_t>::min() / 2;
+
+      // every frame carries its sequence number and the one of the frame it applies to (its own for keyframes), the
+      // client drops the frames that do not apply to the last one it decoded and asks for a keyframe (message type 9)
+      uint32_t seq = 0; // sequence number of the last frame sent
+      uint32_t acked_seq = 0; // last frame the client reported as decoded
+      uint32_t keyframe_seq = 0; // sequence number of the last keyframe sent
+
+      // a keyframe sent this recently after the last frame a client decoded is still on its way, the requests for a
+      // keyframe are ignored until then. shorter than the retry period of the clients (Client::kResyncRetryMs)
+      static constexpr int64_t kKeyframeInFlightMs = 500;
+
+      // large entries are streamed after the other entries of the frames, so they do not delay the small vars. the
+      // request is not updated again before its stream is complete. a keyframe discards the unfinished streams
+      std::vector<Stream> streams{}; // the slots are reused, so that the buffers are allocated once
+      int32_t n_streams = 0; // slots in use
+
+      flow::estimator flow{}; // rate of the connection, with Parameters::bandwidth_budget
+      int64_t budget = flow::kUnlimited; // bytes the frame of the current update() pass may take
+
+      // clients without a socket (e.g. the recorder) receive their frames here
+      std::function<void(std::string_view msg, bool keyframe)> sink{};
+
+      // clients with the same subscriptions share their frames, see Incppect::group()
+      std::string channel_name{}; // set by the client (message type 8), empty to be grouped automatically
+      Channel* channel{}; // the channel the client is a member of, if any
+      bool regroup = false; // the subscriptions or the channel name changed since the last grouping
+      int64_t t_lagged_ms = -1; // when it left its channel because it could not take its frames, -1 if it did not
+      bool idle = false; // left its channel because its requests expired, until it renews them
+
+      // the frames of the channel are encoded for this client and published to all members
+      bool leads() const;
+
+      metrics::client_counters counters{};
 
       std::string buf{}; // buffer
       std::string prev{}; // previous buffer
       std::string diff{}; // difference buffer
    };
 
+   // clients of a loop with identical subscriptions: the frames of the first member (the leader) are encoded once
+   // and published to all of them
+   struct Channel
+   {
+      std::pair<std::string, uint64_t> key{}; // (name, signature of the subscriptions)
+      std::string topic{};
+      std::vector<std::pair<int32_t, ClientData*>> members{}; // (client id, data), in the order they joined
+   };
+
+   inline bool ClientData::leads() const { return channel && channel->members.front().second == this; }
+
    struct Parameters
    {
       int32_t port = 3000;
@@ -105,15 +420,64 @@ namespace incpp
       int64_t t_last_req_timeout_ms = 3000;
       int32_t t_idle_timeout_s = 120;
 
+      // period of the timer that pushes the due requests to the clients
+      // the requests are sent at their own rate (request_option::update_period_ms), rounded up to ticks
+      int32_t t_tick_ms = 4;
+
       std::string http_root = ".";
       std::vector<std::string> resources{};
 
       std::string ssl_key = "key.pem";
       std::string ssl_cert = "cert.pem";
 
+      // number of event loops, each running in its own thread and listening on the same port
+      // the kernel distributes the incoming connections among them (SO_REUSEPORT, Linux)
+      int32_t n_threads = 1;
+
+      // threads calling the asynchronous getters (see Incppect::var_async()), started with the first call
+      int32_t n_async_threads = 2;
+
+      // route serving the metrics in the Prometheus text format, empty to disable
+      std::string metrics_route = "/metrics";
+
+      // every n-th compressed message is compressed again to estimate the bytes on the wire, 0 to disable
+      uint32_t compression_sample_period = 64;
+
+      // permessage-deflate with a window per socket instead of one shared by all, better ratio for more memory
+      bool dedicated_compressor = false;
+
+      // bytes on the wire one nanosecond of encoding is worth, for the automatic selection of the codecs
+      double codec_bytes_per_ns = 0.05;
+
+      // versions of a var between two measurements of the codecs for the automatic selection
+      uint32_t codec_selection_period = 64;
+
+      // share the frames of all clients with identical subscriptions, not only of those in the same named channel
+      bool auto_channels = true;
+
+      // entries larger than this are sent in chunks over several frames, with at most this many bytes of chunks per
+      // frame, so the frames stay below max_payload and the large vars do not delay the others. <= 0 to disable
+      int32_t chunk_size = 64 * 1024;
+
+      // send every client a keyframe with all of its vars in full at this interval, < 0 to disable. the clients ask
+      // for one themselves when a frame is lost, so this only bounds the damage for clients that do not check
+      int64_t t_keyframe_interval_ms = 10000;
+
+      // route serving the last spans of every loop in the Chrome trace-event format, when built with INCPPECT_TRACE
+      std::string trace_route = "/trace";
+
+      // pace the frames of every client to the rate its connection drains (see flow.h), sending the due vars with the
+      // highest priority and staleness first and the others in the next passes. without it, a client whose socket
+      // buffer is not empty is skipped until it is. the frames of a channel are paced to its leader, the members that
+      // cannot take them continue on their own
+      bool bandwidth_budget = true;
+
+      // a client that left its channel because it could not take its frames is grouped again after this long, once
+      // its socket buffer is empty
+      int64_t t_channel_rejoin_ms = 10000;
+
       // todo:
       // max clients
-      // max buffered amount
       // etc.
    };
 
@@ -127,10 +491,11 @@ namespace incpp
       return std::string_view{(char*)(&v), sizeof(v)};
    }
 
+   // the value is kept per thread, so that getters can be called from several event loops
    template <class T>
    inline std::string_view view(T&& v)
    {
-      static T t;
+      thread_local T t;
       t = std::move(v);
       return std::string_view{(char*)(&t), sizeof(t)};
    }
@@ -149,7 +514,7 @@ namespace incpp
          }
       }
 
-      int32_t unique_id = 1;
+      std::atomic<int32_t> unique_id = 1;
 
       enum struct event : uint8_t {
          connect,
@@ -158,56 +523,180 @@ namespace incpp
       };
 
       using getter_t = std::function<std::string_view(const std::vector<int>& idxs)>;
+      using version_t = std::function<uint64_t(const std::vector<int>& idxs)>;
       using handler_t = std::function<void(int32_t client_id, event etype, std::string_view)>;
+      using array_t = std::function<std::span<const float>()>;
+
+      struct Shard;
 
       struct PerSocketData final
       {
          int32_t client_id{};
          uWS::Loop* thread_loop{};
          uWS::WebSocket<SSL, true, PerSocketData>* ws{};
+         Shard* shard{};
+      };
+
+      // state of one event loop: its clients and the snapshots of their requests
+      // nothing in here is shared with the other loops, so it is accessed without locks
+      struct Shard
+      {
+         int32_t index{};
+
+         uWS::Loop* loop{};
+         us_listen_socket_t* listen_socket{};
+         us_timer_t* timer{}; // calls update() every Parameters::t_tick_ms
+         uWS::TemplatedApp<SSL>* app{}; // publishes the frames of the channels, null while the loop is not running
+         std::map<int32_t, PerSocketData*> socket_data{};
+         std::map<int32_t, ClientData> client_data{};
+
+         int64_t tick{}; // number of update() passes
+         std::vector<Snapshot> snapshots{};
+         std::vector<int32_t> free_snapshots{};
+         std::map<std::pair<SnapshotVar, std::vector<int>>, int32_t, SnapshotKeyLess> snapshot_ids{};
+         std::vector<int32_t> pass_snapshots{}; // snapshots needed by the current update() pass
+         std::vector<int32_t> stale_snapshots{}; // the ones without a recent shared content, evaluated by the pass
+         std::vector<int> idxs_scratch{}; // indices of the request being parsed
+         std::string quantized{}; // content of the getter being evaluated, re-encoded
+         quant::scratch quant_scratch{};
+         codec::lz4 lz4{};
+         std::string codec_scratch{};
+         bool update_scheduled = false; // a deferred update of the dirty clients is pending
+
+         std::map<std::pair<std::string, uint64_t>, Channel> channels{};
+         std::vector<int32_t> regroup{}; // clients to group in the next update() pass
+         uint64_t n_topics = 0;
+
+         // held while clients are added to or removed from client_data, so that the metrics route can read the
+         // counters of the clients from the thread of another loop
+         std::mutex clients_mutex{};
+         metrics::compression_sampler compression{};
+
+#if INCPPECT_TRACE
+         trace::ring trace{};
+#endif
       };
 
       Parameters parameters{};
 
-      double tx_count{};
-      double rx_count{};
+      std::atomic<uint64_t> tx_count{}; // bytes of the full frames, before the frame diff and compression
+      std::atomic<uint64_t> rx_count{};
+      std::atomic<uint64_t> tx_compressed_count{}; // estimate of the bytes sent, after the frame diff and compression
 
+      // the getters are registered before run() and only read afterwards
       std::unordered_map<std::string, int> pathToGetter{};
       std::vector<getter_t> getters{};
+      std::vector<version_t> versions{}; // optional version callbacks, by getter id
+      // by getter id, null for the synchronous getters. shared with the pending calls, which may complete after the
+      // server is destroyed
+      std::vector<std::shared_ptr<async::var>> async_vars{};
+      std::vector<uint8_t> local_getters{}; // by getter id, the getters whose result depends on evaluating_shard
+
+      // the snapshots shared by the loops, by (getter, encoding, idxs). the snapshots of the local getters are not
+      // shared, every loop has its own
+      std::mutex snapshots_mutex{};
+      std::map<std::pair<SnapshotVar, std::vector<int>>, std::shared_ptr<SharedSnapshot>, SnapshotKeyLess>
+         shared_snapshots{};
+
+      // the getters and the sync hooks are called by one loop at a time, so they never run concurrently
+      // the loops only take it when one of their snapshots has no recent shared content
+      std::mutex getter_mutex{};
+      Shard* evaluating_shard{}; // the loop holding getter_mutex
+
+      std::vector<std::unique_ptr<Shard>> shards{};
+      std::atomic<int32_t> nclients{};
+
+      // update pass counters
+      std::atomic<uint64_t> n_passes{}; // update() passes of all loops
+      std::atomic<uint64_t> n_deferred_passes{}; // passes for subscription changes, limited to the dirty clients
+      std::atomic<uint64_t> n_coalesced{}; // subscription changes merged into an already scheduled pass
+
+      std::atomic<uint64_t> n_broadcasts{}; // frames published to a channel of several clients
+      std::atomic<uint64_t> n_broadcast_receivers{}; // clients these frames were sent to
+
+      // server-side histories of the vars defined with a history depth, sampled under getter_mutex
+      std::deque<history::ring> histories{};
+
+      // large arrays served decimated, see lod_var()
+      struct LodArray
+      {
+         LodArray(array_t&& data, lod::options opts) : data(std::move(data)), pyramid(opts) {}
+
+         array_t data{};
+         lod::pyramid pyramid;
+      };
+      std::deque<LodArray> lod_arrays{};
 
-      uWS::Loop* main_loop{};
-      us_listen_socket_t* listen_socket{};
-      std::map<int32_t, PerSocketData*> socket_data{};
-      size_t nclients{}; // intermediate memory
-      std::map<int32_t, ClientData> client_data{};
+      metrics::histogram update_latency{}; // duration of the update() passes
+      std::array<codec::counters, codec::kKinds> codec_metrics{}; // by codec::kind, automatic is unused
+      // by getter id, shared with the pending calls of the asynchronous getters like async_vars
+      std::vector<std::shared_ptr<metrics::getter_counters>> getter_metrics{};
 
       std::unordered_map<std::string, std::string> resources{};
 
+      // calls the asynchronous getters, declared after them so that it stops first
+      async::pool async_pool{};
+
+      // called from the thread of the loop the client is connected to
       handler_t handler{};
 
+      // called at the beginning of every update() pass that calls getters, before them
+      std::vector<std::function<void()>> sync_hooks{};
+
+      // called from the thread of the loop the client is connected to
+      std::function<void(playback_command command, int32_t value)> playback_handler{};
+
       struct glaze
       {
          using T = Incppect;
-         static constexpr auto n_clients = [](auto& s) -> auto& {
-            s.nclients = s.socket_data.size();
-            return s.nclients;
-         };
+         static constexpr auto n_clients = [](auto& s) { return s.n_connected(); };
          // static constexpr auto value = glz::object("nclients", n_clients, &T::tx_count, &T::rx_count,
          // &T::ip_address);
       };
 
       Incppect()
       {
-         var("/incppect/nclients", [this](const std::vector<int>&) { return view(socket_data.size()); });
-         var("/incppect/tx_total", [this](const std::vector<int>&) { return view(tx_count); });
-         var("/incppect/rx_total", [this](const std::vector<int>&) { return view(rx_count); });
+         add_shard();
+
+         var("/incppect/nclients", [this](const std::vector<int>&) { return view(n_connected()); });
+         var("/incppect/tx_total", [this](const std::vector<int>&) { return view(double(tx_count.load())); });
+         var("/incppect/rx_total", [this](const std::vector<int>&) { return view(double(rx_count.load())); });
+         var("/incppect/passes", [this](const std::vector<int>&) { return view(n_passes.load()); });
+         var("/incppect/deferred_passes", [this](const std::vector<int>&) { return view(n_deferred_passes.load()); });
+         var("/incppect/coalesced", [this](const std::vector<int>&) { return view(n_coalesced.load()); });
+         // time of the update pass, for measuring the end-to-end latency from a client on the same host
+         var("/incppect/timestamp_us", [](const std::vector<int>&) { return view(timestamp_us()); });
+         // metrics::histogram_data of the update() passes, metrics::getter_data of the getter with the given id
+         var("/incppect/metrics/update", [this](const std::vector<int>&) { return view(update_latency.load()); });
+         var("/incppect/metrics/getter/{}", [this](const std::vector<int>& idxs) {
+            const auto getter_id = size_t(idxs[0]);
+            return view(getter_id < getter_metrics.size() ? getter_metrics[getter_id]->load() : metrics::getter_data{});
+         });
+         // codec::codec_data of the codec::kind with the given value
+         var("/incppect/metrics/codec/{}", [this](const std::vector<int>& idxs) {
+            const auto k = size_t(idxs[0]);
+            return view(k < codec_metrics.size() ? codec_metrics[k].load() : codec::codec_data{});
+         });
+         // metrics::client_data of a client of the same loop, -1 for the requesting client
+         var("/incppect/metrics/client/{}", [this](const std::vector<int>& idxs) {
+            const auto& clients = evaluating_shard->client_data;
+            const auto it = clients.find(idxs[0]);
+            return view(it != clients.end() ? it->second.counters.load() : metrics::client_data{});
+         });
+         local_getters.back() = 1;
+         // indexes the clients of the loop the requesting client is connected to
          var("/incppect/ip_address/{}", [this](const std::vector<int>& idxs) {
-            auto it = client_data.cbegin();
+            auto it = evaluating_shard->client_data.cbegin();
             std::advance(it, idxs[0]);
             return view(it->second.ip_address);
          });
+         local_getters.back() = 1;
+      }
+      ~Incppect()
+      {
+         stop();
+         async_pool.stop();
       }
-      ~Incppect() { stop(); }
 
       // run the incppect service main loop in the current thread
       // blocking call
@@ -220,16 +709,24 @@ namespace incpp
       // terminate the server instance
       void stop()
       {
-         if (main_loop) {
+         for (auto& shard : shards) {
+            if (!shard->loop) {
+               continue;
+            }
+
             timed_latch_t completion_latch(1);
 
-            main_loop->defer([this, &completion_latch]() {
-               for (auto [id, sd] : socket_data) {
+            shard->loop->defer([&shard = *shard, &completion_latch]() {
+               for (auto [id, sd] : shard.socket_data) {
                   if (sd->thread_loop) {
                      sd->thread_loop->defer([sd] { sd->ws->close(); });
                   }
                }
-               us_listen_socket_close(0, listen_socket);
+               us_listen_socket_close(0, shard.listen_socket);
+               if (shard.timer) {
+                  us_timer_close(shard.timer);
+                  shard.timer = nullptr;
+               }
 
                completion_latch.count_down();
             });
@@ -246,7 +743,7 @@ namespace incpp
       void set_resource(const std::string& url, const std::string& content) { resources[url] = content; }
 
       // number of connected clients
-      int32_t n_connected() const { return socket_data.size(); }
+      int32_t n_connected() const { return nclients.load(std::memory_order_relaxed); }
 
       // run the main loop in dedicated thread
       // non-blocking call, returns the created std::future<void>
@@ -265,13 +762,118 @@ namespace incpp
       //   var("path1[%d]", [](auto idxs) { ... idxs[0] ... });
       //   var("path2[%d].foo[%d]", [](auto idxs) { ... idxs[0], idxs[1] ... });
       //
-      bool var(const std::string& path, getter_t&& getter)
+      // with several loops (Parameters::n_threads) the getter is called from all of their threads, but never
+      // concurrently, and about once per tick for a set of indices: the loops share its results
+      //
+      // the optional version callback returns a counter that the app increments whenever the value changes. the
+      // getter is not called while the counter stays the same, which makes static vars almost free
+      //
+      //   var("path3", [](auto ) { ... }, [](auto ) { return state.n_changes; });
+      //
+      // with a history depth, the server samples a scalar var without indices into a ring buffer every
+      // history.period_ms, and serves time windows of it as "<path>/history/{window_ms}/{n_buckets}", an array of
+      // history::bucket (min/max/mean per bucket)
+      //
+      //   var("path4", [](auto ) { ... }, {}, {.depth = 4096, .period_ms = 10, .type = history::sample_type::f32});
+      //
+      bool var(const std::string& path, getter_t&& getter, version_t&& version = {}, history::options history = {})
       {
-         pathToGetter[path] = getters.size();
+         // nothing is registered for an invalid var
+         if (history.depth > 0 && path.find("{}") != std::string::npos) {
+            print("[incppect] error : history of var '{}' with indices is not supported\n", path);
+            return false;
+         }
+
+         const int32_t getter_id = getters.size();
+         pathToGetter[path] = getter_id;
          getters.emplace_back(std::move(getter));
+         versions.emplace_back(std::move(version));
+         async_vars.emplace_back();
+         local_getters.emplace_back();
+         getter_metrics.emplace_back(std::make_shared<metrics::getter_counters>());
+
+         if (history.depth > 0) {
+            auto& ring = histories.emplace_back(getter_id, history);
+            var(path + "/history/{}/{}", [&ring](const std::vector<int>& idxs) {
+               if (idxs.size() < 2) {
+                  return std::string_view{};
+               }
+               const auto& res = ring.query(timestamp(), idxs[0], idxs[1]);
+               return std::string_view{(const char*)res.data(), res.size() * sizeof(history::bucket)};
+            });
+         }
+
+         return true;
+      }
+
+      // define a var whose getter is too slow for the event loops. it is called on the worker threads
+      // (Parameters::n_async_threads), and the loops keep serving its last result for every set of indices until a
+      // newer one completes. a result older than opts.max_staleness_ms is refreshed by the next request of it
+      //
+      //   var_async("stats", [](auto ) { return view(compute_stats()); }, {.max_staleness_ms = 500});
+      //
+      // or completes later, from any thread:
+      //
+      //   var_async("histogram/{}", [](auto idxs, incpp::async::done_t done) {
+      //      jobs.push([channel = idxs[0], done] { done(view(compute_histogram(channel))); });
+      //   });
+      //
+      // the getter runs concurrently with the loops and with the other calls of it, for other indices. it is not
+      // called again for the same indices before its previous call completes
+      bool var_async(const std::string& path, async::getter_t&& getter, async::options opts = {})
+      {
+         if (!var(path, {})) {
+            return false;
+         }
+         async_vars.back() = std::make_shared<async::var>(std::move(getter), opts);
          return true;
       }
 
+      bool var_async(const std::string& path, getter_t&& getter, async::options opts = {})
+      {
+         return var_async(
+            path,
+            [getter = std::move(getter)](const std::vector<int>& idxs, async::done_t done) { done(getter(idxs)); },
+            opts);
+      }
+
+      // define a large float array that is served decimated instead of in full:
+      //
+      //   "<path>/lod/{begin}/{end}/{n_points}" is an array of lod::envelope, the min/max of the samples
+      //   [begin, end) in n_points buckets, and "<path>/lod/size" is the number of samples (double)
+      //
+      // with lod::options::pyramid, call invalidate() on the returned pyramid after modifying samples, so that the
+      // envelopes of these samples are recomputed with the next query
+      //
+      //   auto& signal_lod = lod_var("signal", [&]() { return std::span<const float>(samples); });
+      //   ...
+      //   samples[i] = x;
+      //   signal_lod.invalidate(i, i + 1);
+      //
+      lod::pyramid& lod_var(const std::string& path, array_t&& data, lod::options opts = {})
+      {
+         auto& array = lod_arrays.emplace_back(std::move(data), opts);
+
+         var(path + "/lod/size", [&array](const std::vector<int>&) { return view(double(array.data().size())); });
+         var(path + "/lod/{}/{}/{}", [&array](const std::vector<int>& idxs) {
+            if (idxs.size() < 3 || idxs[0] < 0 || idxs[1] < 0 || idxs[2] < 0) {
+               return std::string_view{};
+            }
+            const auto& res = array.pyramid.query(array.data(), idxs[0], idxs[1], idxs[2]);
+            return std::string_view{(const char*)res.data(), res.size() * sizeof(lod::envelope)};
+         });
+
+         return array.pyramid;
+      }
+
+      // acquire the latest committed snapshot of the buffer at the beginning of every update() pass that calls
+      // getters, so that all getters reading buffer.front() during the pass see the same simulation step
+      template <class T>
+      void sync(triple_buffer<T>& buffer)
+      {
+         sync_hooks.emplace_back([&buffer] { buffer.acquire(); });
+      }
+
       // get global instance
       static Incppect& getInstance()
       {
@@ -279,22 +881,56 @@ namespace incpp
          return instance;
       }
 
+      Shard& add_shard()
+      {
+         auto& shard = *shards.emplace_back(std::make_unique<Shard>());
+         shard.index = int32_t(shards.size()) - 1;
+         return shard;
+      }
+
       void run()
       {
-         main_loop = uWS::Loop::get();
+         const int32_t n_loops = std::max(parameters.n_threads, 1);
+         async_pool.n_threads = parameters.n_async_threads;
+         while (int32_t(shards.size()) < n_loops) {
+            add_shard();
+         }
 
          constexpr std::string_view protocol = SSL ? "HTTPS" : "HTTP";
-         print("[incppect] running instance. serving {} from '{}'\n", protocol, parameters.http_root);
+         print("[incppect] running instance with {} loop(s). serving {} from '{}'\n", n_loops, protocol,
+               parameters.http_root);
+
+         std::vector<std::thread> threads;
+         for (int32_t i = 1; i < n_loops; ++i) {
+            threads.emplace_back([this, i] { run(*shards[i]); });
+         }
+         run(*shards[0]);
+
+         for (auto& thread : threads) {
+            thread.join();
+         }
+      }
+
+      // run the event loop of a shard in the current thread, with its own app listening on the common port
+      void run(Shard& shard)
+      {
+         shard.loop = uWS::Loop::get();
+         shard.compression.period = parameters.compression_sample_period;
 
          typename uWS::TemplatedApp<SSL>::template WebSocketBehavior<PerSocketData> wsBehaviour;
-         wsBehaviour.compression = uWS::SHARED_COMPRESSOR;
+         wsBehaviour.compression = parameters.dedicated_compressor ? uWS::DEDICATED_COMPRESSOR : uWS::SHARED_COMPRESSOR;
          wsBehaviour.maxPayloadLength = parameters.max_payload;
          wsBehaviour.idleTimeout = parameters.t_idle_timeout_s;
-         wsBehaviour.open = [&](auto* ws) {
-            ++unique_id;
-
-            auto& cd = client_data[unique_id];
+         wsBehaviour.open = [this, &shard](auto* ws) {
+            const int32_t client_id = ++unique_id;
+            ++nclients;
+
+            auto& cd = [&]() -> ClientData& {
+               std::lock_guard lock(shard.clients_mutex);
+               return shard.client_data[client_id];
+            }();
             cd.t_connected_ms = timestamp();
+            cd.t_keyframe_interval_ms = parameters.t_keyframe_interval_ms;
 
             auto addressBytes = ws->getRemoteAddress();
             cd.ip_address[0] = addressBytes[12];
@@ -303,107 +939,29 @@ namespace incpp
             cd.ip_address[3] = addressBytes[15];
 
             PerSocketData* sd = ws->getUserData();
-            sd->client_id = unique_id;
+            sd->client_id = client_id;
             sd->ws = ws;
             sd->thread_loop = uWS::Loop::get();
+            sd->shard = &shard;
+
+            shard.socket_data.emplace(client_id, sd);
 
-            socket_data.emplace(unique_id, sd);
+            // advertise the getter ids used by the binary registration messages
+            build_getter_table(cd.buf);
+            ws->send({cd.buf.data(), cd.buf.size()}, uWS::OpCode::BINARY, cd.buf.size() > 64);
+            tx_count += cd.buf.size();
+            tx_compressed_count += cd.buf.size() > 64 ? shard.compression.estimate(cd.buf.size()) : cd.buf.size();
 
-            print("[incppect] client with id = {} connected\n", sd->client_id);
+            print("[incppect] client with id = {} connected to loop {}\n", sd->client_id, shard.index);
 
             if (handler) {
                handler(sd->client_id, event::connect, {(const char*)cd.ip_address.data(), 4});
             }
          };
          wsBehaviour.message = [this](auto* ws, std::string_view message, uWS::OpCode /*opCode*/) {
-            rx_count += message.size();
-            if (message.size() < sizeof(int)) {
-               return;
-            }
-
-            int32_t type;
-            std::memcpy(&type, message.data(), sizeof(type));
-
-            bool do_update = true;
-
             PerSocketData* sd = ws->getUserData();
-            auto& cd = client_data[sd->client_id];
-
-            switch (type) {
-            case 1: {
-               std::stringstream ss(message.data() + 4);
-               while (true) {
-                  Request request;
-
-                  std::string path;
-                  ss >> path;
-                  if (ss.eof()) break;
-                  int req_id = 0;
-                  ss >> req_id;
-                  int nidxs = 0;
-                  ss >> nidxs;
-                  for (int i = 0; i < nidxs; ++i) {
-                     int idx = 0;
-                     ss >> idx;
-                     if (idx == -1) idx = sd->client_id;
-                     request.idxs.push_back(idx);
-                  }
-
-                  if (pathToGetter.contains(path)) {
-                     print("[incppect] req_id = {}, path = '{}', nidxs = {}\n", req_id, path, nidxs);
-                     request.getter_id = pathToGetter[path];
-
-                     cd.requests[req_id] = std::move(request);
-                  }
-                  else {
-                     print("[incppect] missing path '{}'\n", path);
-                  }
-               }
-               break;
-            }
-            case 2: {
-               const size_t n_requests = (message.size() - sizeof(int32_t)) / sizeof(int32_t);
-               if (n_requests * sizeof(int32_t) + sizeof(int32_t) != message.size()) {
-                  print("[incppect] error : invalid message data!\n");
-                  return;
-               }
-               print("[incppect] received requests: {}\n", n_requests);
-
-               cd.last_requests.clear();
-               for (size_t i = 0; i < n_requests; ++i) {
-                  int32_t req_id;
-                  std::memcpy(&req_id, message.data() + 4 * (i + 1), sizeof(req_id));
-                  if (cd.requests.contains(req_id)) {
-                     cd.last_requests.emplace_back(req_id);
-                     cd.requests[req_id].t_last_req_ms = timestamp();
-                     cd.requests[req_id].t_last_req_timeout_ms = parameters.t_last_req_timeout_ms;
-                  }
-               }
-               break;
-            }
-            case 3: {
-               for (auto req_id : cd.last_requests) {
-                  if (cd.requests.contains(req_id)) {
-                     cd.requests[req_id].t_last_req_ms = timestamp();
-                     cd.requests[req_id].t_last_req_timeout_ms = parameters.t_last_req_timeout_ms;
-                  }
-               }
-               break;
-            }
-            case 4: {
-               do_update = false;
-               if (handler && message.size() > sizeof(int32_t)) {
-                  handler(sd->client_id, event::custom,
-                          {message.data() + sizeof(int32_t), message.size() - sizeof(int32_t)});
-               }
-               break;
-            }
-            default:
-               print("[incppect] unknown message type: {}\n", type);
-            };
-
-            if (do_update) {
-               sd->thread_loop->defer([this] { this->update(); });
+            if (process_message(*sd->shard, sd->client_id, message)) {
+               schedule_update(*sd->shard);
             }
          };
          wsBehaviour.drain = [this](auto* ws) {
@@ -415,12 +973,13 @@ namespace incpp
          };
          wsBehaviour.ping = [](auto* /*ws*/, std::string_view) {};
          wsBehaviour.pong = [](auto* /*ws*/, std::string_view) {};
-         wsBehaviour.close = [this](auto* ws, int /*code*/, std::string_view /*message*/) {
+         wsBehaviour.close = [this, &shard](auto* ws, int /*code*/, std::string_view /*message*/) {
             PerSocketData* sd = ws->getUserData();
             print("[incppect] client with id = {} disconnected\n", sd->client_id);
 
-            client_data.erase(sd->client_id);
-            socket_data.erase(sd->client_id);
+            remove_client(shard, sd->client_id);
+            shard.socket_data.erase(sd->client_id);
+            --nclients;
 
             if (handler) {
                handler(sd->client_id, event::disconnect, {});
@@ -451,9 +1010,29 @@ namespace incpp
             return;
          }
 
+         shard.app = app.get();
+
          (*app)
             .template ws<PerSocketData>("/incppect", std::move(wsBehaviour))
             .get("/incppect.js", [](auto* res, auto* /*req*/) { res->end(kIncppect_js); });
+         if (!parameters.metrics_route.empty()) {
+            (*app).get(parameters.metrics_route, [this](auto* res, auto* /*req*/) {
+               std::string out;
+               write_metrics(out);
+               res->writeHeader("Content-Type", "text/plain; version=0.0.4");
+               res->end(out);
+            });
+         }
+#if INCPPECT_TRACE
+         if (!parameters.trace_route.empty()) {
+            (*app).get(parameters.trace_route, [this](auto* res, auto* /*req*/) {
+               std::string out;
+               write_trace(out);
+               res->writeHeader("Content-Type", "application/json");
+               res->end(out);
+            });
+         }
+#endif
          for (const auto& resource : parameters.resources) {
             (*app).get("/" + resource, [this](auto* res, auto* req) {
                std::string url{req->getUrl()};
@@ -503,199 +1082,1589 @@ namespace incpp
          });
          (*app)
             .listen(parameters.port,
-                    [this](auto* token) {
-                       this->listen_socket = token;
+                    [this, &shard](auto* token) {
+                       shard.listen_socket = token;
                        if (token) {
+                          start_timer(shard);
                           print("[incppect] listening on port {}\n", parameters.port);
                           constexpr std::string_view protocol = SSL ? "https" : "http";
                           print("[incppect] {}://localhost:{}/\n", protocol, parameters.port);
                        }
                     })
             .run();
+
+         shard.app = nullptr;
       }
 
-      void update()
+      // all metrics in the Prometheus text format, can be called from any thread
+      void write_metrics(std::string& out)
       {
-         for (auto& [client_id, cd] : client_data) {
-            if (socket_data[client_id]->ws->getBufferedAmount()) {
-               print(
-                  "[incppect] warning: buffered amount = {}, not sending updates to client {}. waiting for buffer to "
-                  "drain\n",
-                  socket_data[client_id]->ws->getBufferedAmount(), client_id);
-               continue;
+         using namespace metrics;
+
+         write_header(out, "incppect_clients", "gauge", "Number of connected clients.");
+         write_sample(out, "incppect_clients", "", n_connected());
+         write_header(out, "incppect_tx_bytes_total", "counter",
+                      "Bytes of the frames sent, before the frame diff and compression.");
+         write_sample(out, "incppect_tx_bytes_total", "", double(tx_count.load()));
+         write_header(out, "incppect_tx_compressed_bytes_total", "counter",
+                      "Estimate of the payload bytes sent, after compression.");
+         write_sample(out, "incppect_tx_compressed_bytes_total", "", double(tx_compressed_count.load()));
+         write_header(out, "incppect_rx_bytes_total", "counter", "Payload bytes received.");
+         write_sample(out, "incppect_rx_bytes_total", "", double(rx_count.load()));
+
+         write_header(out, "incppect_update_passes_total", "counter", "Update passes of all loops.");
+         write_sample(out, "incppect_update_passes_total", "", double(n_passes.load()));
+         write_header(out, "incppect_update_deferred_passes_total", "counter",
+                      "Update passes for subscription changes.");
+         write_sample(out, "incppect_update_deferred_passes_total", "", double(n_deferred_passes.load()));
+         write_header(out, "incppect_update_coalesced_total", "counter",
+                      "Subscription changes merged into an already scheduled pass.");
+         write_sample(out, "incppect_update_coalesced_total", "", double(n_coalesced.load()));
+         write_header(out, "incppect_broadcast_frames_total", "counter",
+                      "Frames encoded once and published to a channel of several clients.");
+         write_sample(out, "incppect_broadcast_frames_total", "", double(n_broadcasts.load()));
+         write_header(out, "incppect_broadcast_receivers_total", "counter", "Clients the published frames were sent to.");
+         write_sample(out, "incppect_broadcast_receivers_total", "", double(n_broadcast_receivers.load()));
+         write_header(out, "incppect_update_duration_seconds", "histogram", "Duration of the update passes.");
+         write_histogram(out, "incppect_update_duration_seconds", "", update_latency.load());
+
+         write_header(out, "incppect_getter_calls_total", "counter", "Getter calls.");
+         for (const auto& [path, getter_id] : pathToGetter) {
+            write_sample(out, "incppect_getter_calls_total", label("path", path),
+                         double(getter_metrics[getter_id]->n_calls.load()));
+         }
+         write_header(out, "incppect_getter_duration_seconds", "histogram",
+                      std::format("Duration of the getter calls, sampled every {}th call.",
+                                  metrics::getter_counters::kSamplePeriod));
+         for (const auto& [path, getter_id] : pathToGetter) {
+            write_histogram(out, "incppect_getter_duration_seconds", label("path", path),
+                            getter_metrics[getter_id]->latency.load());
+         }
+         write_header(out, "incppect_async_jobs", "gauge", "Calls of the asynchronous getters queued or running.");
+         write_sample(out, "incppect_async_jobs", "", double(async_pool.n_jobs()));
+
+         const auto write_codec_metric = [&](std::string_view name, std::string_view help, auto member) {
+            write_header(out, name, "counter", help);
+            for (size_t k = 1; k < codec::kKinds; ++k) {
+               write_sample(out, name, std::format("codec=\"{}\"", codec::name(codec::kind(k))),
+                            double(codec_metrics[k].load().*member));
+            }
+         };
+         write_codec_metric("incppect_codec_entries_total", "Vars sent with the codec.", &codec::codec_data::n_entries);
+         write_codec_metric("incppect_codec_in_bytes_total", "Content bytes of the vars sent with the codec.",
+                            &codec::codec_data::bytes_in);
+         write_codec_metric("incppect_codec_out_bytes_total",
+                            "Entry bytes of the vars sent with the codec, before compression.",
+                            &codec::codec_data::bytes_out);
+         write_codec_metric("incppect_codec_encodes_total", "Encodings of a var version with the codec.",
+                            &codec::codec_data::n_encodes);
+         write_codec_metric("incppect_codec_encode_nanoseconds_total", "Time spent in the encodings.",
+                            &codec::codec_data::encode_ns);
+
+         // copy the counters first, the samples of a metric must be written together
+         struct client_row
+         {
+            int32_t client_id;
+            int32_t loop;
+            client_data data;
+         };
+         std::vector<client_row> rows;
+         for (auto& shard : shards) {
+            std::lock_guard lock(shard->clients_mutex);
+            for (const auto& [client_id, cd] : shard->client_data) {
+               rows.push_back({client_id, shard->index, cd.counters.load()});
             }
+         }
 
-            auto& buf = cd.buf;
-            auto& prev = cd.prev;
-            auto& diff = cd.diff;
+         const auto write_client_metric = [&](std::string_view name, std::string_view help, auto member) {
+            write_header(out, name, "counter", help);
+            for (const auto& row : rows) {
+               write_sample(out, name, std::format("client=\"{}\",loop=\"{}\"", row.client_id, row.loop),
+                            double(row.data.*member));
+            }
+         };
+         write_client_metric("incppect_client_frames_total", "Frames sent to the client.", &client_data::n_frames);
+         write_client_metric("incppect_client_diff_frames_total", "Frames sent as a diff of the previous frame.",
+                             &client_data::n_diff_frames);
+         write_client_metric("incppect_client_no_change_total", "No change messages sent to the client.",
+                             &client_data::n_no_change);
+         write_client_metric("incppect_client_tx_bytes_total", "Payload bytes sent, before compression.",
+                             &client_data::tx_bytes);
+         write_client_metric("incppect_client_tx_full_bytes_total",
+                             "Payload bytes of the same frames with all vars in full, for the diff ratio.",
+                             &client_data::tx_full_bytes);
+         write_client_metric("incppect_client_tx_compressed_bytes_total",
+                             "Estimate of the payload bytes sent, after compression.",
+                             &client_data::tx_compressed_bytes);
+         write_client_metric("incppect_client_backpressure_total", "Sends that left data in the socket buffer.",
+                             &client_data::n_backpressure);
+         write_client_metric("incppect_client_skipped_total", "Update passes skipped while the socket drained.",
+                             &client_data::n_skipped);
+         write_client_metric("incppect_client_resyncs_total", "Keyframes requested by the client after losing a frame.",
+                             &client_data::n_resyncs);
+         write_client_metric("incppect_client_chunks_total", "Chunks of vars larger than the chunk size.",
+                             &client_data::n_chunks);
+         write_client_metric("incppect_client_deferred_total", "Due vars left for a later pass by the bandwidth budget.",
+                             &client_data::n_deferred);
+      }
 
-            buf.clear();
+#if INCPPECT_TRACE
+      // the recorded spans of all loops as Chrome trace-event JSON, can be called from any thread
+      void write_trace(std::string& out)
+      {
+         std::vector<std::string> getter_paths(getters.size());
+         for (const auto& [path, getter_id] : pathToGetter) {
+            getter_paths[getter_id] = path;
+         }
+         const auto name_of = [&](const trace::event& e) {
+            const bool is_getter =
+               e.kind == trace::span::getter || e.kind == trace::span::xor_rle || e.kind == trace::span::lz4;
+            return is_getter && size_t(e.arg) < getter_paths.size() ? getter_paths[e.arg] : std::string{};
+         };
 
-            uint32_t typeAll = 0;
-            buf.append((char*)(&typeAll), sizeof(typeAll));
-
-            for (auto& [req_id, req] : cd.requests) {
-               auto& getter = getters[req.getter_id];
-               const auto t = timestamp();
-               if (((req.t_last_req_timeout_ms < 0 && req.t_last_req_ms > 0) ||
-                    (t - req.t_last_req_ms < req.t_last_req_timeout_ms)) &&
-                   t - req.t_last_update_ms > req.t_min_update_ms) {
-                  if (req.t_last_req_timeout_ms < 0) {
-                     req.t_last_req_ms = 0;
-                  }
+         out += "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+         bool first = true;
+         std::vector<trace::event> events;
+         for (const auto& shard : shards) {
+            std::format_to(std::back_inserter(out),
+                           "{}\n{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"loop {}\"}}}}",
+                           first ? "" : ",", shard->index, shard->index);
+            first = false;
+
+            events.clear();
+            shard->trace.read(events);
+            trace::write_events(out, events, shard->index, name_of, first);
+         }
+         out += "\n]}\n";
+      }
 
-                  req.cur = getter(req.idxs);
-                  req.t_last_update_ms = t;
+      // write the trace to a file, returns false on error
+      bool write_trace(const std::string& filename)
+      {
+         std::string out;
+         write_trace(out);
+         std::ofstream file(filename, std::ios::binary);
+         file.write(out.data(), out.size());
+         return bool(file);
+      }
+#endif
 
-                  constexpr int kPadding = 4;
+      // drop the requests of a client and its data
+      void remove_client(Shard& shard, int32_t client_id)
+      {
+         if (auto it = shard.client_data.find(client_id); it != shard.client_data.end()) {
+            leave_channel(shard, client_id, it->second);
+            for (const auto snapshot_id : it->second.requests.snapshot_id) {
+               if (snapshot_id >= 0) release_snapshot(shard, snapshot_id);
+            }
+            std::lock_guard lock(shard.clients_mutex);
+            shard.client_data.erase(it);
+         }
+      }
 
-                  int data_size = req.cur.size();
-                  int padding_bytes = 0;
-                  {
-                     int r = data_size % kPadding;
-                     while (r > 0 && r < kPadding) {
-                        ++data_size;
-                        ++padding_bytes;
-                        ++r;
-                     }
-                  }
+      // push the due requests of the shard on every tick, independently of the messages from the clients
+      void start_timer(Shard& shard)
+      {
+         struct timer_data
+         {
+            Incppect* self;
+            Shard* shard;
+         };
 
-                  int32_t type = 0; // full update
-                  if (req.prev.size() == req.cur.size() + padding_bytes && req.cur.size() > 256) {
-                     type = 1; // run-length encoding of diff
-                  }
+         shard.timer = us_create_timer((us_loop_t*)shard.loop, 0, sizeof(timer_data));
+         *(timer_data*)us_timer_ext(shard.timer) = {this, &shard};
+
+         const int32_t t_tick_ms = std::max(parameters.t_tick_ms, 1);
+         us_timer_set(
+            shard.timer,
+            [](us_timer_t* timer) {
+               auto* data = (timer_data*)us_timer_ext(timer);
+               data->self->update(*data->shard);
+            },
+            t_tick_ms, t_tick_ms);
+      }
 
-                  buf.append((char*)(&req_id), sizeof(req_id));
-                  buf.append((char*)(&type), sizeof(type));
-
-                  if (type == 0) {
-                     buf.append((char*)(&data_size), sizeof(data_size));
-                     buf.append(req.cur);
-                     {
-                        char v = 0;
-                        for (int i = 0; i < padding_bytes; ++i) {
-                           buf.append((char*)(&v), sizeof(v));
-                        }
-                     }
-                  }
-                  else if (type == 1) {
-                     uint32_t a = 0;
-                     uint32_t b = 0;
-                     uint32_t c = 0;
-                     uint32_t n = 0;
-                     req.diff.clear();
-
-                     for (int i = 0; i < (int)req.cur.size(); i += 4) {
-                        std::memcpy(&a, req.prev.data() + i, sizeof(uint32_t));
-                        std::memcpy(&b, req.cur.data() + i, sizeof(uint32_t));
-                        a = a ^ b;
-                        if (a == c) {
-                           ++n;
-                        }
-                        else {
-                           if (n > 0) {
-                              req.diff.append((char*)(&n), sizeof(uint32_t));
-                              req.diff.append((char*)(&c), sizeof(uint32_t));
-                           }
-                           n = 1;
-                           c = a;
-                        }
-                     }
-
-                     if (req.cur.size() % 4 != 0) {
-                        a = 0;
-                        b = 0;
-                        uint32_t i = (req.cur.size() / 4) * 4;
-                        uint32_t k = req.cur.size() - i;
-                        std::memcpy(&a, req.prev.data() + i, k);
-                        std::memcpy(&b, req.cur.data() + i, k);
-                        a = a ^ b;
-                        if (a == c) {
-                           ++n;
-                        }
-                        else {
-                           req.diff.append((char*)(&n), sizeof(uint32_t));
-                           req.diff.append((char*)(&c), sizeof(uint32_t));
-                           n = 1;
-                           c = a;
-                        }
-                     }
-
-                     req.diff.append((char*)(&n), sizeof(uint32_t));
-                     req.diff.append((char*)(&c), sizeof(uint32_t));
-
-                     data_size = req.diff.size();
-                     buf.append((char*)(&data_size), sizeof(data_size));
-                     buf.append(req.diff);
-                  }
+      // handle a message received from a client connected to the first loop
+      bool process_message(int32_t client_id, std::string_view message)
+      {
+         return process_message(*shards[0], client_id, message);
+      }
 
-                  req.prev = req.cur;
-               }
-            }
-
-            if (buf.size() > 4) {
-               if (buf.size() == prev.size() && buf.size() > 256) {
-                  uint32_t a = 0;
-                  uint32_t b = 0;
-                  uint32_t c = 0;
-                  uint32_t n = 0;
-                  diff.clear();
-
-                  uint32_t typeAll = 1;
-                  diff.append((char*)(&typeAll), sizeof(typeAll));
-
-                  for (int i = 4; i < (int)buf.size(); i += 4) {
-                     std::memcpy(&a, prev.data() + i, sizeof(uint32_t));
-                     std::memcpy(&b, buf.data() + i, sizeof(uint32_t));
-                     a = a ^ b;
-                     if (a == c) {
-                        ++n;
-                     }
-                     else {
-                        if (n > 0) {
-                           diff.append((char*)(&n), sizeof(uint32_t));
-                           diff.append((char*)(&c), sizeof(uint32_t));
-                        }
-                        n = 1;
-                        c = a;
-                     }
-                  }
+      // handle a message received from a client
+      // returns true if it changed the subscriptions of the client and an update should follow
+      bool process_message(Shard& shard, int32_t client_id, std::string_view message)
+      {
+         rx_count += message.size();
+         if (message.size() < sizeof(int)) {
+            return false;
+         }
 
-                  diff.append((char*)(&n), sizeof(uint32_t));
-                  diff.append((char*)(&c), sizeof(uint32_t));
+         int32_t type;
+         std::memcpy(&type, message.data(), sizeof(type));
 
-                  if ((int32_t)diff.size() > parameters.max_payload) {
-                     print("[incppect] warning: buffer size ({}) exceeds maxPayloadLength ({})\n", diff.size(),
-                           parameters.max_payload);
-                  }
+         bool do_update = true;
+
+         auto it_cd = shard.client_data.find(client_id);
+         if (it_cd == shard.client_data.end()) {
+            std::lock_guard lock(shard.clients_mutex);
+            it_cd = shard.client_data.emplace_hint(it_cd, std::piecewise_construct, std::forward_as_tuple(client_id),
+                                                   std::forward_as_tuple());
+         }
+         auto& cd = it_cd->second;
+
+         switch (type) {
+         case 1: {
+            // text registration:
+            //
+            //   [1] n x "path req_id nidxs idxs...", separated by whitespace
+            //
+            std::stringstream ss(std::string(message.substr(sizeof(int32_t))));
+            while (true) {
+               std::string path;
+               int req_id = 0;
+               int nidxs = 0;
+               if (!(ss >> path >> req_id >> nidxs)) {
+                  break;
+               }
 
-                  // compress only for message larger than 64 bytes
-                  bool doCompress = diff.size() > 64;
+               // every index takes at least a digit and a separator
+               if (nidxs < 0 || size_t(nidxs) > message.size() / 2) {
+                  print("[incppect] error : invalid registration data!\n");
+                  break;
+               }
 
-                  if (socket_data[client_id]->ws->send({diff.data(), diff.size()}, uWS::OpCode::BINARY, doCompress) ==
-                      false) {
-                     print("[incpeect] warning: backpressure for client {} increased \n", client_id);
-                  }
+               auto& idxs = shard.idxs_scratch;
+               idxs.resize(nidxs);
+               for (auto& idx : idxs) {
+                  ss >> idx;
+               }
+               if (ss.fail()) {
+                  print("[incppect] error : invalid registration data!\n");
+                  break;
+               }
+
+               if (pathToGetter.contains(path)) {
+                  print("[incppect] req_id = {}, path = '{}', nidxs = {}\n", req_id, path, nidxs);
+                  register_request(shard, client_id, cd, req_id, pathToGetter[path], idxs);
                }
                else {
-                  if (int32_t(buf.size()) > parameters.max_payload) {
-                     print("[incppect] warning: buffer size ({}) exceeds maxPayloadLength ({})\n", (int)buf.size(),
-                           parameters.max_payload);
-                  }
+                  print("[incppect] missing path '{}'\n", path);
+               }
+            }
+            break;
+         }
+         case 2: {
+            const size_t n_requests = (message.size() - sizeof(int32_t)) / sizeof(int32_t);
+            if (n_requests * sizeof(int32_t) + sizeof(int32_t) != message.size()) {
+               print("[incppect] error : invalid message data!\n");
+               return false;
+            }
+            print("[incppect] received requests: {}\n", n_requests);
+
+            const auto t = timestamp();
+            cd.last_requests.clear();
+            for (size_t i = 0; i < n_requests; ++i) {
+               int32_t req_id;
+               std::memcpy(&req_id, message.data() + 4 * (i + 1), sizeof(req_id));
+               if (cd.requests.contains(req_id)) {
+                  cd.last_requests.emplace_back(req_id);
+                  cd.requests.t_last_req_ms[req_id] = t;
+                  cd.requests.t_last_req_timeout_ms[req_id] = parameters.t_last_req_timeout_ms;
+               }
+            }
+            break;
+         }
+         case 3: {
+            // keepalive, the requests are pushed by the timer
+            do_update = false;
+
+            const auto t = timestamp();
+            for (auto req_id : cd.last_requests) {
+               if (cd.requests.contains(req_id)) {
+                  cd.requests.t_last_req_ms[req_id] = t;
+                  cd.requests.t_last_req_timeout_ms[req_id] = parameters.t_last_req_timeout_ms;
+               }
+            }
+            break;
+         }
+         case 5: {
+            // binary registration, parsed in place:
+            //
+            //   [5] n x [req_id][getter_id][nidxs][idxs...], all int32
+            //
+            const auto read = [&message](size_t offset) {
+               int32_t v;
+               std::memcpy(&v, message.data() + offset, sizeof(v));
+               return v;
+            };
 
-                  // compress only for message larger than 64 bytes
-                  const bool compress = buf.size() > 64;
-                  if (socket_data[client_id]->ws->send({buf.data(), buf.size()}, uWS::OpCode::BINARY, compress) ==
-                      false) {
-                     print("[incpeect] warning: backpressure for client {} increased \n", client_id);
-                  }
+            size_t offset = sizeof(int32_t);
+            while (offset + 3 * sizeof(int32_t) <= message.size()) {
+               const int32_t req_id = read(offset);
+               const int32_t getter_id = read(offset + 4);
+               const int32_t nidxs = read(offset + 8);
+               offset += 3 * sizeof(int32_t);
+
+               if (nidxs < 0 || offset + nidxs * sizeof(int32_t) > message.size()) {
+                  print("[incppect] error : invalid registration data!\n");
+                  break;
                }
 
-               tx_count += buf.size();
+               auto& idxs = shard.idxs_scratch;
+               idxs.resize(nidxs);
+               for (int32_t i = 0; i < nidxs; ++i) {
+                  idxs[i] = read(offset + i * sizeof(int32_t));
+               }
+               offset += nidxs * sizeof(int32_t);
+
+               if (getter_id < 0 || getter_id >= int32_t(getters.size())) {
+                  print("[incppect] missing getter id {}\n", getter_id);
+                  continue;
+               }
 
-               prev = buf;
+               register_request(shard, client_id, cd, req_id, getter_id, idxs);
             }
+            break;
          }
+         case 6: {
+            // request options:
+            //
+            //   [6] n x [req_id][option][value], all int32
+            //
+            do_update = false;
+
+            const size_t n_options = (message.size() - sizeof(int32_t)) / (3 * sizeof(int32_t));
+            for (size_t i = 0; i < n_options; ++i) {
+               int32_t v[3];
+               std::memcpy(v, message.data() + sizeof(int32_t) + i * sizeof(v), sizeof(v));
+
+               const auto [req_id, option, value] = v;
+               if (!cd.requests.contains(req_id)) {
+                  continue;
+               }
+
+               switch (request_option(option)) {
+               case request_option::update_period_ms:
+                  cd.requests.t_min_update_ms[req_id] = value;
+                  break;
+               case request_option::quantization:
+                  set_format(shard, cd, req_id, quant::format::from_option(value));
+                  break;
+               case request_option::codec:
+                  cd.requests.codec[req_id] = codec::from_option(value);
+                  break;
+               case request_option::priority:
+                  cd.requests.priority[req_id] = value;
+                  break;
+               default:
+                  print("[incppect] unknown request option: {}\n", option);
+               }
+            }
+            break;
+         }
+         case 7: {
+            // playback control of a replayed recording:
+            //
+            //   [7][command][value], all int32
+            //
+            do_update = false;
+
+            int32_t v[3];
+            if (message.size() < sizeof(v)) {
+               break;
+            }
+            std::memcpy(v, message.data(), sizeof(v));
+            if (playback_handler) {
+               playback_handler(playback_command(v[1]), v[2]);
+            }
+            break;
+         }
+         case 9: {
+            // frame acknowledgement:
+            //
+            //   [9][seq][flags], all int32. seq is the last frame the client decoded, flags bit 0 asks for a keyframe
+            //
+            do_update = false;
+
+            int32_t v[3];
+            if (message.size() < sizeof(v)) {
+               break;
+            }
+            std::memcpy(v, message.data(), sizeof(v));
+            const auto t = timestamp();
+            cd.acked_seq = uint32_t(v[1]);
+            cd.flow.on_ack(cd.acked_seq, t);
+
+            // followers resync with the frames of the whole channel. a keyframe that is due, or on its way, answers
+            // the request already
+            auto& target = cd.channel ? *cd.channel->members.front().second : cd;
+            const bool in_flight = int32_t(target.keyframe_seq - cd.acked_seq) > 0 &&
+                                   t - target.t_last_keyframe_ms < ClientData::kKeyframeInFlightMs;
+            if ((v[2] & 1) && !target.keyframe && !in_flight) {
+               target.keyframe = true;
+               target.dirty = true;
+               metrics::add(cd.counters.n_resyncs, 1);
+               print("[incppect] client {} lost frame {}, sending a keyframe\n", client_id, cd.acked_seq + 1);
+               do_update = true; // without waiting for the next tick
+            }
+            break;
+         }
+         case 8: {
+            // channel:
+            //
+            //   [8] name, zero-padded to 4 bytes. an empty name returns to the automatic grouping
+            //
+            const auto name = message.substr(sizeof(int32_t));
+            cd.channel_name = name.substr(0, name.find('\0'));
+            break;
+         }
+         case 4: {
+            do_update = false;
+            if (handler && message.size() > sizeof(int32_t)) {
+               handler(client_id, event::custom,
+                       {message.data() + sizeof(int32_t), message.size() - sizeof(int32_t)});
+            }
+            break;
+         }
+         default:
+            print("[incppect] unknown message type: {}\n", type);
+         };
+
+         if (do_update) {
+            cd.dirty = true;
+         }
+
+         // registrations, request lists, options and channel names can change the channel of the client
+         if (do_update || type == 6) {
+            schedule_regroup(shard, client_id, cd);
+         }
+
+         return do_update;
+      }
+
+      // send the changed subscriptions without waiting for the next tick
+      // any number of messages received before the deferred call runs result in a single pass over the dirty clients
+      void schedule_update(Shard& shard)
+      {
+         if (shard.update_scheduled) {
+            ++n_coalesced;
+            return;
+         }
+         shard.update_scheduled = true;
+
+         shard.loop->defer([this, &shard] {
+            shard.update_scheduled = false;
+            ++n_deferred_passes;
+            update(shard, true);
+         });
+      }
+
+      // returns the id of the snapshot for (getter_id, idxs) in the given encoding, creating it if needed
+      int32_t acquire_snapshot(Shard& shard, int32_t getter_id, std::span<const int> idxs, quant::format format = {})
+      {
+         auto& snapshots = shard.snapshots;
+         auto& free_snapshots = shard.free_snapshots;
+
+         const SnapshotVar key{getter_id, format};
+         auto it = shard.snapshot_ids.find(std::pair{key, idxs});
+         if (it == shard.snapshot_ids.end()) {
+            int32_t snapshot_id = -1;
+            if (free_snapshots.empty()) {
+               snapshot_id = snapshots.size();
+               snapshots.emplace_back();
+            }
+            else {
+               snapshot_id = free_snapshots.back();
+               free_snapshots.pop_back();
+            }
+
+            auto& snapshot = snapshots[snapshot_id];
+            snapshot.getter_id = getter_id;
+            snapshot.idxs.assign(idxs.begin(), idxs.end());
+            snapshot.format = format;
+            snapshot.shared = acquire_shared(getter_id, idxs, format);
+
+            it = shard.snapshot_ids.emplace(std::pair{key, snapshot.idxs}, snapshot_id).first;
+         }
+
+         ++snapshots[it->second].n_refs;
+         return it->second;
+      }
+
+      // the snapshot of (getter_id, idxs) in the given encoding shared by the loops, or one of its own for a local
+      // getter
+      std::shared_ptr<SharedSnapshot> acquire_shared(int32_t getter_id, std::span<const int> idxs,
+                                                     quant::format format)
+      {
+         const auto create = [&]() {
+            auto shared = std::make_shared<SharedSnapshot>();
+            shared->getter_id = getter_id;
+            shared->idxs.assign(idxs.begin(), idxs.end());
+            shared->format = format;
+            return shared;
+         };
+
+         if (local_getters[getter_id]) {
+            return create();
+         }
+
+         std::lock_guard lock(snapshots_mutex);
+         const SnapshotVar key{getter_id, format};
+         auto it = shared_snapshots.find(std::pair{key, idxs});
+         if (it == shared_snapshots.end()) {
+            auto shared = create();
+            it = shared_snapshots.emplace(std::pair{key, shared->idxs}, std::move(shared)).first;
+         }
+
+         ++it->second->n_refs;
+         return it->second;
+      }
+
+      void release_shared(const std::shared_ptr<SharedSnapshot>& shared)
+      {
+         if (local_getters[shared->getter_id]) {
+            return;
+         }
+
+         std::lock_guard lock(snapshots_mutex);
+         if (--shared->n_refs == 0) {
+            shared_snapshots.erase({SnapshotVar{shared->getter_id, shared->format}, shared->idxs});
+         }
+      }
+
+      // (re-)assign a client request to the var (getter_id, idxs)
+      // an index of -1 is replaced by the client id
+      void register_request(Shard& shard, int32_t client_id, ClientData& cd, int32_t req_id, int32_t getter_id,
+                            std::span<int> idxs)
+      {
+         for (auto& idx : idxs) {
+            if (idx == -1) idx = client_id;
+         }
+
+         auto& requests = cd.requests;
+         if (!requests.valid(req_id)) {
+            print("[incppect] error : invalid req_id {}, the table has {} of at most {} slots\n", req_id,
+                  requests.size(), RequestTable::kMaxRequests);
+            return;
+         }
+
+         const int32_t snapshot_id = acquire_snapshot(shard, getter_id, idxs);
+
+         if (requests.contains(req_id)) {
+            release_snapshot(shard, requests.snapshot_id[req_id]);
+            if (requests.snapshot_id[req_id] == snapshot_id) {
+               return; // re-registration of the same var, keep what the client already has
+            }
+         }
+
+         requests.assign(req_id, snapshot_id);
+      }
+
+      // move a request to the snapshot of its var in another encoding, the client receives it in full
+      void set_format(Shard& shard, ClientData& cd, int32_t req_id, quant::format format)
+      {
+         auto& requests = cd.requests;
+         const int32_t old_id = requests.snapshot_id[req_id];
+         if (shard.snapshots[old_id].format == format) {
+            return;
+         }
+
+         // acquire_snapshot() may grow the snapshots, copy the key first
+         auto& idxs = shard.idxs_scratch;
+         idxs = shard.snapshots[old_id].idxs;
+         const int32_t getter_id = shard.snapshots[old_id].getter_id;
+
+         requests.snapshot_id[req_id] = acquire_snapshot(shard, getter_id, idxs, format);
+         requests.version[req_id] = 0;
+         release_snapshot(shard, old_id);
+      }
+
+      // hash of what the frames of a client depend on: its active requests, their snapshots and their options
+      static uint64_t signature(const ClientData& cd)
+      {
+         uint64_t h = 14695981039346656037ull; // FNV-1a
+         const auto mix = [&h](int64_t v) {
+            for (int i = 0; i < 8; ++i) {
+               h = (h ^ uint8_t(v >> (8 * i))) * 1099511628211ull;
+            }
+         };
+
+         const auto& reqs = cd.requests;
+         for (const int32_t req_id : cd.last_requests) {
+            mix(req_id);
+            mix(reqs.snapshot_id[req_id]);
+            mix(reqs.t_min_update_ms[req_id]);
+            mix(int64_t(reqs.codec[req_id]));
+            mix(reqs.priority[req_id]);
+         }
+         return h;
+      }
+
+      // the frames of a and b are the same, given the same versions of their requests
+      static bool same_subscriptions(const ClientData& a, const ClientData& b)
+      {
+         if (a.last_requests != b.last_requests) {
+            return false;
+         }
+         for (const int32_t req_id : a.last_requests) {
+            if (a.requests.snapshot_id[req_id] != b.requests.snapshot_id[req_id] ||
+                a.requests.t_min_update_ms[req_id] != b.requests.t_min_update_ms[req_id] ||
+                a.requests.codec[req_id] != b.requests.codec[req_id] ||
+                a.requests.priority[req_id] != b.requests.priority[req_id]) {
+               return false;
+            }
+         }
+         return true;
+      }
+
+      // group the client again in the next update() pass
+      static void schedule_regroup(Shard& shard, int32_t client_id, ClientData& cd)
+      {
+         if (!cd.regroup) {
+            cd.regroup = true;
+            shard.regroup.push_back(client_id);
+         }
+      }
+
+      // move the clients whose subscriptions changed to the channels they now belong to
+      void group_clients(Shard& shard)
+      {
+         for (const int32_t client_id : shard.regroup) {
+            if (auto it = shard.client_data.find(client_id); it != shard.client_data.end()) {
+               it->second.regroup = false;
+               group(shard, client_id, it->second);
+            }
+         }
+         shard.regroup.clear();
+      }
+
+      // make a client a member of the channel of its (name, subscriptions)
+      //
+      //   the clients with a socket and active requests are grouped, by name if they chose one and otherwise only
+      //   with Parameters::auto_channels. the channel sends a keyframe when a client joins, so that all members
+      //   share the state the next frames are diffed against
+      //
+      void group(Shard& shard, int32_t client_id, ClientData& cd)
+      {
+         const auto it_sd = shard.socket_data.find(client_id);
+         const bool eligible = it_sd != shard.socket_data.end() && !cd.last_requests.empty() && cd.t_lagged_ms < 0 &&
+                               !cd.idle && (parameters.auto_channels || !cd.channel_name.empty());
+         if (!eligible) {
+            leave_channel(shard, client_id, cd);
+            return;
+         }
+
+         std::pair key{cd.channel_name, signature(cd)};
+         if (cd.channel && cd.channel->key == key) {
+            return;
+         }
+         leave_channel(shard, client_id, cd);
+
+         auto& channel = shard.channels[key];
+         if (!channel.members.empty() && !same_subscriptions(*channel.members.front().second, cd)) {
+            return; // collision of the signatures, the client stays on its own
+         }
+         if (channel.members.empty()) {
+            channel.key = std::move(key);
+            channel.topic = std::format("incppect/channel/{}", shard.n_topics++);
+         }
+         else {
+            auto& leader = *channel.members.front().second;
+            leader.keyframe = true;
+            leader.dirty = true;
+         }
+
+         channel.members.emplace_back(client_id, &cd);
+         cd.channel = &channel;
+         it_sd->second->ws->subscribe(channel.topic);
+      }
+
+      void leave_channel(Shard& shard, int32_t client_id, ClientData& cd)
+      {
+         if (!cd.channel) {
+            return;
+         }
+         const bool leader = cd.leads();
+         auto& channel = *cd.channel;
+         cd.channel = nullptr;
+
+         auto& members = channel.members;
+         members.erase(std::find_if(members.begin(), members.end(), [&](const auto& m) { return m.second == &cd; }));
+         if (auto it_sd = shard.socket_data.find(client_id); it_sd != shard.socket_data.end()) {
+            it_sd->second->ws->unsubscribe(channel.topic);
+         }
+
+         // the frames a follower received were not encoded against its own requests, and a new leader is in the
+         // same situation: both start again from a keyframe
+         if (!leader) {
+            cd.keyframe = true;
+            cd.dirty = true;
+         }
+         else if (!members.empty()) {
+            auto& next = *members.front().second;
+            next.keyframe = true;
+            next.dirty = true;
+         }
+
+         if (members.empty()) {
+            shard.channels.erase(channel.key);
+         }
+      }
+
+      static size_t buffered_amount(const Shard& shard, int32_t client_id)
+      {
+         const auto it_sd = shard.socket_data.find(client_id);
+         return it_sd != shard.socket_data.end() ? it_sd->second->ws->getBufferedAmount() : 0;
+      }
+
+      // bytes the frame of a client may take in this pass: what its connection drains until the next pass (see
+      // flow.h), or without Parameters::bandwidth_budget nothing while its socket buffer is not empty. the frames of
+      // a channel take the budget of its leader, see drop_lagging()
+      int64_t frame_budget(const Shard& shard, int32_t client_id, ClientData& cd, int64_t t)
+      {
+         const size_t buffered = buffered_amount(shard, client_id);
+         if (!parameters.bandwidth_budget) {
+            return buffered ? int64_t(0) : flow::kUnlimited;
+         }
+         return cd.flow.budget(t, buffered);
+      }
+
+      // some request of the client is alive, see RequestTable::alive()
+      static bool requests_alive(const ClientData& cd, int64_t t)
+      {
+         return std::any_of(cd.last_requests.begin(), cd.last_requests.end(), [&](int32_t req_id) {
+            return cd.requests.contains(req_id) && cd.requests.alive(req_id, t);
+         });
+      }
+
+      // the frames of a channel are due when the requests of its leader are. the members whose requests expired
+      // (e.g. a page in a background tab, which stops renewing them) leave the channel, the leader included, so the
+      // others keep receiving frames. they are grouped again once they renew their requests. nobody leaves if the
+      // requests of all members expired
+      void drop_idle(Shard& shard, ClientData& cd, int64_t t)
+      {
+         if (!cd.channel || cd.channel->members.size() < 2) {
+            return;
+         }
+         auto& members = cd.channel->members;
+         const auto alive = [&](const std::pair<int32_t, ClientData*>& member) {
+            return requests_alive(*member.second, t);
+         };
+         if (std::none_of(members.begin(), members.end(), alive)) {
+            return;
+         }
+         for (size_t i = members.size(); i-- > 0 && members.size() > 1;) {
+            const auto member = members[i];
+            if (alive(member)) {
+               continue;
+            }
+            print("[incppect] the requests of client {} expired, it leaves its channel\n", member.first);
+            member.second->idle = true;
+            leave_channel(shard, member.first, *member.second);
+         }
+      }
+
+      // the frame of a channel is published to the sockets of all members. the members whose own budget cannot take
+      // it leave the channel before it is published and continue on their own, from a keyframe, instead of slowing
+      // down the others. they are grouped again after Parameters::t_channel_rejoin_ms, once their socket buffer is
+      // empty. with_leader, before the frame is encoded, also a leader that cannot take any frame leaves and the next
+      // member leads. nobody leaves if no member can take the frame
+      void drop_lagging(Shard& shard, ClientData& cd, int64_t t, size_t frame_size, bool with_leader)
+      {
+         if (!cd.channel || cd.channel->members.size() < 2) {
+            return;
+         }
+         auto& members = cd.channel->members;
+         const auto fits = [&](const std::pair<int32_t, ClientData*>& member) {
+            return frame_budget(shard, member.first, *member.second, t) >= int64_t(frame_size);
+         };
+         if (std::none_of(members.begin(), members.end(), fits)) {
+            return;
+         }
+         for (size_t i = members.size(); i-- > (with_leader ? 0 : 1) && members.size() > 1;) {
+            const auto member = members[i];
+            if (fits(member)) {
+               continue;
+            }
+            print("[incppect] client {} lags behind its channel, sending it frames of its own\n", member.first);
+            member.second->t_lagged_ms = t;
+            leave_channel(shard, member.first, *member.second);
+         }
+      }
+
+      // send a message of a client, or publish it once to all members of the channel it leads
+      // returns false if the socket of the client could not take the message
+      bool send(Shard& shard, ClientData& cd, uWS::WebSocket<SSL, true, PerSocketData>* ws, std::string_view msg,
+                bool compress, bool keyframe)
+      {
+         if (cd.channel && cd.channel->members.size() > 1) {
+            n_broadcasts.fetch_add(1, std::memory_order_relaxed);
+            n_broadcast_receivers.fetch_add(cd.channel->members.size(), std::memory_order_relaxed);
+            if (shard.app) {
+               shard.app->publish(cd.channel->topic, msg, uWS::OpCode::BINARY, compress);
+               return true;
+            }
+            // loops driven without an app
+            for (const auto& [client_id, member] : cd.channel->members) {
+               if (auto it_sd = shard.socket_data.find(client_id); it_sd != shard.socket_data.end()) {
+                  it_sd->second->ws->send(msg, uWS::OpCode::BINARY, compress);
+               }
+            }
+            return true;
+         }
+
+         if (ws) {
+            return ws->send(msg, uWS::OpCode::BINARY, compress);
+         }
+         if (cd.sink) {
+            cd.sink(msg, keyframe);
+         }
+         return true;
+      }
+
+      // call f with a client, or with all members of the channel it leads
+      template <class F>
+      static void for_each_receiver(ClientData& cd, F&& f)
+      {
+         if (cd.channel && cd.channel->members.size() > 1) {
+            for (const auto& [client_id, member] : cd.channel->members) {
+               f(*member);
+            }
+            return;
+         }
+         f(cd);
+      }
+
+      // message listing the (getter_id, path) pairs of all vars, sent to the clients when they connect:
+      //
+      //   [2][n] n x [getter_id][path length][path, zero-padded to 4 bytes], all int32
+      //
+      void build_getter_table(std::string& msg) const
+      {
+         const auto append = [&msg](int32_t v) { msg.append((const char*)(&v), sizeof(v)); };
+
+         msg.clear();
+         append(2);
+         append(int32_t(pathToGetter.size()));
+         for (const auto& [path, getter_id] : pathToGetter) {
+            append(getter_id);
+            append(int32_t(path.size()));
+            msg.append(path);
+            msg.append((4 - path.size() % 4) % 4, 0);
+         }
+      }
+
+      void release_snapshot(Shard& shard, int32_t snapshot_id)
+      {
+         auto& snapshot = shard.snapshots[snapshot_id];
+         if (--snapshot.n_refs > 0) {
+            return;
+         }
+
+         shard.snapshot_ids.erase({SnapshotVar{snapshot.getter_id, snapshot.format}, snapshot.idxs});
+         release_shared(snapshot.shared);
+         snapshot = {};
+         shard.free_snapshots.push_back(snapshot_id);
+      }
+
+      // the shared content of a snapshot was published by another loop during the last tick, the loop can use it
+      // without calling the getter
+      bool fresh(const Shard& shard, SharedSnapshot& shared, int64_t t)
+      {
+         std::lock_guard lock(shared.mutex);
+         return shared.evaluated_by != shard.index && shared.t_evaluated_ms >= 0 &&
+                t - shared.t_evaluated_ms < parameters.t_tick_ms;
+      }
+
+      // mark a snapshot as needed by the current update() pass, the stale ones are evaluated by the pass
+      void need(Shard& shard, int32_t snapshot_id, int64_t t)
+      {
+         auto& snapshot = shard.snapshots[snapshot_id];
+         if (snapshot.tick == shard.tick) {
+            return;
+         }
+         snapshot.tick = shard.tick;
+
+         shard.pass_snapshots.push_back(snapshot_id);
+         if (!fresh(shard, *snapshot.shared, t)) {
+            shard.stale_snapshots.push_back(snapshot_id);
+         }
+      }
+
+      // call the getter of a shared snapshot and publish its content, unless another loop did it in the meantime
+      // requires getter_mutex
+      void evaluate(Shard& shard, SharedSnapshot& shared, int64_t t)
+      {
+         if (fresh(shard, shared, t)) {
+            return;
+         }
+
+         // the content is unchanged, or not available yet
+         const auto evaluated = [&]() {
+            std::lock_guard lock(shared.mutex);
+            shared.t_evaluated_ms = t;
+            shared.evaluated_by = shard.index;
+         };
+
+         std::string_view data{};
+         std::shared_ptr<const std::string> result{}; // of an asynchronous getter, alive until it is copied
+
+         if (const auto& avar = async_vars[shared.getter_id]) {
+            if (!shared.async) {
+               shared.async = avar->find(shared.idxs, t);
+            }
+
+            auto state = shared.async->poll(t, avar->opts);
+            if (state.call) {
+               call_async(shared.getter_id, shared.async, t);
+            }
+            // the app version of an asynchronous var is the number of its results
+            if (!state.data || state.version == shared.app_version) {
+               return evaluated();
+            }
+            shared.app_version = state.version;
+            result = std::move(state.data);
+            data = *result;
+         }
+         else {
+            if (const auto& version = versions[shared.getter_id]) {
+               const uint64_t app_version = version(shared.idxs);
+               if (shared.content && app_version == shared.app_version) {
+                  return evaluated();
+               }
+               shared.app_version = app_version;
+            }
+
+            auto& counters = *getter_metrics[shared.getter_id];
+            const bool timed = counters.n_calls.load(std::memory_order_relaxed) % counters.kSamplePeriod == 0;
+            metrics::add(counters.n_calls, 1);
+
+            INCPPECT_TRACE_SCOPE(shard.trace, getter, shared.getter_id);
+            const auto t_start_ns = timed ? metrics::now_ns() : 0;
+            data = getters[shared.getter_id](shared.idxs);
+            if (timed) {
+               counters.latency.record(metrics::now_ns() - t_start_ns);
+            }
+         }
+
+         if (shared.format.enc != quant::encoding::none) {
+            quant::encode(shared.format, data, shard.quantized, shard.quant_scratch);
+            data = shard.quantized;
+         }
+
+         constexpr size_t kPadding = 4;
+         const size_t padded_size = ((data.size() + kPadding - 1) / kPadding) * kPadding;
+
+         if (shared.content && shared.content->size() == padded_size &&
+             std::string_view{*shared.content}.substr(0, data.size()) == data) {
+            return evaluated();
+         }
+
+         // a buffer no loop references any more, so that the steady state does not allocate. with the loops in step,
+         // the published content, the previous one of the loops and the next one are enough
+         if (shared.buffers.empty()) {
+            for (int i = 0; i < 3; ++i) {
+               shared.buffers.emplace_back(std::make_shared<std::string>())->reserve(padded_size);
+            }
+         }
+
+         std::shared_ptr<std::string> buffer{};
+         for (const auto& b : shared.buffers) {
+            if (b.use_count() == 1) {
+               buffer = b;
+               break;
+            }
+         }
+         if (buffer) {
+            std::atomic_thread_fence(std::memory_order_acquire); // after the last reads of the loops
+         }
+         else {
+            buffer = shared.buffers.emplace_back(std::make_shared<std::string>());
+         }
+         buffer->assign(data);
+         buffer->resize(padded_size, 0);
+
+         std::lock_guard lock(shared.mutex);
+         shared.content = std::move(buffer);
+         ++shared.version;
+         shared.t_evaluated_ms = t;
+         shared.evaluated_by = shard.index;
+      }
+
+      // switch a snapshot needed by the pass to the last content published for it
+      void observe(Snapshot& snapshot)
+      {
+         auto& shared = *snapshot.shared;
+
+         Content content{};
+         {
+            std::lock_guard lock(shared.mutex);
+            if (shared.version == snapshot.shared_version) {
+               return;
+            }
+            content = shared.content;
+            snapshot.shared_version = shared.version;
+         }
+
+         if (snapshot.version == 0) {
+            // allocate the buffer of the later versions with the first one
+            snapshot.diff.reserve(2 * content->size());
+         }
+         snapshot.prev = std::move(snapshot.cur);
+         snapshot.cur = std::move(content);
+         snapshot.has_diff = false;
+         snapshot.has_lz4 = false;
+         snapshot.has_lz4_diff = false;
+         ++snapshot.version;
+      }
+
+      // queue a call of an asynchronous getter for the indices of the entry, started at t
+      //
+      //   the app may complete the call from its own threads at any time, also after the server is destroyed: the
+      //   call shares the ownership of the var, of its counters and of the entry instead of referring to the server
+      //
+      void call_async(int32_t getter_id, std::shared_ptr<async::entry> entry, int64_t t)
+      {
+         auto counters = getter_metrics[getter_id];
+         const bool timed = counters->n_calls.load(std::memory_order_relaxed) % counters->kSamplePeriod == 0;
+         metrics::add(counters->n_calls, 1);
+
+         auto& avar = async_vars[getter_id];
+         async_pool.submit([avar, counters = std::move(counters), entry = std::move(entry), timed, t]() {
+            const auto t_start_ns = timed ? metrics::now_ns() : 0;
+            avar->getter(entry->idxs, [counters, entry, timed, t_start_ns, t](std::string_view data) {
+               if (timed) {
+                  counters->latency.record(metrics::now_ns() - t_start_ns);
+               }
+               entry->complete(data, t);
+            });
+         });
+      }
+
+      // run-length encoding of prev ^ cur, computed once per snapshot version
+      const std::string& snapshot_diff(Shard& shard, Snapshot& snapshot)
+      {
+         if (snapshot.has_diff) {
+            return snapshot.diff;
+         }
+         snapshot.has_diff = true;
+
+         INCPPECT_TRACE_SCOPE(shard.trace, xor_rle, snapshot.getter_id);
+         const auto t0 = metrics::now_ns();
+
+         snapshot.diff.clear();
+         xor_rle::encode(snapshot.prev->data(), snapshot.cur->data(), snapshot.cur->size(), snapshot.diff);
+
+         snapshot.diff_ns = metrics::now_ns() - t0;
+         codec_metrics[size_t(codec::kind::xor_rle)].encoded(snapshot.diff_ns);
+
+         return snapshot.diff;
+      }
+
+      // codec::kind::lz4 entry of cur, or of prev ^ cur with diff, computed once per snapshot version
+      const std::string& snapshot_lz4(Shard& shard, Snapshot& snapshot, bool diff)
+      {
+         auto& out = diff ? snapshot.lz4_diff : snapshot.lz4;
+         auto& has = diff ? snapshot.has_lz4_diff : snapshot.has_lz4;
+         if (has) {
+            return out;
+         }
+         has = true;
+
+         INCPPECT_TRACE_SCOPE(shard.trace, lz4, snapshot.getter_id);
+         const auto t0 = metrics::now_ns();
+
+         const size_t n = snapshot.cur->size();
+         const char* src = snapshot.cur->data();
+
+         // [0, n) holds the XOR, [n, 2n) the shuffled bytes
+         auto& scratch = shard.codec_scratch;
+         scratch.resize(2 * n);
+         if (diff) {
+            for (size_t i = 0; i < n; ++i) {
+               scratch[i] = char((*snapshot.prev)[i] ^ (*snapshot.cur)[i]);
+            }
+            src = scratch.data();
+         }
+         codec::shuffle(src, n, scratch.data() + n);
+
+         // the size of the compression varies between versions, allocate both entries for the worst case with the
+         // first one
+         const size_t capacity = codec::kLz4HeaderSize + codec::lz4::bound(n) + 3;
+         snapshot.lz4.reserve(capacity);
+         snapshot.lz4_diff.reserve(capacity);
+
+         const uint32_t header[2] = {uint32_t(n), diff ? codec::kXorFlag : 0u};
+         out.assign((const char*)header, sizeof(header));
+         shard.lz4.compress(scratch.data() + n, n, out);
+         out.resize(((out.size() + 3) / 4) * 4, 0);
+
+         snapshot.lz4_ns = metrics::now_ns() - t0;
+         codec_metrics[size_t(codec::kind::lz4)].encoded(snapshot.lz4_ns);
+
+         return out;
+      }
+
+      // the codec of the automatic requests of a snapshot: the one minimizing bytes + encoding time, with
+      // parameters.codec_bytes_per_ns as the exchange rate. measured on the current version every
+      // parameters.codec_selection_period versions
+      //
+      //   deflate is estimated from the compression of the sampled frames of the loop, on top of xor_rle
+      //
+      codec::kind select_codec(Shard& shard, Snapshot& snapshot, bool can_diff)
+      {
+         if (snapshot.codec_version != 0 && snapshot.version < snapshot.codec_version + parameters.codec_selection_period) {
+            return snapshot.codec;
+         }
+         snapshot.codec_version = snapshot.version;
+
+         // small vars are not worth measuring, keep the default
+         const size_t n = snapshot.cur->size();
+         if (n <= 256) {
+            return snapshot.codec = codec::kind::deflate;
+         }
+
+         const double rate = parameters.codec_bytes_per_ns;
+
+         double xor_rle_bytes = double(n);
+         double xor_rle_ns = 0.0;
+         if (can_diff) {
+            xor_rle_bytes = double(std::min(snapshot_diff(shard, snapshot).size(), n));
+            xor_rle_ns = double(snapshot.diff_ns);
+         }
+         const double lz4_bytes = double(snapshot_lz4(shard, snapshot, can_diff).size());
+         const double lz4_ns = double(snapshot.lz4_ns);
+
+         const auto xor_rle_size = size_t(xor_rle_bytes);
+         const double deflate_bytes = double(shard.compression.estimate(xor_rle_size));
+         const double deflate_ns = xor_rle_ns + double(shard.compression.estimate_ns(xor_rle_size));
+
+         const std::pair<double, codec::kind> scores[] = {
+            {double(n), codec::kind::raw},
+            {xor_rle_bytes + rate * xor_rle_ns, codec::kind::xor_rle},
+            {lz4_bytes + rate * lz4_ns, codec::kind::lz4},
+            {deflate_bytes + rate * deflate_ns, codec::kind::deflate},
+         };
+
+         return snapshot.codec = std::min_element(std::begin(scores), std::end(scores))->second;
+      }
+
+      // update the clients of the first loop
+      void update() { update(*shards[0]); }
+
+      // send the due requests to the clients of a loop
+      //
+      //   first the snapshots of all due requests are collected. the ones that no other loop evaluated during the
+      //   last tick are evaluated under getter_mutex, copying the app state into their shared content, and the loop
+      //   switches all of them to the last shared content. the frames are then encoded and sent without the lock,
+      //   in parallel with the other loops
+      //
+      // with dirty_only, only the clients whose subscriptions changed since the last pass are considered
+      //
+      void update(Shard& shard, bool dirty_only = false)
+      {
+         const auto t = timestamp();
+         const auto t_start_ns = metrics::now_ns();
+
+         // the chunks keep the entries aligned to 4 bytes
+         const size_t chunk_size = parameters.chunk_size > 0 ? std::max<size_t>(parameters.chunk_size / 4 * 4, 4)
+                                                             : std::numeric_limits<size_t>::max();
+
+         INCPPECT_TRACE_SCOPE(shard.trace, update, -1);
+
+         ++n_passes;
+
+         group_clients(shard);
+
+         ++shard.tick;
+         shard.pass_snapshots.clear();
+         shard.stale_snapshots.clear();
+
+         for (auto& [client_id, cd] : shard.client_data) {
+            cd.due_requests.clear();
+            cd.polled = false;
+            cd.max_frame_size = kFrameHeaderSize;
+
+            if (dirty_only && !cd.dirty) {
+               continue;
+            }
+            cd.dirty = false;
+
+            // the followers of a channel receive the frames of its leader
+            if (cd.channel && !cd.leads()) {
+               continue;
+            }
+
+            // clients without a socket (the recorder, or synthetic clients in the benchmarks) are encoded and passed
+            // to their sink, if any
+            const auto it_sd = shard.socket_data.find(client_id);
+            auto* ws = it_sd != shard.socket_data.end() ? it_sd->second->ws : nullptr;
+
+            if (cd.t_lagged_ms >= 0 && t - cd.t_lagged_ms >= parameters.t_channel_rejoin_ms &&
+                buffered_amount(shard, client_id) == 0) {
+               cd.t_lagged_ms = -1;
+               schedule_regroup(shard, client_id, cd);
+            }
+            if (cd.idle && requests_alive(cd, t)) {
+               cd.idle = false;
+               schedule_regroup(shard, client_id, cd);
+            }
+
+            drop_idle(shard, cd, t);
+            drop_lagging(shard, cd, t, 1, true);
+            cd.budget = frame_budget(shard, client_id, cd, t);
+            if (cd.budget <= 0) {
+               metrics::add(cd.counters.n_skipped, 1);
+               print("[incppect] warning: buffered amount = {}, not sending updates to client {}. waiting for "
+                     "buffer to drain\n",
+                     ws ? ws->getBufferedAmount() : 0, client_id);
+               continue;
+            }
+
+            if (cd.t_keyframe_interval_ms >= 0 && t - cd.t_last_keyframe_ms >= cd.t_keyframe_interval_ms) {
+               cd.keyframe = true;
+            }
+
+            // the unfinished streams continue on every tick
+            if (cd.n_streams > 0) {
+               cd.polled = true;
+            }
+
+            auto& reqs = cd.requests;
+            for (int32_t req_id = 0; req_id < reqs.size(); ++req_id) {
+               if (reqs.snapshot_id[req_id] < 0) {
+                  continue;
+               }
+
+               cd.max_frame_size +=
+                  3 * sizeof(int32_t) + std::min(shard.snapshots[reqs.snapshot_id[req_id]].cur->size(), chunk_size);
+
+               // a streamed request is due again once the client has all of its entry
+               if (reqs.streaming[req_id] && !cd.keyframe) {
+                  continue;
+               }
+
+               if (reqs.alive(req_id, t) &&
+                   (cd.keyframe || t - reqs.t_last_update_ms[req_id] >= reqs.t_min_update_ms[req_id])) {
+                  if (reqs.t_last_req_timeout_ms[req_id] < 0) {
+                     reqs.t_last_req_ms[req_id] = 0;
+                  }
+
+                  need(shard, reqs.snapshot_id[req_id], t);
+                  reqs.t_last_update_ms[req_id] = t;
+                  cd.polled = true;
+
+                  // a keyframe resends everything in full
+                  if (cd.keyframe) {
+                     reqs.version[req_id] = 0;
+                  }
+
+                  cd.due_requests.push_back(req_id);
+               }
+            }
+         }
+
+         // the histories are sampled on the ticks of the first loop, whether or not a client requests the var. the
+         // getters and the sync hooks run only when something is due
+         const bool sample = shard.index == 0 && std::any_of(histories.begin(), histories.end(),
+                                                             [t](const history::ring& ring) { return ring.due(t); });
+         if (!shard.stale_snapshots.empty() || sample) {
+            std::lock_guard lock(getter_mutex);
+            INCPPECT_TRACE_SCOPE(shard.trace, evaluate, -1);
+            evaluating_shard = &shard;
+
+            for (auto& hook : sync_hooks) {
+               hook();
+            }
+
+            for (auto& ring : histories) {
+               if (ring.due(t)) {
+                  ring.push(t, history::read(getters[ring.getter_id]({}), ring.opts.type));
+               }
+            }
+
+            for (const int32_t snapshot_id : shard.stale_snapshots) {
+               evaluate(shard, *shard.snapshots[snapshot_id].shared, t);
+            }
+
+            evaluating_shard = nullptr;
+         }
+
+         for (const int32_t snapshot_id : shard.pass_snapshots) {
+            observe(shard.snapshots[snapshot_id]);
+         }
+
+         // requests the client already has are omitted from the frame
+         for (auto& [client_id, cd] : shard.client_data) {
+            const auto& reqs = cd.requests;
+            std::erase_if(cd.due_requests, [&](int32_t req_id) {
+               return reqs.version[req_id] == shard.snapshots[reqs.snapshot_id[req_id]].version;
+            });
+         }
+
+         for (auto& [client_id, cd] : shard.client_data) {
+            if (!cd.polled) {
+               continue;
+            }
+
+            const auto it_sd = shard.socket_data.find(client_id);
+            auto* ws = it_sd != shard.socket_data.end() ? it_sd->second->ws : nullptr;
+
+            if (cd.due_requests.empty() && cd.n_streams == 0) {
+               // tell the client once that its data is current, then stay silent until something changes
+               if (!cd.unchanged) {
+                  cd.unchanged = true;
+
+                  const uint32_t typeAll = 3;
+                  send(shard, cd, ws, {(const char*)(&typeAll), sizeof(typeAll)}, false, false);
+                  for_each_receiver(cd, [](ClientData& receiver) { receiver.flow.on_send(sizeof(typeAll)); });
+
+                  const size_t n_receivers = cd.channel ? cd.channel->members.size() : 1;
+                  tx_count += n_receivers * sizeof(typeAll);
+                  tx_compressed_count += n_receivers * sizeof(typeAll);
+
+                  for_each_receiver(cd, [&](ClientData& receiver) {
+                     metrics::add(receiver.counters.n_no_change, 1);
+                     metrics::add(receiver.counters.tx_bytes, sizeof(typeAll));
+                     metrics::add(receiver.counters.tx_compressed_bytes, sizeof(typeAll));
+                  });
+               }
+               continue;
+            }
+            cd.unchanged = false;
+
+            auto& reqs = cd.requests;
+
+            // a keyframe requested while no request was due is sent with the next frame
+            const bool keyframe = cd.keyframe;
+            if (keyframe) {
+               cd.keyframe = false;
+               cd.t_last_keyframe_ms = t;
+               cd.prev.clear(); // no frame-level diff
+
+               // the client drops the chunks it has, the streamed requests are sent again in full
+               for (auto& stream : cd.streams) {
+                  if (stream.req_id >= 0 && reqs.contains(stream.req_id)) {
+                     reqs.streaming[stream.req_id] = 0;
+                     reqs.version[stream.req_id] = 0;
+                  }
+                  stream.req_id = -1;
+               }
+               cd.n_streams = 0;
+            }
+
+            INCPPECT_TRACE_SCOPE(shard.trace, frame, client_id);
+
+            auto& buf = cd.buf;
+            auto& prev = cd.prev;
+            auto& diff = cd.diff;
+
+            // the buffers are sized for the worst case, so once the subscriptions and the sizes of the vars are
+            // stable the pass does not allocate
+            buf.reserve(cd.max_frame_size);
+            prev.reserve(cd.max_frame_size);
+            diff.reserve(kFrameHeaderSize + 2 * cd.max_frame_size);
+            buf.clear();
+
+            // [typeAll][seq][base], a keyframe is its own base
+            const uint32_t seq = ++cd.seq;
+            const uint32_t header[3] = {0, seq, keyframe ? seq : seq - 1};
+            if (keyframe) {
+               cd.keyframe_seq = seq;
+            }
+            buf.append((const char*)header, sizeof(header));
+
+            size_t full_size = buf.size();
+            bool deflate = false; // some entry relies on the compression of the frame
+
+            // with a budget, the due requests by priority plus the number of update periods since they were last
+            // sent, so that the requests of low priority are delayed but not starved
+            int64_t budget = cd.budget;
+            if (budget != flow::kUnlimited) {
+               const auto score = [&](int32_t req_id) {
+                  const int64_t period = std::max<int64_t>({reqs.t_min_update_ms[req_id], parameters.t_tick_ms, 1});
+                  return double(reqs.priority[req_id]) + double(t - reqs.t_last_sent_ms[req_id]) / double(period);
+               };
+               std::sort(cd.due_requests.begin(), cd.due_requests.end(), [&](int32_t a, int32_t b) {
+                  const double sa = score(a), sb = score(b);
+                  return sa != sb ? sa > sb : a < b;
+               });
+            }
+            size_t n_entries = 0;
+            size_t n_deferred = 0;
+
+            for (const int32_t req_id : cd.due_requests) {
+               auto& snapshot = shard.snapshots[reqs.snapshot_id[req_id]];
+
+               auto& version = reqs.version[req_id];
+
+               const bool can_diff = version + 1 == snapshot.version && snapshot.prev->size() == snapshot.cur->size();
+               const auto codec = reqs.codec[req_id] == codec::kind::automatic
+                                     ? select_codec(shard, snapshot, can_diff)
+                                     : reqs.codec[req_id];
+
+               int32_t type = 0;
+               const std::string* entry = snapshot.cur.get();
+               if (codec == codec::kind::lz4) {
+                  type = 2;
+                  entry = &snapshot_lz4(shard, snapshot, can_diff);
+               }
+               else if (codec != codec::kind::raw && snapshot.cur->size() > 256 && can_diff &&
+                        snapshot_diff(shard, snapshot).size() < snapshot.cur->size()) {
+                  // run-length encoding of the diff, unless it is not smaller than the content
+                  type = 1;
+                  entry = &snapshot.diff;
+               }
+               deflate = deflate || codec == codec::kind::deflate;
+               if (snapshot.format.enc != quant::encoding::none) {
+                  type |= quant::kEntryFlag;
+               }
+
+               const auto& data = *entry;
+               const int32_t data_size = data.size();
+
+               // the streamed entries take their share of the budget with their chunks. the first entry is sent
+               // regardless, so that the frames progress with a budget below the size of a var
+               const int64_t cost = data.size() > chunk_size ? 0 : int64_t(3 * sizeof(int32_t) + data.size());
+               if (n_entries > 0 && cost > budget) {
+                  reqs.t_last_update_ms[req_id] = -1; // due again in the next pass
+                  ++n_deferred;
+                  continue;
+               }
+               budget -= cost;
+               ++n_entries;
+
+               codec_metrics[size_t(codec)].entry(snapshot.cur->size(), data.size());
+               full_size += 3 * sizeof(int32_t) + snapshot.cur->size();
+
+               version = snapshot.version;
+               reqs.t_last_sent_ms[req_id] = t;
+
+               // too large for a frame, streamed below
+               if (data.size() > chunk_size) {
+                  // replaces the unfinished stream of a request that was registered again, or takes a free slot
+                  auto it = std::find_if(cd.streams.begin(), cd.streams.end(),
+                                         [req_id](const Stream& s) { return s.req_id == req_id; });
+                  if (it == cd.streams.end()) {
+                     it = std::find_if(cd.streams.begin(), cd.streams.end(),
+                                       [](const Stream& s) { return s.req_id < 0; });
+                  }
+                  auto& stream = it != cd.streams.end() ? *it : cd.streams.emplace_back();
+                  cd.n_streams += stream.req_id < 0 ? 1 : 0;
+                  stream.req_id = req_id;
+                  stream.type = type;
+                  stream.data.assign(data);
+                  stream.offset = 0;
+                  reqs.streaming[req_id] = 1;
+                  continue;
+               }
+
+               buf.append((char*)(&req_id), sizeof(req_id));
+               buf.append((char*)(&type), sizeof(type));
+               buf.append((char*)(&data_size), sizeof(data_size));
+               buf.append(data);
+            }
+
+            // then the next chunks of the streams, up to chunk_size bytes in total and within the budget
+            size_t n_chunks = 0;
+            size_t chunk_budget = std::min(chunk_size, budget > 0 ? size_t(budget) / 4 * 4 : size_t(0));
+            if (chunk_budget == 0 && n_entries == 0) {
+               chunk_budget = 4;
+            }
+            for (auto& stream : cd.streams) {
+               if (stream.req_id < 0) {
+                  continue;
+               }
+
+               // the request was registered again since, its new var is sent in full
+               if (!reqs.contains(stream.req_id) || !reqs.streaming[stream.req_id]) {
+                  stream.req_id = -1;
+                  --cd.n_streams;
+                  continue;
+               }
+
+               if (chunk_budget == 0) {
+                  continue;
+               }
+
+               const size_t n = std::min(chunk_budget, stream.data.size() - stream.offset);
+               const uint32_t chunk[6] = {uint32_t(stream.req_id), 3, uint32_t(3 * sizeof(uint32_t) + n),
+                                          uint32_t(stream.type), uint32_t(stream.data.size()), uint32_t(stream.offset)};
+               buf.append((const char*)chunk, sizeof(chunk));
+               buf.append(stream.data, stream.offset, n);
+
+               stream.offset += n;
+               chunk_budget -= n;
+               ++n_chunks;
+
+               if (stream.offset == stream.data.size()) {
+                  reqs.streaming[stream.req_id] = 0;
+                  stream.req_id = -1;
+                  --cd.n_streams;
+               }
+            }
+
+            // diff against the previous frame, if it is smaller
+            bool use_diff = false;
+            if (buf.size() == prev.size() && buf.size() > 256) {
+               INCPPECT_TRACE_SCOPE(shard.trace, frame_diff, client_id);
+               diff.clear();
+
+               const uint32_t diff_header[3] = {1, header[1], header[2]};
+               diff.append((const char*)diff_header, sizeof(diff_header));
+
+               xor_rle::encode(prev.data() + kFrameHeaderSize, buf.data() + kFrameHeaderSize,
+                               buf.size() - kFrameHeaderSize, diff);
+
+               use_diff = diff.size() < buf.size();
+            }
+
+            const auto& msg = use_diff ? diff : buf;
+
+            if (int32_t(msg.size()) > parameters.max_payload) {
+               print("[incppect] warning: buffer size ({}) exceeds maxPayloadLength ({})\n", msg.size(),
+                     parameters.max_payload);
+            }
+
+            // compress only for message larger than 64 bytes, with an entry that asks for it
+            const bool compress = deflate && msg.size() > 64;
+            drop_lagging(shard, cd, t, msg.size(), false);
+            {
+               INCPPECT_TRACE_SCOPE(shard.trace, send, client_id);
+               if (!send(shard, cd, ws, {msg.data(), msg.size()}, compress, keyframe)) {
+                  metrics::add(cd.counters.n_backpressure, 1);
+                  print("[incpeect] warning: backpressure for client {} increased \n", client_id);
+               }
+            }
+
+            if (compress) {
+               shard.compression.sample(msg);
+            }
+            const uint64_t compressed_size = compress ? shard.compression.estimate(msg.size()) : msg.size();
+
+            const size_t n_receivers = cd.channel ? cd.channel->members.size() : 1;
+            tx_count += n_receivers * buf.size();
+            tx_compressed_count += n_receivers * compressed_size;
+
+            for_each_receiver(cd, [&](ClientData& receiver) {
+               auto& counters = receiver.counters;
+               metrics::add(counters.n_frames, 1);
+               metrics::add(counters.n_diff_frames, use_diff ? 1 : 0);
+               metrics::add(counters.tx_bytes, msg.size());
+               metrics::add(counters.tx_full_bytes, full_size);
+               metrics::add(counters.tx_compressed_bytes, compressed_size);
+               metrics::add(counters.n_chunks, n_chunks);
+               metrics::add(counters.n_deferred, n_deferred);
+
+               receiver.flow.on_send(msg.size());
+               receiver.flow.on_frame(seq, t);
+            });
+
+            // the sent frame becomes the base of the next diff, buf reuses the memory of the old one
+            prev.swap(buf);
+         }
+
+         update_latency.record(metrics::now_ns() - t_start_ns);
       }
    };
 }
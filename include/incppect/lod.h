@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <span>
+#include <vector>
+
+#include "simd.h"
+
+namespace incpp
+{
+   // level-of-detail views of large float arrays:
+   //
+   //   a query for [begin, end) decimated to n points returns the min/max envelope of every bucket of samples, so a
+   //   plot of millions of samples costs n points on the wire and keeps its peaks. the reductions use a pyramid of
+   //   block envelopes (each level halves the previous one) and only touch the raw samples at the bucket edges
+   namespace lod
+   {
+      struct envelope
+      {
+         float min = std::numeric_limits<float>::infinity();
+         float max = -std::numeric_limits<float>::infinity();
+
+         void add(const envelope& e)
+         {
+            min = std::min(min, e.min);
+            max = std::max(max, e.max);
+         }
+      };
+
+      struct options
+      {
+         // keep a pyramid of the envelopes, updated incrementally with pyramid::invalidate(). without it every
+         // query reduces the raw samples, which needs no invalidation but costs O(end - begin)
+         bool pyramid = true;
+      };
+
+      // envelope of n samples, accumulated into e
+      using minmax_t = void (*)(const float* p, size_t n, envelope& e);
+
+      inline void minmax_scalar(const float* p, size_t n, envelope& e)
+      {
+         for (size_t i = 0; i < n; ++i) {
+            e.min = std::min(e.min, p[i]);
+            e.max = std::max(e.max, p[i]);
+         }
+      }
+
+#if INCPPECT_SIMD_X86
+      INCPPECT_TARGET("sse4.2")
+      inline void minmax_sse42(const float* p, size_t n, envelope& e)
+      {
+         __m128 vmin = _mm_set1_ps(e.min);
+         __m128 vmax = _mm_set1_ps(e.max);
+         size_t i = 0;
+         // min/max return their second operand for nan, which skips the nan samples like minmax_scalar
+         for (; i + 4 <= n; i += 4) {
+            const __m128 v = _mm_loadu_ps(p + i);
+            vmin = _mm_min_ps(v, vmin);
+            vmax = _mm_max_ps(v, vmax);
+         }
+
+         alignas(16) float mins[4], maxs[4];
+         _mm_store_ps(mins, vmin);
+         _mm_store_ps(maxs, vmax);
+         e.min = std::min({mins[0], mins[1], mins[2], mins[3]});
+         e.max = std::max({maxs[0], maxs[1], maxs[2], maxs[3]});
+         minmax_scalar(p + i, n - i, e);
+      }
+
+      INCPPECT_TARGET("avx2")
+      inline void minmax_avx2(const float* p, size_t n, envelope& e)
+      {
+         // two accumulators hide the latency of min/max
+         __m256 vmin0 = _mm256_set1_ps(e.min), vmin1 = vmin0;
+         __m256 vmax0 = _mm256_set1_ps(e.max), vmax1 = vmax0;
+         size_t i = 0;
+         for (; i + 16 <= n; i += 16) {
+            const __m256 v0 = _mm256_loadu_ps(p + i);
+            const __m256 v1 = _mm256_loadu_ps(p + i + 8);
+            vmin0 = _mm256_min_ps(v0, vmin0); // skips nan, see minmax_sse42
+            vmax0 = _mm256_max_ps(v0, vmax0);
+            vmin1 = _mm256_min_ps(v1, vmin1);
+            vmax1 = _mm256_max_ps(v1, vmax1);
+         }
+
+         alignas(32) float mins[8], maxs[8];
+         _mm256_store_ps(mins, _mm256_min_ps(vmin0, vmin1));
+         _mm256_store_ps(maxs, _mm256_max_ps(vmax0, vmax1));
+         for (int k = 0; k < 8; ++k) {
+            e.min = std::min(e.min, mins[k]);
+            e.max = std::max(e.max, maxs[k]);
+         }
+         minmax_scalar(p + i, n - i, e);
+      }
+#endif
+
+      inline minmax_t minmax(simd::level l)
+      {
+#if INCPPECT_SIMD_X86
+         switch (l) {
+         case simd::level::avx2:
+            return minmax_avx2;
+         case simd::level::sse42:
+            return minmax_sse42;
+         default:
+            break;
+         }
+#endif
+         return minmax_scalar;
+      }
+
+      // levels[0] holds the envelopes of blocks of kBlock samples, levels[k + 1][i] = levels[k][2i] + levels[k][2i + 1]
+      struct pyramid
+      {
+         static constexpr size_t kBlock = 64;
+
+         options opts{};
+         minmax_t reduce = minmax(simd::best());
+
+         std::vector<std::vector<envelope>> levels{};
+         size_t n_samples = 0; // size of the array the pyramid was built for
+
+         std::vector<envelope> result{}; // content of the last query
+
+         pyramid() = default;
+         explicit pyramid(options opts) : opts(opts) {}
+
+         // samples [begin, end) were modified, can be called from any thread
+         // the pyramid is updated with the next query
+         void invalidate(size_t begin = 0, size_t end = std::numeric_limits<size_t>::max())
+         {
+            std::lock_guard lock(mutex);
+            dirty_begin = std::min(dirty_begin, begin);
+            dirty_end = std::max(dirty_end, end);
+         }
+
+         // bring the pyramid up to date with the array, a change of its size rebuilds everything
+         void update(std::span<const float> data)
+         {
+            size_t begin, end;
+            {
+               std::lock_guard lock(mutex);
+               begin = dirty_begin;
+               end = dirty_end;
+               dirty_begin = std::numeric_limits<size_t>::max();
+               dirty_end = 0;
+            }
+
+            if (data.size() != n_samples) {
+               n_samples = data.size();
+               begin = 0;
+               end = n_samples;
+
+               levels.clear();
+               for (size_t n = (n_samples + kBlock - 1) / kBlock; n > 1; n = (n + 1) / 2) {
+                  levels.emplace_back(n);
+               }
+            }
+
+            end = std::min(end, n_samples);
+            if (begin >= end || levels.empty()) {
+               return;
+            }
+
+            // blocks [b0, b1) of level 0, then their parents
+            size_t b0 = begin / kBlock;
+            size_t b1 = (end + kBlock - 1) / kBlock;
+            for (size_t b = b0; b < b1; ++b) {
+               const size_t i = b * kBlock;
+               auto& e = levels[0][b] = {};
+               reduce(data.data() + i, std::min(kBlock, n_samples - i), e);
+            }
+
+            for (size_t k = 1; k < levels.size(); ++k) {
+               const auto& children = levels[k - 1];
+               b0 /= 2;
+               b1 = (b1 + 1) / 2;
+               for (size_t b = b0; b < b1; ++b) {
+                  auto& e = levels[k][b] = children[2 * b];
+                  if (2 * b + 1 < children.size()) {
+                     e.add(children[2 * b + 1]);
+                  }
+               }
+            }
+         }
+
+         // envelope of the samples [begin, end)
+         envelope range(std::span<const float> data, size_t begin, size_t end) const
+         {
+            envelope e{};
+
+            size_t b0 = (begin + kBlock - 1) / kBlock;
+            size_t b1 = end / kBlock;
+            if (!opts.pyramid || levels.empty() || b0 >= b1) {
+               reduce(data.data() + begin, end - begin, e);
+               return e;
+            }
+
+            reduce(data.data() + begin, b0 * kBlock - begin, e);
+            reduce(data.data() + b1 * kBlock, end - b1 * kBlock, e);
+
+            // bottom-up over the levels, taking the unpaired blocks at both ends
+            for (size_t k = 0; b0 < b1; ++k) {
+               const auto& level = levels[k];
+               if (k + 1 == levels.size()) {
+                  for (size_t b = b0; b < b1; ++b) {
+                     e.add(level[b]);
+                  }
+                  break;
+               }
+               if (b0 & 1) {
+                  e.add(level[b0++]);
+               }
+               if (b1 & 1) {
+                  e.add(level[--b1]);
+               }
+               b0 /= 2;
+               b1 /= 2;
+            }
+
+            return e;
+         }
+
+         // envelopes of [begin, end) in n_points buckets of equal size, at most one bucket per sample
+         const std::vector<envelope>& query(std::span<const float> data, size_t begin, size_t end, size_t n_points)
+         {
+            if (opts.pyramid) {
+               update(data);
+            }
+
+            end = std::min(end, data.size());
+            begin = std::min(begin, end);
+            n_points = std::min(n_points, end - begin);
+
+            result.resize(n_points);
+            for (size_t k = 0; k < n_points; ++k) {
+               const size_t i0 = begin + (end - begin) * k / n_points;
+               const size_t i1 = begin + (end - begin) * (k + 1) / n_points;
+               result[k] = range(data, i0, i1);
+            }
+
+            return result;
+         }
+
+        private:
+         std::mutex mutex{};
+         size_t dirty_begin = 0;
+         size_t dirty_end = std::numeric_limits<size_t>::max();
+      };
+   }
+}
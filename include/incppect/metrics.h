@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#ifndef UWS_NO_ZLIB
+#include <zlib.h>
+#endif
+
+namespace incpp
+{
+   // instrumentation of the server, cheap enough to stay enabled: recording is a few relaxed atomic increments on
+   // the thread of the loop, the values are read from any thread by the metrics vars and the metrics route
+   namespace metrics
+   {
+      inline uint64_t now_ns()
+      {
+         using namespace std::chrono;
+         return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+      }
+
+      // for counters with a single writer at a time (the loop of a client, or the holder of getter_mutex), a relaxed
+      // load and store avoids the locked read-modify-write
+      inline void add(std::atomic<uint64_t>& counter, uint64_t n)
+      {
+         counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+      }
+
+      // plain copy of a histogram, the content of the histogram vars
+      struct histogram_data
+      {
+         static constexpr size_t kBuckets = 32;
+
+         uint64_t count = 0;
+         uint64_t sum_ns = 0;
+         std::array<uint64_t, kBuckets> buckets{}; // not cumulative, see histogram::upper_bound_ns()
+      };
+
+      // durations in log2 buckets, from < 256 ns to ~9 min
+      struct histogram
+      {
+         static constexpr size_t kBuckets = histogram_data::kBuckets;
+
+         // bucket k counts the durations below upper_bound_ns(k), the last one is unbounded
+         static constexpr uint64_t upper_bound_ns(size_t k) { return uint64_t(256) << k; }
+
+         static constexpr size_t bucket(uint64_t ns)
+         {
+            return std::min<size_t>(std::bit_width(ns >> 8), kBuckets - 1);
+         }
+
+         std::atomic<uint64_t> count{};
+         std::atomic<uint64_t> sum_ns{};
+         std::array<std::atomic<uint64_t>, kBuckets> buckets{};
+
+         void record(uint64_t ns)
+         {
+            buckets[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+            count.fetch_add(1, std::memory_order_relaxed);
+            sum_ns.fetch_add(ns, std::memory_order_relaxed);
+         }
+
+         histogram_data load() const
+         {
+            histogram_data res;
+            res.count = count.load(std::memory_order_relaxed);
+            res.sum_ns = sum_ns.load(std::memory_order_relaxed);
+            for (size_t k = 0; k < kBuckets; ++k) {
+               res.buckets[k] = buckets[k].load(std::memory_order_relaxed);
+            }
+            return res;
+         }
+      };
+
+      // plain copy of the counters of a getter, the content of /incppect/metrics/getter/{}
+      struct getter_data
+      {
+         uint64_t n_calls = 0;
+         histogram_data latency{}; // sampled
+      };
+
+      // a clock read costs about as much as a small getter, so only every kSamplePeriod-th call is timed
+      struct getter_counters
+      {
+         static constexpr uint64_t kSamplePeriod = 16;
+
+         std::atomic<uint64_t> n_calls{};
+         histogram latency{};
+
+         getter_data load() const { return {n_calls.load(std::memory_order_relaxed), latency.load()}; }
+      };
+
+      // plain copy of the counters of a client, the content of /incppect/metrics/client/{}
+      struct client_data
+      {
+         uint64_t n_frames = 0;
+         uint64_t n_diff_frames = 0; // frames sent as a diff of the previous one
+         uint64_t n_no_change = 0;
+         uint64_t tx_bytes = 0; // payload passed to the socket
+         uint64_t tx_full_bytes = 0; // size of the same frames with all vars in full
+         uint64_t tx_compressed_bytes = 0; // estimate of tx_bytes after permessage-deflate
+         uint64_t n_backpressure = 0; // sends that left data in the socket buffer
+         uint64_t n_skipped = 0; // passes skipped while the socket buffer drained, or without budget
+         uint64_t n_resyncs = 0; // keyframes requested by the client after a broken sequence of frames
+         uint64_t n_chunks = 0; // parts of vars larger than Parameters::chunk_size
+         uint64_t n_deferred = 0; // due vars left for a later pass by the bandwidth budget
+      };
+
+      // written by the loop of the client
+      struct client_counters
+      {
+         std::atomic<uint64_t> n_frames{};
+         std::atomic<uint64_t> n_diff_frames{};
+         std::atomic<uint64_t> n_no_change{};
+         std::atomic<uint64_t> tx_bytes{};
+         std::atomic<uint64_t> tx_full_bytes{};
+         std::atomic<uint64_t> tx_compressed_bytes{};
+         std::atomic<uint64_t> n_backpressure{};
+         std::atomic<uint64_t> n_skipped{};
+         std::atomic<uint64_t> n_resyncs{};
+         std::atomic<uint64_t> n_chunks{};
+         std::atomic<uint64_t> n_deferred{};
+
+         client_data load() const
+         {
+            constexpr auto relaxed = std::memory_order_relaxed;
+            return {n_frames.load(relaxed),      n_diff_frames.load(relaxed),  n_no_change.load(relaxed),
+                    tx_bytes.load(relaxed),      tx_full_bytes.load(relaxed),  tx_compressed_bytes.load(relaxed),
+                    n_backpressure.load(relaxed), n_skipped.load(relaxed),     n_resyncs.load(relaxed),
+                    n_chunks.load(relaxed),      n_deferred.load(relaxed)};
+         }
+      };
+
+      // the compressed size of the messages is not reported by uWebSockets, so every n-th compressed message is
+      // deflated again with the zlib defaults of permessage-deflate (no context takeover) to estimate the ratio
+      struct compression_sampler
+      {
+         uint32_t period = 64;
+         uint32_t n = 0;
+
+         uint64_t in_bytes = 0;
+         uint64_t out_bytes = 0;
+         uint64_t ns = 0; // time spent compressing the samples
+
+#ifndef UWS_NO_ZLIB
+         z_stream stream{};
+         bool initialized = false;
+         std::string out{};
+
+         compression_sampler() = default;
+         compression_sampler(const compression_sampler&) = delete;
+         compression_sampler& operator=(const compression_sampler&) = delete;
+         ~compression_sampler()
+         {
+            if (initialized) {
+               deflateEnd(&stream);
+            }
+         }
+
+         void sample(std::string_view msg)
+         {
+            if (period == 0 || n++ % period != 0) {
+               return;
+            }
+
+            if (!initialized) {
+               if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                  period = 0;
+                  return;
+               }
+               initialized = true;
+            }
+
+            const uint64_t t0 = now_ns();
+            out.resize(deflateBound(&stream, msg.size()) + 16);
+            stream.next_in = (Bytef*)msg.data();
+            stream.avail_in = uInt(msg.size());
+            stream.next_out = (Bytef*)out.data();
+            stream.avail_out = uInt(out.size());
+            deflate(&stream, Z_SYNC_FLUSH);
+
+            // the 4 bytes of the sync flush marker are not sent (RFC 7692, 7.2.1)
+            in_bytes += msg.size();
+            out_bytes += std::max<uint64_t>(out.size() - stream.avail_out, 4) - 4;
+            deflateReset(&stream);
+            ns += now_ns() - t0;
+         }
+#else
+         void sample(std::string_view) {}
+#endif
+
+         // estimated size of a compressed message
+         uint64_t estimate(size_t size) const { return in_bytes ? uint64_t(double(size) * out_bytes / in_bytes) : size; }
+
+         // estimated time to compress a message
+         uint64_t estimate_ns(size_t size) const { return in_bytes ? uint64_t(double(size) * ns / in_bytes) : 0; }
+      };
+
+      // Prometheus text exposition format
+      inline void write_header(std::string& out, std::string_view name, std::string_view type, std::string_view help)
+      {
+         std::format_to(std::back_inserter(out), "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+      }
+
+      // appends value with its backslashes, double quotes and line feeds escaped, as in a label value of the text
+      // format or in a JSON string
+      inline void escape(std::string& out, std::string_view value)
+      {
+         for (const char c : value) {
+            if (c == '\\' || c == '"') {
+               out += '\\';
+               out += c;
+            }
+            else if (c == '\n') {
+               out += "\\n";
+            }
+            else {
+               out += c;
+            }
+         }
+      }
+
+      // name="value", with the value escaped
+      inline std::string label(std::string_view name, std::string_view value)
+      {
+         std::string out(name);
+         out += "=\"";
+         escape(out, value);
+         out += '"';
+         return out;
+      }
+
+      inline void write_sample(std::string& out, std::string_view name, std::string_view labels, double value)
+      {
+         if (labels.empty()) {
+            std::format_to(std::back_inserter(out), "{} {}\n", name, value);
+         }
+         else {
+            std::format_to(std::back_inserter(out), "{}{{{}}} {}\n", name, labels, value);
+         }
+      }
+
+      // the buckets of the exposition format are cumulative and in seconds
+      // the count is the sum of the buckets, it may lag behind h.count while the histogram is being recorded
+      inline void write_histogram(std::string& out, std::string_view name, std::string_view labels,
+                                  const histogram_data& h)
+      {
+         const std::string_view sep = labels.empty() ? "" : ",";
+
+         uint64_t n = 0;
+         for (size_t k = 0; k + 1 < histogram_data::kBuckets; ++k) {
+            n += h.buckets[k];
+            std::format_to(std::back_inserter(out), "{}_bucket{{{}{}le=\"{}\"}} {}\n", name, labels, sep,
+                           histogram::upper_bound_ns(k) * 1e-9, n);
+         }
+         n += h.buckets[histogram_data::kBuckets - 1];
+         std::format_to(std::back_inserter(out), "{}_bucket{{{}{}le=\"+Inf\"}} {}\n", name, labels, sep, n);
+
+         write_sample(out, std::string(name) + "_sum", labels, h.sum_ns * 1e-9);
+         write_sample(out, std::string(name) + "_count", labels, double(n));
+      }
+   }
+}
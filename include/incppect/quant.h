@@ -0,0 +1,396 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "lod.h"
+#include "simd.h"
+
+namespace incpp
+{
+   // lossy encodings of float arrays, requested per request with request_option::quantization:
+   //
+   //   [u32 encoding][u32 n] payload, for n values
+   //
+   //   fp16   n x IEEE 754 binary16
+   //   bf16   n x the upper 16 bits of the float32, rounded to nearest even
+   //   int16  per block of kBlock values: [f32 min][f32 scale] kBlock x u16, value = min + scale * q
+   //   int8   per block of kBlock values: [f32 min][f32 scale] kBlock x u8,  value = min + scale * q
+   //
+   // the encoded arrays are stored in the snapshots like any other content, so they are diffed with XOR-RLE as well.
+   // the frame entries of an encoded array have kEntryFlag set in their type. the clients decode only those, so the
+   // float array that may still be in flight when the option changes is not mistaken for an encoded one, and neither
+   // is any other content that happens to look like a header
+   namespace quant
+   {
+      enum struct encoding : int32_t {
+         none = 0,
+         fp16 = 1,
+         bf16 = 2,
+         int16 = 3,
+         int8 = 4,
+      };
+
+      // set in the value of the request option if the var holds doubles instead of floats
+      constexpr int32_t kDoubleSource = 0x100;
+
+      constexpr size_t kBlock = 256;
+
+      constexpr uint32_t kEntryFlag = 0x100; // in the type of a frame entry
+      constexpr size_t kHeaderSize = 2 * sizeof(uint32_t);
+
+      struct format
+      {
+         encoding enc = encoding::none;
+         bool f64 = false; // the var holds doubles
+
+         static format from_option(int32_t value)
+         {
+            const int32_t enc = value & 0xff;
+            return {enc >= 0 && enc <= int32_t(encoding::int8) ? encoding(enc) : encoding::none,
+                    (value & kDoubleSource) != 0};
+         }
+
+         int32_t option() const { return int32_t(enc) | (f64 ? kDoubleSource : 0); }
+
+         auto operator<=>(const format&) const = default;
+      };
+
+      inline uint16_t to_half(float f)
+      {
+         const uint32_t x = std::bit_cast<uint32_t>(f);
+         const uint32_t sign = (x >> 16) & 0x8000;
+         const uint32_t abs = x & 0x7fffffff;
+
+         if (abs > 0x7f800000) {
+            // nan, made quiet and keeping the upper bits of its payload, as f16c does
+            return uint16_t(sign | 0x7e00 | ((abs >> 13) & 0x3ff));
+         }
+         if (abs >= 0x477ff000) {
+            return uint16_t(sign | 0x7c00); // inf, overflow
+         }
+         if (abs < 0x38800000) {
+            // subnormal, rounded by the float addition
+            const float r = std::bit_cast<float>(abs) + 0.5f;
+            return uint16_t(sign | (std::bit_cast<uint32_t>(r) - 0x3f000000));
+         }
+         const uint32_t rounded = abs + 0xfff + ((abs >> 13) & 1) - 0x38000000;
+         return uint16_t(sign | (rounded >> 13));
+      }
+
+      inline float from_half(uint16_t h)
+      {
+         const uint32_t sign = uint32_t(h & 0x8000) << 16;
+         const uint32_t exp = (h >> 10) & 0x1f;
+         const uint32_t mant = h & 0x3ff;
+
+         if (exp == 0) {
+            return std::bit_cast<float>(sign | std::bit_cast<uint32_t>(float(mant) * 0x1p-24f));
+         }
+         if (exp == 31) {
+            return std::bit_cast<float>(sign | 0x7f800000 | (mant << 13));
+         }
+         return std::bit_cast<float>(sign | ((exp + 112) << 23) | (mant << 13));
+      }
+
+      inline uint16_t to_bf16(float f)
+      {
+         const uint32_t x = std::bit_cast<uint32_t>(f);
+         if ((x & 0x7fffffff) > 0x7f800000) {
+            return uint16_t((x >> 16) | 0x40); // keep nan a nan
+         }
+         return uint16_t((x + 0x7fff + ((x >> 16) & 1)) >> 16);
+      }
+
+      inline float from_bf16(uint16_t b) { return std::bit_cast<float>(uint32_t(b) << 16); }
+
+      // float -> 16 bit conversions of n values
+      using convert16_t = void (*)(const float* src, size_t n, uint16_t* dst);
+
+      inline void fp16_scalar(const float* src, size_t n, uint16_t* dst)
+      {
+         for (size_t i = 0; i < n; ++i) {
+            dst[i] = to_half(src[i]);
+         }
+      }
+
+      inline void bf16_scalar(const float* src, size_t n, uint16_t* dst)
+      {
+         for (size_t i = 0; i < n; ++i) {
+            dst[i] = to_bf16(src[i]);
+         }
+      }
+
+      // q = round((v - min) * inv_scale), clamped to [0, q_max]. nan maps to 0
+      using scale_t = void (*)(const float* src, size_t n, float min, float inv_scale, float q_max, uint16_t* dst);
+
+      inline void scale_scalar(const float* src, size_t n, float min, float inv_scale, float q_max, uint16_t* dst)
+      {
+         for (size_t i = 0; i < n; ++i) {
+            const float q = (src[i] - min) * inv_scale + 0.5f;
+            dst[i] = q > 0.0f ? uint16_t(std::min(q, q_max)) : 0; // false for nan
+         }
+      }
+
+#if INCPPECT_SIMD_X86
+      INCPPECT_TARGET("avx2,f16c")
+      inline void fp16_avx2(const float* src, size_t n, uint16_t* dst)
+      {
+         size_t i = 0;
+         for (; i + 8 <= n; i += 8) {
+            const __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+            _mm_storeu_si128((__m128i*)(dst + i), h);
+         }
+         fp16_scalar(src + i, n - i, dst + i);
+      }
+
+      INCPPECT_TARGET("avx2")
+      inline void bf16_avx2(const float* src, size_t n, uint16_t* dst)
+      {
+         const __m256i bias = _mm256_set1_epi32(0x7fff);
+         const __m256i one = _mm256_set1_epi32(1);
+         const __m256i abs_mask = _mm256_set1_epi32(0x7fffffff);
+         const __m256i inf = _mm256_set1_epi32(0x7f800000);
+         const __m256i quiet = _mm256_set1_epi32(0x400000);
+
+         size_t i = 0;
+         for (; i + 16 <= n; i += 16) {
+            __m256i r[2];
+            for (int k = 0; k < 2; ++k) {
+               const __m256i x = _mm256_loadu_si256((const __m256i*)(src + i + 8 * k));
+               const __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(x, 16), one);
+               const __m256i rounded = _mm256_add_epi32(x, _mm256_add_epi32(bias, lsb));
+               const __m256i nan = _mm256_cmpgt_epi32(_mm256_and_si256(x, abs_mask), inf);
+               const __m256i v = _mm256_blendv_epi8(rounded, _mm256_or_si256(x, quiet), nan);
+               r[k] = _mm256_srli_epi32(v, 16);
+            }
+            // packus works within 128-bit lanes, restore the order of the values
+            const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(r[0], r[1]), 0xd8);
+            _mm256_storeu_si256((__m256i*)(dst + i), packed);
+         }
+         bf16_scalar(src + i, n - i, dst + i);
+      }
+
+      INCPPECT_TARGET("avx2")
+      inline void scale_avx2(const float* src, size_t n, float min, float inv_scale, float q_max, uint16_t* dst)
+      {
+         const __m256 vmin = _mm256_set1_ps(min);
+         const __m256 vinv = _mm256_set1_ps(inv_scale);
+         const __m256 vhalf = _mm256_set1_ps(0.5f);
+         const __m256 vzero = _mm256_setzero_ps();
+         const __m256 vmax = _mm256_set1_ps(q_max);
+
+         size_t i = 0;
+         for (; i + 16 <= n; i += 16) {
+            __m256i q[2];
+            for (int k = 0; k < 2; ++k) {
+               __m256 v = _mm256_loadu_ps(src + i + 8 * k);
+               v = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(v, vmin), vinv), vhalf);
+               // max returns its second operand for nan, so nan maps to 0 as in scale_scalar
+               v = _mm256_min_ps(_mm256_max_ps(v, vzero), vmax);
+               q[k] = _mm256_cvttps_epi32(v);
+            }
+            const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(q[0], q[1]), 0xd8);
+            _mm256_storeu_si256((__m256i*)(dst + i), packed);
+         }
+         scale_scalar(src + i, n - i, min, inv_scale, q_max, dst + i);
+      }
+#endif
+
+      inline convert16_t fp16(simd::level l)
+      {
+#if INCPPECT_SIMD_X86
+         static const bool f16c = (__builtin_cpu_init(), __builtin_cpu_supports("f16c"));
+         if (l == simd::level::avx2 && f16c) {
+            return fp16_avx2;
+         }
+#endif
+         return fp16_scalar;
+      }
+
+      inline convert16_t bf16(simd::level l)
+      {
+#if INCPPECT_SIMD_X86
+         if (l == simd::level::avx2) {
+            return bf16_avx2;
+         }
+#endif
+         return bf16_scalar;
+      }
+
+      inline scale_t scale(simd::level l)
+      {
+#if INCPPECT_SIMD_X86
+         if (l == simd::level::avx2) {
+            return scale_avx2;
+         }
+#endif
+         return scale_scalar;
+      }
+
+      // size in bytes of the encoding of n values
+      inline size_t encoded_size(encoding enc, size_t n)
+      {
+         const size_t n_blocks = (n + kBlock - 1) / kBlock;
+         switch (enc) {
+         case encoding::fp16:
+         case encoding::bf16:
+            return kHeaderSize + 2 * n;
+         case encoding::int16:
+            return kHeaderSize + 8 * n_blocks + 2 * n;
+         case encoding::int8:
+            return kHeaderSize + 8 * n_blocks + n;
+         default:
+            return n * sizeof(float);
+         }
+      }
+
+      // reusable buffers of the encoder
+      struct scratch
+      {
+         std::vector<float> floats{}; // the doubles of the var, converted
+         std::vector<uint16_t> q{}; // one block of int8 values before narrowing
+      };
+
+      // encode the array of floats (or doubles) in data, replacing the content of out
+      inline void encode(format fmt, std::string_view data, std::string& out, scratch& s,
+                         simd::level l = simd::best())
+      {
+         if (fmt.enc == encoding::none) {
+            out.assign(data);
+            return;
+         }
+
+         const float* src = (const float*)data.data();
+         size_t n = data.size() / sizeof(float);
+         if (fmt.f64) {
+            n = data.size() / sizeof(double);
+            s.floats.resize(n);
+            for (size_t i = 0; i < n; ++i) {
+               double v;
+               std::memcpy(&v, data.data() + i * sizeof(double), sizeof(v));
+               s.floats[i] = float(v);
+            }
+            src = s.floats.data();
+         }
+         else if (uintptr_t(src) % alignof(float) != 0) {
+            s.floats.resize(n);
+            std::memcpy(s.floats.data(), data.data(), n * sizeof(float));
+            src = s.floats.data();
+         }
+
+         out.resize(encoded_size(fmt.enc, n));
+         const uint32_t header[2] = {uint32_t(fmt.enc), uint32_t(n)};
+         std::memcpy(out.data(), header, sizeof(header));
+         char* dst = out.data() + kHeaderSize;
+
+         switch (fmt.enc) {
+         case encoding::fp16:
+         case encoding::bf16: {
+            const auto convert = fmt.enc == encoding::fp16 ? fp16(l) : bf16(l);
+            convert(src, n, (uint16_t*)dst);
+            break;
+         }
+         case encoding::int16:
+         case encoding::int8: {
+            const bool is16 = fmt.enc == encoding::int16;
+            const float q_max = is16 ? 65535.0f : 255.0f;
+            const auto reduce = lod::minmax(l);
+            const auto quantize = scale(l);
+
+            s.q.resize(kBlock);
+            for (size_t i = 0; i < n; i += kBlock) {
+               const size_t m = std::min(kBlock, n - i);
+
+               lod::envelope e{};
+               reduce(src + i, m, e);
+               if (!std::isfinite(e.min) || !std::isfinite(e.max)) {
+                  e = {0.0f, 0.0f}; // non-finite values are not representable, the block becomes zeros
+               }
+               const float step = (e.max - e.min) / q_max;
+               const float inv = step > 0.0f ? 1.0f / step : 0.0f;
+
+               std::memcpy(dst, &e.min, sizeof(float));
+               std::memcpy(dst + 4, &step, sizeof(float));
+               dst += 8;
+
+               if (is16) {
+                  quantize(src + i, m, e.min, inv, q_max, (uint16_t*)dst);
+                  dst += 2 * m;
+               }
+               else {
+                  quantize(src + i, m, e.min, inv, q_max, s.q.data());
+                  for (size_t k = 0; k < m; ++k) {
+                     dst[k] = char(uint8_t(s.q[k]));
+                  }
+                  dst += m;
+               }
+            }
+            break;
+         }
+         default:
+            break;
+         }
+      }
+
+      // decode an encoded array into floats, the content of an entry flagged with kEntryFlag
+      // returns false if it is malformed
+      inline bool decode(std::string_view data, std::vector<float>& out)
+      {
+         if (data.size() < kHeaderSize) {
+            return false;
+         }
+         uint32_t header[2];
+         std::memcpy(header, data.data(), sizeof(header));
+         const auto enc = encoding(header[0]);
+         const uint32_t n = header[1];
+         if (header[0] < uint32_t(encoding::fp16) || header[0] > uint32_t(encoding::int8) ||
+             encoded_size(enc, n) > data.size()) {
+            return false;
+         }
+
+         out.resize(n);
+         const char* src = data.data() + kHeaderSize;
+         switch (enc) {
+         case encoding::fp16:
+         case encoding::bf16:
+            for (size_t i = 0; i < n; ++i) {
+               uint16_t h;
+               std::memcpy(&h, src + 2 * i, sizeof(h));
+               out[i] = enc == encoding::fp16 ? from_half(h) : from_bf16(h);
+            }
+            break;
+         case encoding::int16:
+         case encoding::int8: {
+            const size_t q_size = enc == encoding::int16 ? 2 : 1;
+            for (size_t i = 0; i < n; i += kBlock) {
+               const size_t m = std::min<size_t>(kBlock, n - i);
+               float min, step;
+               std::memcpy(&min, src, sizeof(float));
+               std::memcpy(&step, src + 4, sizeof(float));
+               src += 8;
+               for (size_t k = 0; k < m; ++k) {
+                  uint16_t q = 0;
+                  std::memcpy(&q, src + q_size * k, q_size);
+                  out[i + k] = min + step * q;
+               }
+               src += q_size * m;
+            }
+            break;
+         }
+         default:
+            return false;
+         }
+
+         return true;
+      }
+   }
+}
@@ -0,0 +1,486 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "client.h"
+#include "incppect.h"
+
+namespace incpp
+{
+   // recording of the update stream of a server, and its replay to the clients of another one
+   //
+   //   the Recorder is a client without a socket that requests a fixed list of paths. its frames, as encoded by
+   //   update() (full or XOR-RLE diffs of the previous frame), are appended to a pair of memory-mapped files:
+   //
+   //   <filename>      "INCPREC2" [u64 size] n x [u32 kind][u32 size][i64 t_us][data, zero-padded to 4 bytes]
+   //                      kind 0: the recorded paths, '\n'-separated, in req id order, first record of the file
+   //                      kind 1: a frame
+   //   <filename>.idx  "INCPIDX1" [u64 size] n x [i64 t_us][u64 offset of the record], for the keyframes
+   //
+   //   size is the number of valid bytes after the header. it is updated after every record, so a recording that
+   //   was not closed (e.g. after a crash) can be replayed up to the last complete record
+   //
+   //   the Replayer decodes the frames with incpp::Client and serves the recorded paths as vars, so incppect.js
+   //   clients work unchanged. the getters of the recorded app are not involved
+   namespace rec
+   {
+      constexpr size_t kHeaderSize = 16;
+
+      enum struct kind : uint32_t {
+         paths = 0,
+         frame = 1,
+      };
+
+      struct record_header
+      {
+         uint32_t kind = 0;
+         uint32_t size = 0;
+         int64_t t_us = 0; // since the start of the recording
+      };
+
+      struct index_entry
+      {
+         int64_t t_us = 0;
+         uint64_t offset = 0;
+      };
+
+      // errors of the recordings are reported regardless of Incppect::debug, they lose data
+      template <class... Args>
+      void error(std::format_string<Args...> fmt, Args&&... args)
+      {
+         const auto str = std::format(fmt, std::forward<Args>(args)...);
+         std::fwrite(str.data(), 1, str.size(), stderr);
+      }
+
+      // append-only memory-mapped file, grown in steps of at least kGrowth bytes
+      struct mapped_writer
+      {
+         static constexpr size_t kGrowth = 16 << 20;
+
+         int fd = -1;
+         char* data = nullptr;
+         size_t capacity = 0;
+         size_t size = kHeaderSize;
+
+         mapped_writer() = default;
+         mapped_writer(const mapped_writer&) = delete;
+         mapped_writer& operator=(const mapped_writer&) = delete;
+         ~mapped_writer() { close(); }
+
+         bool open(const std::string& filename, std::string_view magic)
+         {
+            fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0 || !reserve(kHeaderSize)) {
+               close();
+               return false;
+            }
+            std::memcpy(data, magic.data(), std::min<size_t>(magic.size(), 8));
+            commit();
+            return true;
+         }
+
+         // the appended bytes become visible to readers with commit()
+         bool append(const void* src, size_t n)
+         {
+            if (!data || !reserve(size + n)) {
+               return false;
+            }
+            std::memcpy(data + size, src, n);
+            size += n;
+            return true;
+         }
+
+         void commit()
+         {
+            if (!data) {
+               return;
+            }
+            const uint64_t n = size - kHeaderSize;
+            std::memcpy(data + 8, &n, sizeof(n));
+         }
+
+         void close()
+         {
+            if (data) {
+               munmap(data, capacity);
+               data = nullptr;
+            }
+            if (fd >= 0) {
+               if (ftruncate(fd, size) != 0) {
+                  // the size in the header is still valid
+               }
+               ::close(fd);
+               fd = -1;
+            }
+         }
+
+        private:
+         bool reserve(size_t n)
+         {
+            if (n <= capacity) {
+               return true;
+            }
+
+            const size_t new_capacity = std::max(n, capacity + std::max(capacity, kGrowth));
+            if (ftruncate(fd, new_capacity) != 0) {
+               return false;
+            }
+            // map the new size before dropping the old mapping, a failure leaves the file usable
+            auto* new_data = (char*)mmap(nullptr, new_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (new_data == MAP_FAILED) {
+               return false;
+            }
+            if (data) {
+               munmap(data, capacity);
+            }
+            data = new_data;
+            capacity = new_capacity;
+            return true;
+         }
+      };
+
+      // read-only mapping of a file written by mapped_writer
+      struct mapped_reader
+      {
+         int fd = -1;
+         const char* data = nullptr;
+         size_t mapped = 0;
+         size_t size = 0; // valid bytes, including the header
+
+         mapped_reader() = default;
+         mapped_reader(const mapped_reader&) = delete;
+         mapped_reader& operator=(const mapped_reader&) = delete;
+         ~mapped_reader() { close(); }
+
+         bool open(const std::string& filename, std::string_view magic)
+         {
+            struct stat st{};
+            fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0 || fstat(fd, &st) != 0 || size_t(st.st_size) < kHeaderSize) {
+               close();
+               return false;
+            }
+
+            mapped = st.st_size;
+            data = (const char*)mmap(nullptr, mapped, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED || std::memcmp(data, magic.data(), std::min<size_t>(magic.size(), 8)) != 0) {
+               if (data == MAP_FAILED) data = nullptr;
+               close();
+               return false;
+            }
+
+            uint64_t n = 0;
+            std::memcpy(&n, data + 8, sizeof(n));
+            size = kHeaderSize + std::min<uint64_t>(n, mapped - kHeaderSize);
+            return true;
+         }
+
+         void close()
+         {
+            if (data) {
+               munmap((void*)data, mapped);
+               data = nullptr;
+            }
+            if (fd >= 0) {
+               ::close(fd);
+               fd = -1;
+            }
+         }
+      };
+
+      // "/balls/3/x" -> "/balls/{}/x", [3]
+      inline std::string pattern(std::string_view path, std::vector<int>& idxs) { return Client::pattern(path, idxs); }
+   }
+
+   template <bool SSL>
+   struct Recorder
+   {
+      struct Options
+      {
+         int32_t update_period_ms = 16; // minimum time between two frames
+         int32_t keyframe_interval_ms = 1000; // the granularity of seeking in the replay
+      };
+
+      rec::mapped_writer file{};
+      rec::mapped_writer index{};
+
+      int32_t client_id = -1;
+      int64_t t_start_us = 0;
+      uint64_t n_frames = 0;
+      uint64_t n_keyframes = 0;
+
+      // record the vars with the given paths, e.g. "/state/balls/3/x", from the next update() pass on
+      // create it before Incppect::run(), the server sends the frames to it until it stops, so it must outlive it
+      Recorder(Incppect<SSL>& incppect, const std::string& filename, const std::vector<std::string>& paths,
+               Options options = {})
+      {
+         if (!file.open(filename, "INCPREC2") || !index.open(filename + ".idx", "INCPIDX1")) {
+            rec::error("[incppect] failed to open recording '{}': {}\n", filename, std::strerror(errno));
+            close();
+            return;
+         }
+
+         t_start_us = timestamp_us();
+
+         std::string text;
+         for (const auto& path : paths) {
+            text += path + '\n';
+         }
+         if (!append(rec::kind::paths, text)) {
+            rec::error("[incppect] failed to write recording '{}': {}\n", filename, std::strerror(errno));
+            close();
+            return;
+         }
+
+         // register the paths like a client would: [5] n x [req_id][getter_id][nidxs][idxs...], [2] req ids
+         std::vector<int32_t> msg_register = {5};
+         std::vector<int32_t> msg_request = {2};
+         std::vector<int> idxs;
+         for (int32_t req_id = 0; req_id < int32_t(paths.size()); ++req_id) {
+            idxs.clear();
+            const auto p = rec::pattern(paths[req_id], idxs);
+            const auto it = incppect.pathToGetter.find(p);
+            if (it == incppect.pathToGetter.end()) {
+               rec::error("[incppect] recorder: missing path '{}'\n", paths[req_id]);
+               continue;
+            }
+            msg_register.insert(msg_register.end(), {req_id, it->second, int32_t(idxs.size())});
+            msg_register.insert(msg_register.end(), idxs.begin(), idxs.end());
+            msg_request.push_back(req_id);
+         }
+
+         auto& shard = *incppect.shards[0];
+         client_id = ++incppect.unique_id;
+         incppect.process_message(shard, client_id,
+                                  {(const char*)msg_register.data(), msg_register.size() * sizeof(int32_t)});
+         incppect.process_message(shard, client_id,
+                                  {(const char*)msg_request.data(), msg_request.size() * sizeof(int32_t)});
+
+         auto& cd = shard.client_data[client_id];
+         auto& reqs = cd.requests;
+         for (int32_t req_id = 0; req_id < reqs.size(); ++req_id) {
+            reqs.t_min_update_ms[req_id] = options.update_period_ms;
+            reqs.t_last_req_timeout_ms[req_id] = std::numeric_limits<int64_t>::max() / 2; // no keepalive needed
+         }
+         cd.t_keyframe_interval_ms = options.keyframe_interval_ms;
+         cd.sink = [this](std::string_view msg, bool keyframe) { on_frame(msg, keyframe); };
+      }
+
+      bool is_open() const { return file.data != nullptr; }
+
+     private:
+      // the recording keeps the records committed so far
+      void close()
+      {
+         file.close();
+         index.close();
+      }
+
+      // appends and commits a whole record, or nothing
+      bool append(rec::kind kind, std::string_view data)
+      {
+         const rec::record_header header{uint32_t(kind), uint32_t(data.size()), timestamp_us() - t_start_us};
+         const uint32_t padding = 0;
+         const size_t size = file.size;
+         if (!file.append(&header, sizeof(header)) || !file.append(data.data(), data.size()) ||
+             !file.append(&padding, (4 - data.size() % 4) % 4)) {
+            file.size = size;
+            return false;
+         }
+         file.commit();
+         return true;
+      }
+
+      void on_frame(std::string_view msg, bool keyframe)
+      {
+         // "no change" messages carry no data
+         if (!is_open() || (msg.size() == sizeof(uint32_t) && xor_rle::word(msg.data()) == 3)) {
+            return;
+         }
+
+         // the first failure ends the recording, it stays replayable up to the last complete frame
+         const rec::index_entry entry{timestamp_us() - t_start_us, file.size};
+         if (!append(rec::kind::frame, msg)) {
+            rec::error("[incppect] recorder: failed to write frame {}, recording stopped: {}\n", n_frames,
+                       std::strerror(errno));
+            close();
+            return;
+         }
+         ++n_frames;
+
+         if (keyframe) {
+            if (!index.append(&entry, sizeof(entry))) {
+               rec::error("[incppect] recorder: failed to write the index, recording stopped: {}\n",
+                          std::strerror(errno));
+               close();
+               return;
+            }
+            index.commit();
+            ++n_keyframes;
+         }
+      }
+   };
+
+   template <bool SSL>
+   struct Replayer
+   {
+      rec::mapped_reader file{};
+      rec::mapped_reader index{};
+
+      std::vector<std::string> paths{};
+      Client client{}; // decodes the frames, its vars hold the recorded content at the playback position
+
+      // getter of every recorded pattern: idxs -> req id
+      std::map<std::string, std::map<std::vector<int>, int32_t>> patterns{};
+
+      size_t first_frame = 0; // offset of the first frame record
+      size_t cursor = 0; // offset of the next record to apply
+      int64_t duration_us = 0;
+
+      // playback state, updated at the beginning of every update() pass
+      double t_play_us = 0.0;
+      int64_t t_last_us = -1;
+
+      // set by the clients from the threads of the loops
+      std::atomic<int64_t> seek_ms{0}; // -1: none, starts with a seek to the beginning
+      std::atomic<int32_t> speed_permille{1000};
+
+      // serve the recording through incppect. create it before Incppect::run(), it must outlive the server
+      // playback starts at the beginning, in real time, and stops at the end of the recording
+      Replayer(Incppect<SSL>& incppect, const std::string& filename)
+      {
+         if (!file.open(filename, "INCPREC2") || !index.open(filename + ".idx", "INCPIDX1")) {
+            rec::error("[incppect] failed to open recording '{}'\n", filename);
+            file.close();
+            return;
+         }
+
+         rec::record_header header{};
+         if (!read_header(rec::kHeaderSize, header) || header.kind != uint32_t(rec::kind::paths)) {
+            rec::error("[incppect] invalid recording '{}'\n", filename);
+            file.close();
+            return;
+         }
+         first_frame = rec::kHeaderSize + sizeof(header) + (header.size + 3) / 4 * 4;
+
+         // the req ids of the recording are the indices of the paths, so are the ones of the client
+         std::string_view text{file.data + rec::kHeaderSize + sizeof(header), header.size};
+         while (!text.empty()) {
+            const auto end = text.find('\n');
+            paths.emplace_back(text.substr(0, end));
+            text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+         }
+
+         for (int32_t req_id = 0; req_id < int32_t(paths.size()); ++req_id) {
+            client.subscribe(paths[req_id]);
+
+            std::vector<int> idxs;
+            const auto p = rec::pattern(paths[req_id], idxs);
+            patterns[p][idxs] = req_id;
+         }
+
+         for (size_t offset = first_frame; read_header(offset, header); offset += record_size(header)) {
+            duration_us = header.t_us;
+         }
+
+         for (const auto& [p, idx_map] : patterns) {
+            incppect.var(p, [this, &idx_map](const std::vector<int>& idxs) {
+               const auto it = idx_map.find(idxs);
+               return it != idx_map.end() ? client.data(it->second) : std::string_view{};
+            });
+         }
+
+         incppect.var("/incppect/replay/t_ms", [this](const std::vector<int>&) { return view(t_play_us * 1e-3); });
+         incppect.var("/incppect/replay/duration_ms",
+                      [this](const std::vector<int>&) { return view(double(duration_us) * 1e-3); });
+         incppect.var("/incppect/replay/speed",
+                      [this](const std::vector<int>&) { return view(speed_permille.load() * 1e-3); });
+
+         // the sync hooks and the getters of all loops are called under the same lock
+         incppect.sync_hooks.emplace_back([this] { advance(); });
+
+         incppect.playback_handler = [this](playback_command command, int32_t value) {
+            switch (command) {
+            case playback_command::seek_ms:
+               seek_ms = std::max(value, 0);
+               break;
+            case playback_command::speed_permille:
+               speed_permille = std::max(value, 0);
+               break;
+            }
+         };
+      }
+
+      bool is_open() const { return file.data != nullptr; }
+
+     private:
+      static size_t record_size(const rec::record_header& header)
+      {
+         return sizeof(header) + (size_t(header.size) + 3) / 4 * 4;
+      }
+
+      bool read_header(size_t offset, rec::record_header& header) const
+      {
+         if (offset + sizeof(header) > file.size) {
+            return false;
+         }
+         std::memcpy(&header, file.data + offset, sizeof(header));
+         return offset + record_size(header) <= file.size;
+      }
+
+      // restart from the last keyframe at or before t_us
+      void seek(int64_t t_us)
+      {
+         const auto* entries = (const rec::index_entry*)(index.data + rec::kHeaderSize);
+         const size_t n = (index.size - rec::kHeaderSize) / sizeof(rec::index_entry);
+
+         const auto it = std::upper_bound(entries, entries + n, t_us,
+                                          [](int64_t t, const rec::index_entry& e) { return t < e.t_us; });
+         cursor = it == entries ? first_frame : size_t((it - 1)->offset);
+         client.frame.clear();
+
+         t_play_us = double(std::clamp<int64_t>(t_us, 0, duration_us));
+      }
+
+      void advance()
+      {
+         if (!is_open()) {
+            return;
+         }
+
+         const int64_t t = timestamp_us();
+         if (t_last_us < 0) {
+            t_last_us = t;
+         }
+
+         if (const int64_t t_seek_ms = seek_ms.exchange(-1); t_seek_ms >= 0) {
+            seek(t_seek_ms * 1000);
+         }
+         else {
+            t_play_us = std::min(t_play_us + (t - t_last_us) * (speed_permille.load() * 1e-3), double(duration_us));
+         }
+         t_last_us = t;
+
+         rec::record_header header{};
+         while (read_header(cursor, header) && header.t_us <= t_play_us) {
+            client.on_message({file.data + cursor + sizeof(header), header.size});
+            cursor += record_size(header);
+         }
+      }
+   };
+}
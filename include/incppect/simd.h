@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define INCPPECT_SIMD_X86 1
+#include <immintrin.h>
+#define INCPPECT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define INCPPECT_SIMD_X86 0
+#define INCPPECT_TARGET(isa)
+#endif
+
+namespace incpp::simd
+{
+   // instruction sets the vectorized kernels are specialized for
+   enum struct level : uint8_t {
+      scalar,
+      sse42,
+      avx2,
+   };
+
+   inline const char* name(level l)
+   {
+      switch (l) {
+      case level::sse42:
+         return "sse4.2";
+      case level::avx2:
+         return "avx2";
+      default:
+         return "scalar";
+      }
+   }
+
+   inline level detect()
+   {
+#if INCPPECT_SIMD_X86
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2")) {
+         return level::avx2;
+      }
+      if (__builtin_cpu_supports("sse4.2")) {
+         return level::sse42;
+      }
+#endif
+      return level::scalar;
+   }
+
+   // the best level supported by the cpu, detected once
+   inline level best()
+   {
+      static const level l = detect();
+      return l;
+   }
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+// spans of the update() passes, exported in the Chrome trace-event format (chrome://tracing, ui.perfetto.dev)
+//
+//   built with INCPPECT_TRACE=1 (cmake -DINCPPECT_TRACE=ON), every loop records its spans into its own ring buffer.
+//   without it INCPPECT_TRACE_SCOPE() expands to nothing and no buffer exists
+
+#ifndef INCPPECT_TRACE
+#define INCPPECT_TRACE 0
+#endif
+
+#if INCPPECT_TRACE
+
+#include <atomic>
+#include <cstdint>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "metrics.h"
+
+#ifndef INCPPECT_TRACE_CAPACITY
+#define INCPPECT_TRACE_CAPACITY (1 << 16) // spans per loop, a power of 2
+#endif
+
+namespace incpp
+{
+   namespace trace
+   {
+      enum struct span : uint8_t {
+         update, // update() pass
+         evaluate, // getters and sync hooks, under getter_mutex
+         getter, // getter call, arg: getter id
+         xor_rle, // diff of a snapshot, arg: getter id
+         frame, // encoding of the frame of a client, arg: client id
+         frame_diff, // diff against the previous frame, arg: client id
+         send, // ws->send(), including the compression, arg: client id
+         lz4, // shuffle and LZ4 compression of a snapshot, arg: getter id
+      };
+
+      inline constexpr const char* span_names[] = {"update", "evaluate",   "getter", "xor_rle", "frame",
+                                                   "frame_diff", "send", "lz4"};
+      inline constexpr const char* arg_names[] = {"", "", "getter", "getter", "client", "client", "client", "getter"};
+
+      struct event
+      {
+         span kind{};
+         int32_t arg = -1;
+         uint64_t t_start_ns = 0;
+         uint64_t t_end_ns = 0;
+      };
+
+      // overwriting ring buffer with a single writer (the thread of the loop) and any number of readers
+      // every slot is a seqlock, so the readers skip the slots being overwritten instead of blocking the writer
+      struct ring
+      {
+         static constexpr uint64_t kCapacity = INCPPECT_TRACE_CAPACITY;
+         static_assert((kCapacity & (kCapacity - 1)) == 0, "INCPPECT_TRACE_CAPACITY must be a power of 2");
+
+         struct slot
+         {
+            std::atomic<uint64_t> seq{}; // 2 * index + 2 once written, odd while being written
+            std::atomic<uint64_t> kind_arg{};
+            std::atomic<uint64_t> t_start_ns{};
+            std::atomic<uint64_t> t_end_ns{};
+         };
+
+         std::unique_ptr<slot[]> slots{new slot[kCapacity]};
+         std::atomic<uint64_t> head{}; // number of events pushed
+
+         void push(span kind, int32_t arg, uint64_t t_start_ns, uint64_t t_end_ns)
+         {
+            constexpr auto relaxed = std::memory_order_relaxed;
+
+            const uint64_t i = head.load(relaxed);
+            auto& s = slots[i & (kCapacity - 1)];
+
+            s.seq.store(2 * i + 1, relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            s.kind_arg.store((uint64_t(kind) << 32) | uint32_t(arg), relaxed);
+            s.t_start_ns.store(t_start_ns, relaxed);
+            s.t_end_ns.store(t_end_ns, relaxed);
+            s.seq.store(2 * i + 2, std::memory_order_release);
+
+            head.store(i + 1, std::memory_order_release);
+         }
+
+         // the last kCapacity events, oldest first
+         void read(std::vector<event>& out) const
+         {
+            constexpr auto relaxed = std::memory_order_relaxed;
+
+            const uint64_t n = head.load(std::memory_order_acquire);
+            for (uint64_t i = n > kCapacity ? n - kCapacity : 0; i < n; ++i) {
+               const auto& s = slots[i & (kCapacity - 1)];
+
+               const uint64_t seq = s.seq.load(std::memory_order_acquire);
+               if (seq != 2 * i + 2) {
+                  continue;
+               }
+               const uint64_t kind_arg = s.kind_arg.load(relaxed);
+               const event e{span(kind_arg >> 32), int32_t(uint32_t(kind_arg)), s.t_start_ns.load(relaxed),
+                             s.t_end_ns.load(relaxed)};
+               std::atomic_thread_fence(std::memory_order_acquire);
+               if (s.seq.load(relaxed) != seq) {
+                  continue;
+               }
+               out.push_back(e);
+            }
+         }
+      };
+
+      struct scope
+      {
+         ring& r;
+         span kind;
+         int32_t arg = -1;
+         uint64_t t_start_ns = metrics::now_ns();
+
+         ~scope() { r.push(kind, arg, t_start_ns, metrics::now_ns()); }
+      };
+
+      // complete ("X") events, one thread per loop
+      // name_of(e) returns the label of the arg of the event, e.g. the path of a getter, or an empty string
+      template <class F>
+      void write_events(std::string& out, const std::vector<event>& events, int32_t loop, F&& name_of, bool& first)
+      {
+         for (const auto& e : events) {
+            const auto k = size_t(e.kind);
+            std::format_to(std::back_inserter(out),
+                           "{}{{\"name\":\"{}\",\"cat\":\"incppect\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},"
+                           "\"pid\":1,\"tid\":{}",
+                           first ? "\n" : ",\n", span_names[k], e.t_start_ns * 1e-3,
+                           (e.t_end_ns - e.t_start_ns) * 1e-3, loop);
+            if (arg_names[k][0] != '\0') {
+               std::format_to(std::back_inserter(out), ",\"args\":{{\"{}\":{}", arg_names[k], e.arg);
+               const std::string name = name_of(e);
+               if (!name.empty()) {
+                  out += ",\"path\":\"";
+                  metrics::escape(out, name);
+                  out += '"';
+               }
+               out += '}';
+            }
+            out += '}';
+            first = false;
+         }
+      }
+   }
+}
+
+#define INCPPECT_TRACE_CONCAT_(a, b) a##b
+#define INCPPECT_TRACE_CONCAT(a, b) INCPPECT_TRACE_CONCAT_(a, b)
+#define INCPPECT_TRACE_SCOPE(ring, kind, arg)                                                                          \
+   const ::incpp::trace::scope INCPPECT_TRACE_CONCAT(incppect_trace_scope_, __LINE__)                                 \
+   {                                                                                                                   \
+      ring, ::incpp::trace::span::kind, int32_t(arg)                                                                   \
+   }
+
+#else
+
+#define INCPPECT_TRACE_SCOPE(ring, kind, arg) ((void)0)
+
+#endif
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "simd.h"
+
+namespace incpp
+{
+   // XOR run-length encoding used for the diff updates:
+   //
+   //   the buffers are processed as uint32_t words, the word-wise XOR of prev and cur is split into runs of
+   //   equal values and every run is written as a (count, value) pair of uint32_t
+   //
+   // the vectorized kernels only accelerate the search for the end of a run, so the output is identical for
+   // all simd levels
+   namespace xor_rle
+   {
+      inline uint32_t word(const char* p)
+      {
+         uint32_t w;
+         std::memcpy(&w, p, sizeof(w));
+         return w;
+      }
+
+      // index of the first word in [i, n) for which prev ^ cur != c, or n
+      using run_end_t = size_t (*)(const char* prev, const char* cur, size_t i, size_t n, uint32_t c);
+
+      inline size_t run_end_scalar(const char* prev, const char* cur, size_t i, size_t n, uint32_t c)
+      {
+         for (; i < n; ++i) {
+            if ((word(prev + 4 * i) ^ word(cur + 4 * i)) != c) {
+               break;
+            }
+         }
+         return i;
+      }
+
+#if INCPPECT_SIMD_X86
+      INCPPECT_TARGET("sse4.2")
+      inline size_t run_end_sse42(const char* prev, const char* cur, size_t i, size_t n, uint32_t c)
+      {
+         // short runs are common in dense diffs, check the first words without the vector setup
+         for (const size_t e = i + 4 < n ? i + 4 : n; i < e; ++i) {
+            if ((word(prev + 4 * i) ^ word(cur + 4 * i)) != c) {
+               return i;
+            }
+         }
+
+         const __m128i vc = _mm_set1_epi32(int32_t(c));
+         for (; i + 4 <= n; i += 4) {
+            const __m128i a = _mm_loadu_si128((const __m128i*)(prev + 4 * i));
+            const __m128i b = _mm_loadu_si128((const __m128i*)(cur + 4 * i));
+            const __m128i x = _mm_xor_si128(_mm_xor_si128(a, b), vc);
+            if (!_mm_testz_si128(x, x)) {
+               const uint32_t eq = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(x, _mm_setzero_si128())));
+               return i + std::countr_one(eq);
+            }
+         }
+         return run_end_scalar(prev, cur, i, n, c);
+      }
+
+      INCPPECT_TARGET("avx2")
+      inline size_t run_end_avx2(const char* prev, const char* cur, size_t i, size_t n, uint32_t c)
+      {
+         for (const size_t e = i + 4 < n ? i + 4 : n; i < e; ++i) {
+            if ((word(prev + 4 * i) ^ word(cur + 4 * i)) != c) {
+               return i;
+            }
+         }
+
+         const __m256i vc = _mm256_set1_epi32(int32_t(c));
+         for (; i + 16 <= n; i += 16) {
+            const __m256i x0 =
+               _mm256_xor_si256(_mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(prev + 4 * i)),
+                                                 _mm256_loadu_si256((const __m256i*)(cur + 4 * i))),
+                                vc);
+            const __m256i x1 =
+               _mm256_xor_si256(_mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(prev + 4 * i + 32)),
+                                                 _mm256_loadu_si256((const __m256i*)(cur + 4 * i + 32))),
+                                vc);
+            const __m256i x = _mm256_or_si256(x0, x1);
+            if (!_mm256_testz_si256(x, x)) {
+               const __m256i zero = _mm256_setzero_si256();
+               const uint32_t eq0 = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x0, zero)));
+               if (eq0 != 0xff) {
+                  return i + std::countr_one(eq0);
+               }
+               const uint32_t eq1 = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(x1, zero)));
+               return i + 8 + std::countr_one(eq1);
+            }
+         }
+         return run_end_scalar(prev, cur, i, n, c);
+      }
+#endif
+
+      inline run_end_t run_end(simd::level l)
+      {
+#if INCPPECT_SIMD_X86
+         switch (l) {
+         case simd::level::avx2:
+            return run_end_avx2;
+         case simd::level::sse42:
+            return run_end_sse42;
+         default:
+            break;
+         }
+#endif
+         return run_end_scalar;
+      }
+
+      // collects (count, value) pairs and appends them to the output in batches
+      struct writer
+      {
+         static constexpr size_t kPairs = 64;
+
+         // pairs is left uninitialized, only the first n_pairs are read
+         explicit writer(std::string& out) : out(out) {}
+
+         std::string& out;
+         uint32_t pairs[2 * kPairs];
+         size_t n_pairs = 0;
+
+         void push(uint32_t n, uint32_t c)
+         {
+            pairs[2 * n_pairs + 0] = n;
+            pairs[2 * n_pairs + 1] = c;
+            if (++n_pairs == kPairs) {
+               flush();
+            }
+         }
+
+         void flush()
+         {
+            out.append((const char*)pairs, 2 * sizeof(uint32_t) * n_pairs);
+            n_pairs = 0;
+         }
+      };
+
+      // append the encoding of prev ^ cur to out
+      // size is in bytes, a trailing partial word is zero-extended
+      inline void encode(const char* prev, const char* cur, size_t size, std::string& out,
+                         simd::level l = simd::best())
+      {
+         const run_end_t find_run_end = run_end(l);
+
+         const size_t n_words = size / 4;
+
+         writer w{out};
+
+         uint32_t c = 0;
+         uint32_t n = 0;
+
+         size_t i = 0;
+         while (true) {
+            const size_t j = find_run_end(prev, cur, i, n_words, c);
+            n += uint32_t(j - i);
+            if (j == n_words) {
+               break;
+            }
+
+            if (n > 0) {
+               w.push(n, c);
+            }
+            n = 1;
+            c = word(prev + 4 * j) ^ word(cur + 4 * j);
+            i = j + 1;
+         }
+
+         if (size % 4 != 0) {
+            uint32_t a = 0;
+            uint32_t b = 0;
+            std::memcpy(&a, prev + 4 * n_words, size % 4);
+            std::memcpy(&b, cur + 4 * n_words, size % 4);
+            a = a ^ b;
+            if (a == c) {
+               ++n;
+            }
+            else {
+               w.push(n, c);
+               n = 1;
+               c = a;
+            }
+         }
+
+         w.push(n, c);
+         w.flush();
+      }
+
+      // xor n words starting at dst with c
+      using xor_fill_t = void (*)(char* dst, size_t n, uint32_t c);
+
+      inline void xor_fill_scalar(char* dst, size_t n, uint32_t c)
+      {
+         for (size_t i = 0; i < n; ++i) {
+            const uint32_t w = word(dst + 4 * i) ^ c;
+            std::memcpy(dst + 4 * i, &w, sizeof(w));
+         }
+      }
+
+#if INCPPECT_SIMD_X86
+      INCPPECT_TARGET("sse4.2")
+      inline void xor_fill_sse42(char* dst, size_t n, uint32_t c)
+      {
+         const __m128i vc = _mm_set1_epi32(int32_t(c));
+         size_t i = 0;
+         for (; i + 4 <= n; i += 4) {
+            __m128i* p = (__m128i*)(dst + 4 * i);
+            _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), vc));
+         }
+         xor_fill_scalar(dst + 4 * i, n - i, c);
+      }
+
+      INCPPECT_TARGET("avx2")
+      inline void xor_fill_avx2(char* dst, size_t n, uint32_t c)
+      {
+         const __m256i vc = _mm256_set1_epi32(int32_t(c));
+         size_t i = 0;
+         for (; i + 8 <= n; i += 8) {
+            __m256i* p = (__m256i*)(dst + 4 * i);
+            _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), vc));
+         }
+         xor_fill_scalar(dst + 4 * i, n - i, c);
+      }
+#endif
+
+      inline xor_fill_t xor_fill(simd::level l)
+      {
+#if INCPPECT_SIMD_X86
+         switch (l) {
+         case simd::level::avx2:
+            return xor_fill_avx2;
+         case simd::level::sse42:
+            return xor_fill_sse42;
+         default:
+            break;
+         }
+#endif
+         return xor_fill_scalar;
+      }
+
+      // apply an encoding produced by encode() to dst, turning prev into cur
+      // size is in bytes, a trailing partial word is handled like in encode()
+      // returns false if the encoding is malformed or covers more than size bytes
+      inline bool decode(const char* rle, size_t rle_size, char* dst, size_t size, simd::level l = simd::best())
+      {
+         if (rle_size % 8 != 0) {
+            return false;
+         }
+
+         const xor_fill_t fill = xor_fill(l);
+
+         const size_t n_words = size / 4;
+         const size_t n_total = (size + 3) / 4;
+
+         size_t k = 0;
+         for (size_t i = 0; i < rle_size; i += 8) {
+            const uint32_t n = word(rle + i);
+            const uint32_t c = word(rle + i + 4);
+            if (n > n_total - k) {
+               return false;
+            }
+
+            // runs of zeros leave the words unchanged, short runs are not worth the vector setup
+            if (c != 0) {
+               const size_t n_full = std::min<size_t>(n, n_words - std::min(k, n_words));
+               if (n_full < 8) {
+                  xor_fill_scalar(dst + 4 * k, n_full, c);
+               }
+               else {
+                  fill(dst + 4 * k, n_full, c);
+               }
+               if (n_full < n) {
+                  for (size_t b = 0; b < size % 4; ++b) {
+                     dst[4 * n_words + b] ^= char(c >> (8 * b));
+                  }
+               }
+            }
+            k += n;
+         }
+
+         return true;
+      }
+   }
+}
@@ -10,8 +10,41 @@ var incppect = {
     vars_map: {},
     var_to_id: {},
     id_to_var: {},
+    nvars_sent: 0,
+    path_to_getter: null,
     last_data: null,
 
+    // sequence numbers of the frames: the last decoded one, the last one reported to the server, and whether a frame
+    // was lost and the next ones are dropped until a keyframe arrives, asked for at t_resync_ms
+    seq: 0,
+    seq_acked: 0,
+    resync: false,
+    t_resync_ms: null,
+
+    // entries larger than the chunk size of the server, being received over several frames
+    chunks: {},
+
+    // requested update periods, see set_update_period_ms()
+    update_period_ms: {},
+    update_period_default_ms: null,
+    update_period_sent_ms: {},
+
+    // requested encodings of float arrays, see set_quantization()
+    quantization: {},
+    quantization_sent: {},
+
+    // requested codecs of the vars, see set_codec()
+    codec: {},
+    codec_sent: {},
+
+    // priorities of the vars on a slow connection, see set_priority()
+    priority: {},
+    priority_sent: {},
+
+    // channel of the client, see set_channel()
+    channel: '',
+    channel_sent: '',
+
     // requests data
     requests: [],
     requests_old: [],
@@ -27,6 +60,11 @@ var incppect = {
     k_var_delim: ' ',
     k_auto_reconnect: true,
     k_requests_update_freq_ms: 50,
+    k_resync_retry_ms: 1000,
+    k_quantization: { none: 0, fp16: 1, bf16: 2, int16: 3, int8: 4 },
+    k_quantization_f64: 0x100,
+    k_entry_quantized: 0x100,
+    k_codec: { automatic: 0, raw: 1, xor_rle: 2, lz4: 3, deflate: 4 },
 
     // stats
     stats: {
@@ -35,6 +73,9 @@ var incppect = {
 
         rx_n: 0,
         rx_bytes: 0,
+        rx_no_change: 0,
+        rx_dropped: 0,
+        rx_errors: 0,
     },
 
     timestamp: function () {
@@ -88,11 +129,17 @@ var incppect = {
             this.onerror('Failed to render state: ' + err);
         }
 
+        // acknowledged on every frame of the page, the server paces its frames with them
+        this.send_ack();
+
         if (this.requests_regenerate) {
-            if (this.requests_new_vars) {
+            // wait for the getter table before registering the vars
+            if (this.requests_new_vars && this.path_to_getter !== null) {
                 this.send_var_to_id_map();
                 this.requests_new_vars = false;
             }
+            this.send_request_options();
+            this.send_channel();
             this.send_requests();
             this.t_requests_last_update_ms = this.timestamp();
         }
@@ -121,6 +168,80 @@ var incppect = {
         return this.vars_map[path];
     },
 
+    // minimum time between two updates of a var pushed by the server, e.g. 8 for 120 Hz or 1000 for 1 Hz
+    // without a path, sets the period of all vars that don't have their own
+    set_update_period_ms: function (period_ms, path, ...args) {
+        if (path === undefined) {
+            this.update_period_default_ms = period_ms;
+            return;
+        }
+
+        for (var i = 2; i < arguments.length; i++) {
+            path = path.replace('{}', arguments[i]);
+        }
+
+        this.update_period_ms[path] = period_ms;
+    },
+
+    // playback control of a server replaying a recording (incpp::Replayer):
+    //   [7][command][value], command 0 seeks to value ms, command 1 sets the speed in permille
+    seek_ms: function (t_ms) {
+        this.send_playback(0, t_ms);
+    },
+
+    // 1.0 is real time, 0.0 pauses
+    set_playback_speed: function (speed) {
+        this.send_playback(1, Math.round(1000 * speed));
+    },
+
+    send_playback: function (command, value) {
+        if (this.ws == null || this.ws.readyState !== this.ws.OPEN) {
+            return;
+        }
+
+        var data = new Int32Array([7, command, value]);
+        this.ws.send(data);
+
+        this.stats.tx_n += 1;
+        this.stats.tx_bytes += data.byteLength;
+    },
+
+    // receive a float array var in a lossy encoding: 'fp16', 'bf16', 'int16', 'int8' or 'none'
+    // append '/f64' if the var holds doubles, e.g. 'int16/f64'. get_float_arr() decodes it transparently
+    set_quantization: function (encoding, path, ...args) {
+        for (var i = 2; i < arguments.length; i++) {
+            path = path.replace('{}', arguments[i]);
+        }
+
+        var parts = encoding.split('/');
+        this.quantization[path] = this.k_quantization[parts[0]] | (parts[1] === 'f64' ? this.k_quantization_f64 : 0);
+    },
+
+    // encoding of the var in the frames: 'raw', 'xor_rle', 'lz4', 'deflate' or 'automatic' (the default)
+    set_codec: function (codec, path, ...args) {
+        for (var i = 2; i < arguments.length; i++) {
+            path = path.replace('{}', arguments[i]);
+        }
+
+        this.codec[path] = this.k_codec[codec];
+    },
+
+    // order of the vars when the connection is too slow for all of them, higher first (0 by default). the vars that
+    // have waited the longest catch up with the higher priorities, so none of them stops completely
+    set_priority: function (priority, path, ...args) {
+        for (var i = 2; i < arguments.length; i++) {
+            path = path.replace('{}', arguments[i]);
+        }
+
+        this.priority[path] = priority;
+    },
+
+    // share the frames with the other clients of the same name that subscribe to the same vars, e.g. all viewers of a
+    // dashboard. the server groups identical subscriptions on its own unless it was configured not to
+    set_channel: function (name) {
+        this.channel = name;
+    },
+
     get_abuf: function (path, ...args) {
         return this.get(path, ...args);
     },
@@ -185,6 +306,9 @@ var incppect = {
 
     get_float_arr: function (path, ...args) {
         var abuf = this.get(path, ...args);
+        if (this.is_quantized(abuf)) {
+            return this.dequantize(abuf);
+        }
         return new Float32Array(abuf);
     },
 
@@ -192,11 +316,89 @@ var incppect = {
         return this.get_double_arr(path, ...args)[0];
     },
 
+    // a quantized var is returned as a Float32Array
     get_double_arr: function (path, ...args) {
         var abuf = this.get(path, ...args);
+        if (this.is_quantized(abuf)) {
+            return this.dequantize(abuf);
+        }
         return new Float64Array(abuf);
     },
 
+    // the server flags the entries of the quantized arrays, see apply_entry()
+    is_quantized: function (abuf) {
+        return abuf.quantized === true;
+    },
+
+    // [encoding][n] payload, decoded once per update of the var, the result is cached on the buffer
+    dequantize: function (abuf) {
+        if (abuf.decoded) {
+            return abuf.decoded;
+        }
+
+        var header = new DataView(abuf, 0, Math.min(abuf.byteLength, 8));
+        var encoding = abuf.byteLength >= 8 ? header.getUint32(0, true) : 0;
+        var n = abuf.byteLength >= 8 ? header.getUint32(4, true) : 0;
+        var n_blocks = Math.ceil(n / 256);
+        var sizes = [0, 2 * n, 2 * n, 8 * n_blocks + 2 * n, 8 * n_blocks + n];
+        if (!(encoding >= 1 && encoding <= 4) || 8 + sizes[encoding] > abuf.byteLength) {
+            console.error("[incppect] malformed quantized array");
+            return new Float32Array(0);
+        }
+
+        var view = new DataView(abuf, 8);
+        var out = new Float32Array(n);
+
+        if (encoding == 1) {
+            for (var i = 0; i < n; ++i) {
+                var h = view.getUint16(2 * i, true);
+                var e = (h >> 10) & 0x1f;
+                var m = h & 0x3ff;
+                var v = e == 0 ? m * Math.pow(2, -24) : e == 31 ? (m ? NaN : Infinity) : (1 + m / 1024) * Math.pow(2, e - 15);
+                out[i] = h & 0x8000 ? -v : v;
+            }
+        } else if (encoding == 2) {
+            var bits = new Uint32Array(out.buffer);
+            for (var i = 0; i < n; ++i) {
+                bits[i] = view.getUint16(2 * i, true) << 16;
+            }
+        } else if (encoding == 3 || encoding == 4) {
+            // blocks of 256 values: [f32 min][f32 scale] 256 x u16 (int16) or u8 (int8)
+            var q_size = encoding == 3 ? 2 : 1;
+            var offset = 0;
+            for (var i = 0; i < n; i += 256) {
+                var count = Math.min(256, n - i);
+                var min = view.getFloat32(offset, true);
+                var scale = view.getFloat32(offset + 4, true);
+                offset += 8;
+                for (var k = 0; k < count; ++k) {
+                    var q = q_size == 2 ? view.getUint16(offset + 2 * k, true) : view.getUint8(offset + k);
+                    out[i + k] = min + Math.fround(scale * q); // rounded as the float arithmetic of quant.h
+                }
+                offset += q_size * count;
+            }
+        }
+
+        abuf.decoded = out;
+        return out;
+    },
+
+    // history of a var defined with a history depth on the server, see Incppect::var()
+    // returns n_buckets x [t_ms, min, max, mean], t_ms <= 0 is relative to now, empty buckets hold NaN
+    get_history: function (path, window_ms, n_buckets) {
+        return this.get_double_arr(path + '/history/{}/{}', window_ms, n_buckets);
+    },
+
+    // decimated view of an array defined with lod_var() on the server
+    // returns [min0, max0, min1, max1, ...], the envelopes of the samples [begin, end) in at most n_points buckets
+    get_lod: function (path, begin, end, n_points) {
+        return this.get_float_arr(path + '/lod/{}/{}/{}', begin, end, n_points);
+    },
+
+    get_lod_size: function (path) {
+        return this.get_double(path + '/lod/size');
+    },
+
     get_str: function (path, ...args) {
         var abuf = this.get(path, ...args);
         var enc = new TextDecoder("utf-8");
@@ -224,32 +426,140 @@ var incppect = {
     },
 
     send_var_to_id_map: function () {
+        // vars with a path advertised by the server are registered with a binary message:
+        //   [5] n x [req_id][getter_id][nidxs][idxs...]
+        // the rest fall back to the text format: 'path req_id nidxs idxs...'
+        var bin = [5];
         var msg = '';
         var delim = this.k_var_delim;
-        for (var key in this.var_to_id) {
-            var nidxs = 0;
-            var idxs = delim;
-            //var keyp = key.replace(/\[-?\d*\]/g, function (m) { ++nidxs; idxs += m.replace(/[\[\]]/g, '') + delim; return '[%d]'; });
+        for (var id = this.nvars_sent; id < this.nvars; ++id) {
+            var key = this.id_to_var[id];
+            var idxs = [];
 
             // replace /# with /{}
             var keyp = key.replace(/\/-?\d+/g, function (m) {
-                ++nidxs;
-                idxs += m.replace(/\//g, '') + delim; // Remove the leading '/' and append to idxs
+                idxs.push(parseInt(m.replace(/\//g, ''))); // Remove the leading '/'
                 return '/{}';
             });
-            console.log(idxs);
 
-            msg += keyp + delim + this.var_to_id[key].toString() + delim + nidxs + idxs;
+            if (keyp in this.path_to_getter) {
+                bin.push(id, this.path_to_getter[keyp], idxs.length);
+                bin.push(...idxs);
+            } else {
+                msg += keyp + delim + id.toString() + delim + idxs.length + delim + idxs.join(delim) + delim;
+            }
+        }
+        this.nvars_sent = this.nvars;
+
+        if (bin.length > 1) {
+            var data = new Int32Array(bin);
+            this.ws.send(data);
+
+            this.stats.tx_n += 1;
+            this.stats.tx_bytes += data.byteLength;
+        }
+
+        if (msg.length > 0) {
+            var enc_msg = new TextEncoder().encode(msg);
+            var data = new Int8Array(4 + enc_msg.length + 1);
+            data[0] = 1;
+            data.set(enc_msg, 4);
+            data[4 + enc_msg.length] = 0;
+            this.ws.send(data);
+
+            this.stats.tx_n += 1;
+            this.stats.tx_bytes += data.length;
         }
-        var data = new Int8Array(4 + msg.length + 1);
-        var enc = new TextEncoder();
-        data[0] = 1;
-        data.set(enc.encode(msg), 4);
-        data[4 + msg.length] = 0;
+    },
+
+    send_request_options: function () {
+        // [6] n x [req_id][option][value], option 0 is the update period, option 1 the quantization, option 2 the codec,
+        // option 3 the priority
+        var opts = [6];
+        for (var id = 0; id < this.nvars_sent; ++id) {
+            var path = this.id_to_var[id];
+            var period_ms = path in this.update_period_ms ? this.update_period_ms[path] : this.update_period_default_ms;
+            if (period_ms !== null && this.update_period_sent_ms[id] !== period_ms) {
+                opts.push(id, 0, period_ms);
+                this.update_period_sent_ms[id] = period_ms;
+            }
+            if (path in this.quantization && this.quantization_sent[id] !== this.quantization[path]) {
+                opts.push(id, 1, this.quantization[path]);
+                this.quantization_sent[id] = this.quantization[path];
+            }
+            if (path in this.codec && this.codec_sent[id] !== this.codec[path]) {
+                opts.push(id, 2, this.codec[path]);
+                this.codec_sent[id] = this.codec[path];
+            }
+            if (path in this.priority && this.priority_sent[id] !== this.priority[path]) {
+                opts.push(id, 3, this.priority[path]);
+                this.priority_sent[id] = this.priority[path];
+            }
+        }
+
+        if (opts.length > 1) {
+            var data = new Int32Array(opts);
+            this.ws.send(data);
+
+            this.stats.tx_n += 1;
+            this.stats.tx_bytes += data.byteLength;
+        }
+    },
+
+    send_ack: function () {
+        // [9][seq][flags], flags bit 0 asks for a keyframe: once per lost frame, and again every k_resync_retry_ms
+        // until one arrives
+        var t = this.timestamp();
+        var ask = this.resync && (this.t_resync_ms === null || t - this.t_resync_ms >= this.k_resync_retry_ms);
+        if (ask == false && this.seq === this.seq_acked) {
+            return;
+        }
+
+        var data = new Int32Array([9, this.seq, ask ? 1 : 0]);
         this.ws.send(data);
+        this.seq_acked = this.seq;
+        if (ask) {
+            this.t_resync_ms = t;
+        }
 
         this.stats.tx_n += 1;
-        this.stats.tx_bytes += data.length;
+        this.stats.tx_bytes += data.byteLength;
+    },
+
+    send_channel: function () {
+        // [8] name, zero-padded to 4 bytes
+        if (this.channel === this.channel_sent) {
+            return;
+        }
+
+        var name = new TextEncoder().encode(this.channel);
+        var data = new Uint8Array(4 + 4 * Math.ceil(name.length / 4));
+        new Int32Array(data.buffer, 0, 1)[0] = 8;
+        data.set(name, 4);
+        this.ws.send(data);
+        this.channel_sent = this.channel;
+
+        this.stats.tx_n += 1;
+        this.stats.tx_bytes += data.byteLength;
+    },
+
+    on_getter_table: function (data) {
+        // [2][n] n x [getter_id][path length][path, zero-padded to 4 bytes]
+        var int_view = new Int32Array(data);
+        var dec = new TextDecoder("utf-8");
+        var n = int_view[1];
+        var offset = 2;
+
+        this.path_to_getter = {};
+        for (var i = 0; i < n; ++i) {
+            var getter_id = int_view[offset + 0];
+            var len = int_view[offset + 1];
+            offset += 2;
+            var path = dec.decode(new Uint8Array(data, 4 * offset, len));
+            offset += Math.ceil(len / 4);
+
+            this.path_to_getter[path] = getter_id;
+        }
     },
 
     send_requests: function () {
@@ -291,6 +601,19 @@ var incppect = {
         this.vars_map = {};
         this.var_to_id = {};
         this.id_to_var = {};
+        this.nvars_sent = 0;
+        this.path_to_getter = null;
+        this.update_period_sent_ms = {};
+        this.quantization_sent = {};
+        this.codec_sent = {};
+        this.priority_sent = {};
+        this.channel_sent = '';
+        this.last_data = null;
+        this.chunks = {};
+        this.seq = 0;
+        this.seq_acked = 0;
+        this.resync = false;
+        this.t_resync_ms = null;
         this.requests = null;
         this.requests_old = null;
         this.ws = null;
@@ -302,11 +625,36 @@ var incppect = {
 
         var type_all = (new Uint32Array(evt.data))[0];
 
+        if (type_all == 2) {
+            this.on_getter_table(evt.data);
+            return;
+        }
+
+        if (type_all == 3) {
+            // nothing changed since the last update, the server stays silent until something does
+            this.stats.rx_no_change += 1;
+            return;
+        }
+
+        // [typeAll][seq][base], a frame applies to the last decoded one unless it is a keyframe (base == seq)
+        var header = new Uint32Array(evt.data, 0, 3);
+        var seq = header[1];
+        var base = header[2];
+        if (base != seq && (this.resync || base != this.seq)) {
+            // a frame was lost, ask for a keyframe with the next requests
+            this.resync = true;
+            this.stats.rx_dropped += 1;
+            return;
+        }
+        this.resync = false;
+        this.t_resync_ms = null;
+        this.seq = seq;
+
         if (this.last_data != null && type_all == 1) {
-            var ntotal = evt.data.byteLength / 4 - 1;
+            var ntotal = evt.data.byteLength / 4 - 3;
 
-            var src_view = new Uint32Array(evt.data, 4);
-            var dst_view = new Uint32Array(this.last_data, 4);
+            var src_view = new Uint32Array(evt.data, 12);
+            var dst_view = new Uint32Array(this.last_data, 12);
 
             var k = 0;
             for (var i = 0; i < ntotal / 2; ++i) {
@@ -322,7 +670,7 @@ var incppect = {
         }
 
         var int_view = new Uint32Array(this.last_data);
-        var offset = 1;
+        var offset = 3;
         var offset_new = 0;
         var total_size = this.last_data.byteLength;
         var id = 0;
@@ -334,26 +682,193 @@ var incppect = {
             len = int_view[offset + 2];
             offset += 3;
             offset_new = offset + len / 4;
-            if (type == 0) {
-                this.vars_map[this.id_to_var[id]] = this.last_data.slice(4 * offset, 4 * offset_new);
-            } else {
-                var src_view = new Uint32Array(this.last_data, 4 * offset);
-                var dst_view = new Uint32Array(this.vars_map[this.id_to_var[id]]);
-
-                var k = 0;
-                for (var i = 0; i < len / 8; ++i) {
-                    var n = src_view[2 * i + 0];
-                    var c = src_view[2 * i + 1];
-                    for (var j = 0; j < n; ++j) {
-                        dst_view[k] = dst_view[k] ^ c;
-                        ++k;
-                    }
-                }
+            var ok = type == 3 ? this.apply_chunk(id, new Uint8Array(this.last_data, 4 * offset, len))
+                               : this.apply_entry(id, type, this.last_data, 4 * offset, len);
+            if (!ok) {
+                // the vars may no longer match the frames of the server, ask for a keyframe
+                this.stats.rx_errors += 1;
+                this.resync = true;
+                return;
             }
             offset = offset_new;
         }
     },
 
+    // type 0 content, 1 XOR-RLE diff of the previous content, 2 lz4, with k_entry_quantized for a quantized array.
+    // false for an unknown type or a diff that does not fit the previous content
+    apply_entry: function (id, type, buffer, byte_offset, len) {
+        var path = this.id_to_var[id];
+        var codec = type & ~this.k_entry_quantized;
+        if (codec == 0) {
+            this.vars_map[path] = buffer.slice(byte_offset, byte_offset + len);
+        } else if (codec == 1) {
+            if (!(path in this.vars_map)) {
+                return false;
+            }
+            var src_view = new Uint32Array(buffer, byte_offset, len / 4);
+            var dst_view = new Uint32Array(this.vars_map[path]);
+
+            var k = 0;
+            for (var i = 0; i < len / 8; ++i) {
+                var n = src_view[2 * i + 0];
+                var c = src_view[2 * i + 1];
+                if (n > dst_view.length - k) {
+                    return false;
+                }
+                for (var j = 0; j < n; ++j) {
+                    dst_view[k] = dst_view[k] ^ c;
+                    ++k;
+                }
+            }
+            this.vars_map[path].decoded = null;
+        } else if (codec == 2) {
+            if (!this.apply_lz4(id, new Uint8Array(buffer, byte_offset, len))) {
+                return false;
+            }
+        } else {
+            console.error("[incppect] unknown entry type", type, "for", path);
+            return false;
+        }
+        this.vars_map[path].quantized = (type & this.k_entry_quantized) != 0;
+        return true;
+    },
+
+    // [type][total size][offset] part of an entry of another type, larger than the chunk size of the server. the
+    // parts are copied into a buffer allocated with the first one, and the entry is applied once complete
+    apply_chunk: function (id, src) {
+        var header = new DataView(src.buffer, src.byteOffset, 12);
+        var type = header.getUint32(0, true);
+        var total = header.getUint32(4, true);
+        var offset = header.getUint32(8, true);
+        var data = src.subarray(12);
+
+        if (offset == 0) {
+            this.chunks[id] = { type: type, buffer: new ArrayBuffer(total), received: 0 };
+        }
+
+        var entry = this.chunks[id];
+        if (entry == null || entry.type != type || entry.buffer.byteLength != total || entry.received != offset ||
+            offset + data.length > total) {
+            console.error("[incppect] unexpected chunk for", this.id_to_var[id]);
+            delete this.chunks[id];
+            return false;
+        }
+
+        new Uint8Array(entry.buffer, offset, data.length).set(data);
+        entry.received += data.length;
+        if (entry.received < total) {
+            return true;
+        }
+
+        delete this.chunks[id];
+        if ((type & ~this.k_entry_quantized) == 0) {
+            entry.buffer.quantized = (type & this.k_entry_quantized) != 0;
+            this.vars_map[this.id_to_var[id]] = entry.buffer;
+            return true;
+        }
+        return this.apply_entry(id, type, entry.buffer, 0, total);
+    },
+
+    // [u32 raw size][u32 flags] lz4 block of the byte-shuffled content, or of its XOR with the previous one (flags & 1)
+    apply_lz4: function (id, src) {
+        var header = new DataView(src.buffer, src.byteOffset, 8);
+        var size = header.getUint32(0, true);
+        var flags = header.getUint32(4, true);
+
+        var shuffled = this.lz4_decompress(src.subarray(8), size);
+        if (shuffled === null) {
+            console.error("[incppect] malformed lz4 entry for", this.id_to_var[id]);
+            return false;
+        }
+
+        // byte planes of the 4-byte words
+        var m = size / 4;
+        var content = new Uint8Array(size);
+        for (var j = 0; j < m; ++j) {
+            content[4 * j + 0] = shuffled[j];
+            content[4 * j + 1] = shuffled[m + j];
+            content[4 * j + 2] = shuffled[2 * m + j];
+            content[4 * j + 3] = shuffled[3 * m + j];
+        }
+
+        var path = this.id_to_var[id];
+        if (flags & 1) {
+            // a diff of the previous content, which has the same size
+            if (!(path in this.vars_map) || this.vars_map[path].byteLength != size) {
+                console.error("[incppect] lz4 diff of", size, "bytes does not match", path);
+                return false;
+            }
+            var dst = new Uint8Array(this.vars_map[path]);
+            for (var i = 0; i < size; ++i) {
+                dst[i] ^= content[i];
+            }
+            this.vars_map[path].decoded = null;
+        } else {
+            this.vars_map[path] = content.buffer;
+        }
+        return true;
+    },
+
+    // LZ4 block format, the last sequence may be followed by the zero padding of the entry
+    lz4_decompress: function (src, size) {
+        var dst = new Uint8Array(size);
+        var i = 0;
+        var o = 0;
+        var n = src.length;
+        while (i < n) {
+            var token = src[i++];
+
+            var n_literals = token >> 4;
+            if (n_literals == 15) {
+                var b = 255;
+                while (b == 255 && i < n) {
+                    b = src[i++];
+                    n_literals += b;
+                }
+            }
+            if (n_literals > n - i || n_literals > size - o) {
+                return null;
+            }
+            dst.set(src.subarray(i, i + n_literals), o);
+            i += n_literals;
+            o += n_literals;
+
+            if (i == n || o == size) {
+                break;
+            }
+
+            var offset = src[i] | (src[i + 1] << 8);
+            i += 2;
+
+            var length = token & 0xf;
+            if (length == 15) {
+                var b = 255;
+                while (b == 255 && i < n) {
+                    b = src[i++];
+                    length += b;
+                }
+            }
+            length += 4;
+
+            if (offset == 0 || offset > o || length > size - o) {
+                return null;
+            }
+            for (var k = 0; k < length; ++k, ++o) {
+                dst[o] = dst[o - offset];
+            }
+        }
+
+        if (o != size || n - i > 3) {
+            return null;
+        }
+        for (; i < n; ++i) {
+            if (src[i] != 0) {
+                return null;
+            }
+        }
+        return dst;
+    },
+
     onerror: function (evt) {
         console.error("[incppect]", evt);
     },
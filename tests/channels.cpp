@@ -0,0 +1,118 @@
+/*! \file channels.cpp
+ *  \brief Broadcast channels of a server on loopback, viewed with incpp::Client
+ *
+ *  - three viewers with the same subscriptions share a channel, led by the first one
+ *  - the leader stops renewing its requests, like a page in a background tab: the others keep receiving the updates
+ *  - the leader renews them again and catches up
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "incppect/client.h"
+#include "incppect/incppect.h"
+
+using namespace incpp;
+
+static int n_errors = 0;
+
+void check(bool ok, const char* what, int a = 0, int b = 0)
+{
+   if (!ok && n_errors++ < 20) {
+      printf("error: %s: %d vs %d\n", what, a, b);
+   }
+}
+
+struct Viewer
+{
+   websocket ws;
+   Client client;
+   int32_t req = -1;
+
+   int32_t value() const { return client.vars[req].data.size() >= 4 ? client.value<int32_t>(req) : -1; }
+};
+
+int main()
+{
+   constexpr int kPort = 3117;
+
+   Parameters parameters;
+   parameters.port = kPort;
+   parameters.t_last_req_timeout_ms = 300;
+
+   std::atomic<int32_t> counter{0};
+   int32_t sampled = 0; // read by the loop only
+
+   Incppect<false> server;
+   server.var("/counter", [&](const std::vector<int>&) {
+      sampled = counter.load();
+      return view(sampled);
+   });
+   auto done = server.run_async(parameters);
+
+   std::vector<Viewer> viewers(3);
+
+   // ticks the active viewers every 50 ms, like incppect.js, and polls all of them for ms milliseconds
+   const auto run_for = [&](int ms, const std::vector<bool>& active) {
+      const auto t_end = std::chrono::steady_clock::now() + std::chrono::milliseconds(ms);
+      while (std::chrono::steady_clock::now() < t_end) {
+         ++counter;
+         for (size_t i = 0; i < viewers.size(); ++i) {
+            auto& v = viewers[i];
+            if (!v.ws.is_open()) {
+               continue;
+            }
+            v.ws.poll([&](std::string_view msg) { check(v.client.on_message(msg), "malformed message"); });
+            if (active[i]) {
+               v.client.tick();
+            }
+         }
+         std::this_thread::sleep_for(std::chrono::milliseconds(50));
+      }
+   };
+
+   const auto connect = [&](Viewer& v) {
+      for (int attempt = 0; attempt < 50 && !v.ws.connect("localhost", kPort); ++attempt) {
+         std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      }
+      check(v.ws.is_open(), "connect");
+      v.client.send = [&v](std::string_view msg) { v.ws.send(msg); };
+      v.req = v.client.subscribe("/counter");
+   };
+
+   // the first viewer joins first and leads the channel
+   connect(viewers[0]);
+   run_for(300, {true, false, false});
+   connect(viewers[1]);
+   connect(viewers[2]);
+   run_for(500, {true, true, true});
+   check(server.n_broadcasts.load() > 0, "no frame published to the channel");
+
+   const auto up_to_date = [&](const Viewer& v) { return v.value() >= counter.load() - 4; };
+   for (const auto& v : viewers) {
+      check(up_to_date(v), "viewer behind", v.value(), counter.load());
+   }
+
+   // the leader goes quiet, its requests expire after 300 ms
+   run_for(1000, {false, true, true});
+   check(up_to_date(viewers[1]) && up_to_date(viewers[2]), "followers behind the quiet leader",
+         std::min(viewers[1].value(), viewers[2].value()), counter.load());
+
+   run_for(500, {true, true, true});
+   for (const auto& v : viewers) {
+      check(up_to_date(v), "viewer behind after the leader is back", v.value(), counter.load());
+      check(v.client.stats.n_errors == 0, "client errors", int(v.client.stats.n_errors));
+   }
+
+   for (auto& v : viewers) {
+      v.ws.close();
+   }
+   server.stop();
+   done.wait();
+
+   printf("channels: %d errors\n", n_errors);
+   return n_errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+/*! \file lod.cpp
+ *  \brief lod::pyramid::range() and update() against a scalar reduction of the raw samples
+ *
+ *  Every kernel supported by the cpu is checked, with and without the pyramid, over random queries between random
+ *  modifications of the samples (invalidated incrementally, nan included) and changes of the array size.
+ */
+
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "incppect/lod.h"
+
+using namespace incpp;
+
+// envelope of [begin, end), one sample at a time
+lod::envelope reference(const std::vector<float>& data, size_t begin, size_t end)
+{
+   lod::envelope e{};
+   lod::minmax_scalar(data.data() + begin, end - begin, e);
+   return e;
+}
+
+int main()
+{
+   std::vector<simd::level> levels = {simd::level::scalar};
+   if (simd::best() >= simd::level::sse42) levels.push_back(simd::level::sse42);
+   if (simd::best() >= simd::level::avx2) levels.push_back(simd::level::avx2);
+
+   int n_errors = 0;
+   for (const auto level : levels) {
+      for (const bool use_pyramid : {true, false}) {
+         std::mt19937 rng(1234);
+         std::uniform_real_distribution<float> sample(-1.0f, 1.0f);
+
+         lod::pyramid p(lod::options{use_pyramid});
+         p.reduce = lod::minmax(level);
+
+         std::vector<float> data;
+         for (const size_t n : {1, 10, 63, 64, 65, 1000, 4096, 100003, 1 << 18}) {
+            data.resize(n);
+            for (auto& x : data) x = sample(rng);
+            p.invalidate();
+
+            for (int step = 0; step < 8; ++step) {
+               // a few samples, or a whole range, changed since the last query
+               const size_t i0 = rng() % n;
+               const size_t i1 = step % 2 ? std::min(n, i0 + 1 + rng() % 5000) : i0 + 1;
+               for (size_t i = i0; i < i1; ++i) data[i] = 4.0f * sample(rng);
+               if (step == 5) {
+                  data[i0] = std::numeric_limits<float>::quiet_NaN(); // skipped by all kernels
+               }
+               p.invalidate(i0, i1);
+
+               for (int q = 0; q < 32; ++q) {
+                  const size_t begin = rng() % n;
+                  const size_t end = begin + rng() % (n - begin + 1);
+                  const size_t n_points = 1 + rng() % 300;
+
+                  const auto& res = p.query(data, begin, end, n_points);
+                  for (size_t k = 0; k < res.size(); ++k) {
+                     const size_t b = begin + (end - begin) * k / res.size();
+                     const size_t e = begin + (end - begin) * (k + 1) / res.size();
+                     const auto ref = reference(data, b, e);
+                     if (res[k].min != ref.min || res[k].max != ref.max) {
+                        if (n_errors++ < 10) {
+                           printf("%s, pyramid %d, n %zu: [%zu, %zu) is [%g, %g] instead of [%g, %g]\n",
+                                  simd::name(level), use_pyramid, n, b, e, res[k].min, res[k].max, ref.min, ref.max);
+                        }
+                     }
+                  }
+
+                  // a single range, across the block edges
+                  const auto e = p.range(data, begin, end);
+                  const auto ref = reference(data, begin, end);
+                  if (e.min != ref.min || e.max != ref.max) {
+                     if (n_errors++ < 10) {
+                        printf("%s, pyramid %d, n %zu: range [%zu, %zu) is [%g, %g] instead of [%g, %g]\n",
+                               simd::name(level), use_pyramid, n, begin, end, e.min, e.max, ref.min, ref.max);
+                     }
+                  }
+               }
+            }
+         }
+      }
+   }
+
+   printf("lod: %d errors\n", n_errors);
+   return n_errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,124 @@
+/*! \file lz4.cpp
+ *  \brief Round trips of codec::lz4 and its decoder on malformed blocks
+ *
+ *  - random, repetitive and short (< 13 bytes, no match) inputs decompress to themselves, also with the zero padding
+ *    of the entries, and compress to at most lz4::bound() bytes
+ *  - truncated blocks are rejected, and so are blocks that decode to more than the expected size or are
+ *    followed by more than the padding
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+
+#include "incppect/codec.h"
+
+using namespace incpp;
+
+static int n_errors = 0;
+
+void check(bool ok, const char* what, size_t n)
+{
+   if (!ok && n_errors++ < 20) {
+      printf("error: %s, %zu bytes\n", what, n);
+   }
+}
+
+bool decompresses_to(const std::string& block, const std::string& expected)
+{
+   std::string out(expected.size(), '\x55');
+   return codec::lz4::decompress(block.data(), block.size(), out.data(), out.size()) && out == expected;
+}
+
+void round_trip(codec::lz4& c, const std::string& in)
+{
+   std::string block;
+   c.compress(in.data(), in.size(), block);
+   check(block.size() <= codec::lz4::bound(in.size()), "larger than the bound", in.size());
+   check(decompresses_to(block, in), "round trip", in.size());
+
+   // the entries are zero-padded to 4 bytes
+   const std::string padded = block + std::string((4 - block.size() % 4) % 4, '\0');
+   check(decompresses_to(padded, in), "round trip with padding", in.size());
+
+   if (in.empty()) {
+      return;
+   }
+
+   // every truncation of the small blocks, the last bytes and a sample of the others for the large ones
+   std::string out(in.size(), '\0');
+   const size_t stride = block.size() > 4096 ? block.size() / 64 : 1;
+   for (size_t k = 0; k < block.size(); k += k + 16 >= block.size() ? 1 : stride) {
+      check(!codec::lz4::decompress(block.data(), k, out.data(), out.size()), "truncated block accepted", in.size());
+   }
+
+   // a block with more than the expected size, or followed by more than the padding
+   check(!codec::lz4::decompress(block.data(), block.size(), out.data(), out.size() - 1), "over-long block accepted",
+         in.size());
+   const std::string extra = block + std::string(4, '\0');
+   check(!codec::lz4::decompress(extra.data(), extra.size(), out.data(), out.size()), "long padding accepted",
+         in.size());
+   const std::string garbage = block + '\x01';
+   check(!codec::lz4::decompress(garbage.data(), garbage.size(), out.data(), out.size()), "trailing data accepted",
+         in.size());
+}
+
+int main()
+{
+   std::mt19937 rng(1234);
+   codec::lz4 c;
+
+   // no match fits in fewer than 13 bytes
+   for (size_t n = 0; n < 13; ++n) {
+      std::string in(n, 'a');
+      round_trip(c, in);
+      for (auto& x : in) x = char(rng());
+      round_trip(c, in);
+   }
+
+   for (const size_t n : {13, 100, 4096, 65536, 1 << 20}) {
+      std::string in(n, '\0');
+
+      for (auto& x : in) x = char(rng()); // incompressible
+      round_trip(c, in);
+
+      for (size_t i = 0; i < n; ++i) in[i] = char(i % 7); // short period
+      round_trip(c, in);
+
+      std::fill(in.begin(), in.end(), 'x'); // one run, with lengths over 15 + 255
+      round_trip(c, in);
+
+      // copies of recent bytes, with offsets up to the window size
+      for (size_t i = 0; i < n; ++i) {
+         in[i] = i > 16 && rng() % 4 ? in[i - 1 - rng() % std::min<size_t>(i - 1, 65535)] : char(rng());
+      }
+      round_trip(c, in);
+
+      // byte-shuffled floats, as the codec sends them
+      std::string floats(n / 4 * 4, '\0');
+      for (size_t i = 0; i < floats.size() / 4; ++i) {
+         const float v = float(i % 1000) * 0.5f;
+         std::memcpy(floats.data() + 4 * i, &v, sizeof(v));
+      }
+      std::string shuffled(floats.size(), '\0'), unshuffled(floats.size(), '\0');
+      codec::shuffle(floats.data(), floats.size(), shuffled.data());
+      codec::unshuffle(shuffled.data(), shuffled.size(), unshuffled.data());
+      check(unshuffled == floats, "unshuffle", floats.size());
+      round_trip(c, shuffled);
+   }
+
+   // malformed tokens
+   std::string out(64, '\0');
+   const std::string zero_offset = std::string("\x14") + "a" + std::string("\x00\x00", 2);
+   check(!codec::lz4::decompress(zero_offset.data(), zero_offset.size(), out.data(), 5), "zero offset", 0);
+   const std::string far_offset = std::string("\x14") + "a" + std::string("\x02\x00", 2);
+   check(!codec::lz4::decompress(far_offset.data(), far_offset.size(), out.data(), 5), "offset before the start", 0);
+   const std::string long_literals = std::string("\xf0") + std::string(3, '\xff');
+   check(!codec::lz4::decompress(long_literals.data(), long_literals.size(), out.data(), out.size()),
+         "unterminated length", 0);
+
+   printf("lz4: %d errors\n", n_errors);
+   return n_errors == 0 ? 0 : 1;
+}
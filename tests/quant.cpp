@@ -0,0 +1,248 @@
+/*! \file quant.cpp
+ *  \brief The encodings of quant.h: kernels, round trips and malformed input
+ *
+ *  - the AVX2 kernels (fp16, bf16, int scaling) produce the same bits as the scalar ones, nan and inf included
+ *  - fp16, bf16, int16 and int8 arrays decode to the values they encode, within the precision of the encoding, for
+ *    blocks with nan and inf as well
+ *  - decode() rejects truncated arrays and unknown encodings
+ *
+ *  Usage: test-quant [--write cases.bin]
+ *
+ *  --write also saves the encoded arrays and their decoding, for the comparison with the decoder of incppect.js
+ *  (quant.js): n x [u32 encoded size][encoded][u32 ok][u32 n][n x f32 decoded]
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "incppect/quant.h"
+
+using namespace incpp;
+
+static int n_errors = 0;
+
+void check(bool ok, const char* what, size_t i, double a = 0.0, double b = 0.0)
+{
+   if (!ok && n_errors++ < 20) {
+      printf("error: %s at %zu: %g vs %g\n", what, i, a, b);
+   }
+}
+
+// the float patterns around the rounding points of the 16 bit conversions: every upper half with a set of lower ones
+std::vector<float> conversion_inputs()
+{
+   const uint32_t lows[] = {0x0000, 0x0001, 0x0fff, 0x1000, 0x1001, 0x1fff, 0x2000, 0x2001,
+                            0x7fff, 0x8000, 0x8001, 0xefff, 0xf000, 0xffff, 0x5555, 0xaaaa};
+   std::vector<float> v;
+   for (uint32_t hi = 0; hi < 0x10000; ++hi) {
+      for (const uint32_t lo : lows) {
+         v.push_back(std::bit_cast<float>(hi << 16 | lo));
+      }
+   }
+   return v;
+}
+
+// float arrays with nan and inf in some of their blocks
+std::vector<float> array_with_specials(size_t n, std::mt19937& rng)
+{
+   std::uniform_real_distribution<float> u(-100.0f, 100.0f);
+   std::vector<float> v(n);
+   for (auto& x : v) x = u(rng);
+
+   const float nan = std::numeric_limits<float>::quiet_NaN();
+   const float inf = std::numeric_limits<float>::infinity();
+   if (n > 3 * quant::kBlock) {
+      v[5] = nan; // a finite block with a nan
+      v[quant::kBlock + 7] = inf; // blocks with an infinity
+      v[2 * quant::kBlock + 9] = -inf;
+      for (size_t i = 3 * quant::kBlock; i < std::min(n, 4 * quant::kBlock); ++i) v[i] = nan; // all nan
+   }
+   return v;
+}
+
+void test_kernels()
+{
+   if (simd::best() < simd::level::avx2) {
+      printf("avx2 not supported, kernels not compared\n");
+      return;
+   }
+
+   const auto in = conversion_inputs();
+   std::vector<uint16_t> a(in.size()), b(in.size());
+
+   quant::fp16_scalar(in.data(), in.size(), a.data());
+   quant::fp16(simd::level::avx2)(in.data(), in.size(), b.data());
+   for (size_t i = 0; i < in.size(); ++i) check(a[i] == b[i], "fp16 avx2", i, a[i], b[i]);
+
+   quant::bf16_scalar(in.data(), in.size(), a.data());
+   quant::bf16(simd::level::avx2)(in.data(), in.size(), b.data());
+   for (size_t i = 0; i < in.size(); ++i) check(a[i] == b[i], "bf16 avx2", i, a[i], b[i]);
+
+   // the scaling, of values in and out of range, nan and inf
+   std::mt19937 rng(1);
+   std::uniform_real_distribution<float> u(-10.0f, 110.0f);
+   std::vector<float> v(4099);
+   for (auto& x : v) x = u(rng);
+   v[3] = std::numeric_limits<float>::quiet_NaN();
+   v[17] = std::numeric_limits<float>::infinity();
+   v[18] = -std::numeric_limits<float>::infinity();
+   v[33] = -std::numeric_limits<float>::quiet_NaN();
+   for (const float q_max : {255.0f, 65535.0f}) {
+      for (const float inv : {0.0f, q_max / 100.0f}) {
+         std::vector<uint16_t> qa(v.size()), qb(v.size());
+         quant::scale_scalar(v.data(), v.size(), 0.0f, inv, q_max, qa.data());
+         quant::scale(simd::level::avx2)(v.data(), v.size(), 0.0f, inv, q_max, qb.data());
+         for (size_t i = 0; i < v.size(); ++i) check(qa[i] == qb[i], "scale avx2", i, qa[i], qb[i]);
+         check(qa[3] == 0 && qa[33] == 0, "scale of nan", 3, qa[3], qa[33]);
+      }
+   }
+
+   // whole arrays, block bounds included
+   for (const auto enc :
+        {quant::encoding::fp16, quant::encoding::bf16, quant::encoding::int16, quant::encoding::int8}) {
+      const auto data = array_with_specials(5000, rng);
+      const std::string_view view{(const char*)data.data(), data.size() * sizeof(float)};
+      std::string ea, eb;
+      quant::scratch s;
+      quant::encode({enc}, view, ea, s, simd::level::scalar);
+      quant::encode({enc}, view, eb, s, simd::level::avx2);
+      check(ea == eb, "encode avx2", size_t(enc));
+   }
+}
+
+void test_round_trips(std::vector<std::string>& cases)
+{
+   std::mt19937 rng(2);
+   for (const size_t n : {0, 1, 255, 256, 257, 1000, 4096}) {
+      const auto data = array_with_specials(n, rng);
+      const std::string_view view{(const char*)data.data(), data.size() * sizeof(float)};
+
+      for (const auto enc :
+           {quant::encoding::fp16, quant::encoding::bf16, quant::encoding::int16, quant::encoding::int8}) {
+         std::string encoded;
+         quant::scratch s;
+         quant::encode({enc}, view, encoded, s);
+         check(encoded.size() == quant::encoded_size(enc, n), "encoded size", n, encoded.size());
+         cases.push_back(encoded);
+
+         std::vector<float> out;
+         if (!quant::decode(encoded, out) || out.size() != n) {
+            check(false, "decode", n, out.size());
+            continue;
+         }
+
+         for (size_t i = 0; i < n; ++i) {
+            const float x = data[i];
+            const float y = out[i];
+            if (enc == quant::encoding::fp16 || enc == quant::encoding::bf16) {
+               const float rel = enc == quant::encoding::fp16 ? 1.0f / 2048 : 1.0f / 256;
+               const bool ok = std::isnan(x)   ? std::isnan(y)
+                               : std::isinf(x) ? x == y
+                                               : std::abs(x - y) <= rel * std::abs(x);
+               check(ok, "fp16/bf16 round trip", i, x, y);
+               continue;
+            }
+
+            // a block with an infinity becomes zeros, a nan in a finite block becomes its min
+            const size_t b = i / quant::kBlock * quant::kBlock;
+            float lo = std::numeric_limits<float>::infinity(), hi = -lo;
+            bool finite = true;
+            for (size_t k = b; k < std::min(n, b + quant::kBlock); ++k) {
+               finite = finite && !std::isinf(data[k]);
+               if (!std::isnan(data[k])) {
+                  lo = std::min(lo, data[k]);
+                  hi = std::max(hi, data[k]);
+               }
+            }
+            if (!finite || lo > hi) {
+               check(y == 0.0f, "int block with inf or only nan", i, x, y);
+            }
+            else if (std::isnan(x)) {
+               check(y == lo, "int nan", i, lo, y);
+            }
+            else {
+               // half a step, and the rounding of the float arithmetic of both sides
+               const float step = (hi - lo) / (enc == quant::encoding::int16 ? 65535.0f : 255.0f);
+               const float eps = 8.0f * std::numeric_limits<float>::epsilon() * std::max(std::abs(lo), std::abs(hi));
+               check(std::abs(x - y) <= 0.5f * step + eps, "int round trip", i, x, y);
+            }
+         }
+      }
+   }
+
+   // doubles are converted to floats first
+   std::vector<double> doubles(1000);
+   for (size_t i = 0; i < doubles.size(); ++i) doubles[i] = std::sin(i * 0.01);
+   std::string encoded;
+   quant::scratch s;
+   quant::encode({quant::encoding::int16, true}, {(const char*)doubles.data(), doubles.size() * sizeof(double)},
+                 encoded, s);
+   std::vector<float> out;
+   check(quant::decode(encoded, out) && out.size() == doubles.size(), "decode f64", 0);
+   for (size_t i = 0; i < out.size(); ++i) check(std::abs(out[i] - doubles[i]) < 1e-4, "f64 round trip", i);
+}
+
+void test_malformed(std::vector<std::string>& cases)
+{
+   std::vector<float> data(1000, 1.0f);
+   std::string encoded;
+   quant::scratch s;
+   quant::encode({quant::encoding::int16}, {(const char*)data.data(), data.size() * sizeof(float)}, encoded, s);
+
+   std::vector<float> out;
+   const auto rejected = [&](std::string bad, const char* what) {
+      check(!quant::decode(bad, out), what, bad.size());
+      cases.push_back(std::move(bad));
+   };
+
+   rejected(encoded.substr(0, encoded.size() - 1), "truncated array");
+   rejected(encoded.substr(0, 6), "truncated header");
+
+   auto bad = encoded;
+   const uint32_t unknown = 5;
+   std::memcpy(bad.data(), &unknown, sizeof(unknown));
+   rejected(bad, "unknown encoding");
+
+   // a double whose low word looked like a header of the old in-band tag, with a huge n
+   bad = encoded;
+   const uint32_t huge[2] = {0x7fa51003, 0xffffffff};
+   std::memcpy(bad.data(), huge, sizeof(huge));
+   rejected(bad, "foreign header");
+
+   bad = encoded;
+   std::memcpy(bad.data() + 4, &huge[1], sizeof(uint32_t));
+   rejected(bad, "huge size");
+}
+
+int main(int argc, char** argv)
+{
+   std::vector<std::string> cases;
+
+   test_kernels();
+   test_round_trips(cases);
+   test_malformed(cases);
+
+   if (argc > 2 && std::string(argv[1]) == "--write") {
+      std::ofstream f(argv[2], std::ios::binary);
+      for (const auto& c : cases) {
+         std::vector<float> out;
+         const uint32_t ok = quant::decode(c, out) ? 1 : 0;
+         const uint32_t header[2] = {ok, uint32_t(out.size())};
+         const uint32_t size = c.size();
+         f.write((const char*)&size, sizeof(size));
+         f.write(c.data(), c.size());
+         f.write((const char*)header, sizeof(header));
+         f.write((const char*)out.data(), out.size() * sizeof(float));
+      }
+      printf("%zu cases written to '%s'\n", cases.size(), argv[2]);
+   }
+
+   printf("quant: %d errors\n", n_errors);
+   return n_errors == 0 ? 0 : 1;
+}
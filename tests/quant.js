@@ -0,0 +1,60 @@
+// decoder of the quantized arrays in incppect.js against the one of quant.h
+//
+// usage: node quant.js path/to/incppect.js cases.bin, with the cases written by test-quant --write
+
+const fs = require('fs');
+
+global.window = { location: { hostname: 'localhost', port: '3000' } };
+const incppect = eval('(' + fs.readFileSync(process.argv[2], 'utf8').replace(/^var incppect\s*=/, '') + ')');
+console.error = function () {}; // the malformed cases are expected to be reported
+
+const file = fs.readFileSync(process.argv[3]);
+const data = file.buffer.slice(file.byteOffset, file.byteOffset + file.length);
+const view = new DataView(data);
+
+var n_cases = 0;
+var n_errors = 0;
+for (var offset = 0; offset < data.byteLength; ++n_cases) {
+    const size = view.getUint32(offset, true);
+    const encoded = data.slice(offset + 4, offset + 4 + size);
+    offset += 4 + size;
+    const ok = view.getUint32(offset, true);
+    const n = view.getUint32(offset + 4, true);
+    const expected = new Float32Array(data.slice(offset + 8, offset + 8 + 4 * n));
+    offset += 8 + 4 * n;
+
+    // only the entries flagged by the server are decoded
+    if (incppect.is_quantized(encoded)) {
+        console.log('case', n_cases, 'decoded without the flag of its entry');
+        ++n_errors;
+    }
+    encoded.quantized = true;
+    const decoded = incppect.get_float_arr.call(Object.assign(Object.create(incppect), {
+        get: function () { return encoded; },
+    }), '/x');
+
+    if (!ok) {
+        if (decoded.length != 0) {
+            console.log('case', n_cases, 'malformed but decoded to', decoded.length, 'values');
+            ++n_errors;
+        }
+        continue;
+    }
+    if (decoded.length != expected.length) {
+        console.log('case', n_cases, 'size', decoded.length, 'instead of', expected.length);
+        ++n_errors;
+        continue;
+    }
+    for (var i = 0; i < n; ++i) {
+        const a = decoded[i];
+        const b = expected[i];
+        if (!(a === b || (isNaN(a) && isNaN(b)))) {
+            if (n_errors++ < 20) {
+                console.log('case', n_cases, 'value', i, a, 'instead of', b);
+            }
+        }
+    }
+}
+
+console.log('quant.js:', n_cases, 'cases,', n_errors, 'errors');
+process.exit(n_cases > 0 && n_errors == 0 ? 0 : 1);